@@ -0,0 +1,245 @@
+"""
+mdlj の strong / weak scaling ベンチマーク
+
+指定した規模の初期状態（格子または液体状の配置）と、rank数ごとに整合する計算条件
+ファイルを生成し、mdlj を mpirun で実行して、rootが出力するフェーズ別の所要時間
+("phase <name> <max> <avg>" の行) から並列化効率の表を作る。
+
+1台のLinuxマシン上でコア数を越えるrank数を起動する（oversubscribe）ことを前提に
+している。mpirun に渡す追加オプションは --mpirun-args で指定する。
+
+使い方の例 (md ディレクトリで):
+
+  make release
+  python3 bench/scaling_bench.py --mode strong --ranks 1,2,4,8 --atoms 32000
+  python3 bench/scaling_bench.py --mode weak --ranks 1,8,27 --atoms 4000 \\
+      --mpirun-args "--oversubscribe --allow-run-as-root"
+
+strong : 総分子数 --atoms を固定して rank 数を変える。効率 = T(p0)*p0 / (T(p)*p)
+weak   : rank あたりの分子数 --atoms を固定して rank 数を変える。効率 = T(p0) / T(p)
+"""
+
+import argparse
+import math
+import os
+import random
+import shlex
+import subprocess
+import sys
+
+# src-nompi/LJParams.cpp と同じ分子種の質量 [u]
+MOLECULE_MASS = {
+    "He": 4.0026022, "Ne": 20.17976, "Ar": 39.948, "Kr": 83.7982, "Xe": 131.2936,
+    "N2": 28.01344, "I2": 253.808946, "Hg": 200.592, "CCl4": 153.82358,
+}
+
+# 単位格子内の格子点（格子定数で規格化した座標）
+LATTICE_BASIS = {
+    "sc": [(0.0, 0.0, 0.0)],
+    "bcc": [(0.0, 0.0, 0.0), (0.5, 0.5, 0.5)],
+    "fcc": [(0.0, 0.0, 0.0), (0.5, 0.5, 0.0), (0.5, 0.0, 0.5), (0.0, 0.5, 0.5)],
+}
+
+K_BOLTZMANN = 1.380649e-23  # [J/K]
+M_AMU = 1.660538e-27        # [kg]
+
+# mdlj が出力するフェーズ名（include/PhaseTimer.h と揃える）
+PHASES = ["integrate", "migrate", "halo", "force", "output", "total"]
+
+
+def process_division(nprocs):
+    """nprocs を、できるだけ立方体に近い npx * npy * npz に分解する。"""
+    best = None
+    for npx in range(1, nprocs + 1):
+        if nprocs % npx:
+            continue
+        for npy in range(1, nprocs // npx + 1):
+            if (nprocs // npx) % npy:
+                continue
+            npz = nprocs // npx // npy
+            score = max(npx, npy, npz) - min(npx, npy, npz)
+            if best is None or score < best[0]:
+                best = (score, (npx, npy, npz))
+    return best[1]
+
+
+def write_initial_state(path, cells, lattice, a, species, temperature, seed):
+    """
+    cells = (nx, ny, nz) 個の単位格子からなる初期状態ファイルを書き、分子数を返す。
+    lattice が "liquid" の場合は fcc 格子点を乱数で揺らした配置とする。
+    速度は温度 temperature [K] の Maxwell-Boltzmann 分布から与え、重心速度は除く。
+    """
+    rng = random.Random(seed)
+    basis = LATTICE_BASIS["fcc" if lattice == "liquid" else lattice]
+    jitter = 0.04 * a if lattice == "liquid" else 0.0
+    mass = MOLECULE_MASS[species]
+    # 速度の標準偏差 [m/s] を [Angstrom/fs] に直す
+    sigma_v = math.sqrt(K_BOLTZMANN * temperature / (mass * M_AMU)) * 1.0e-5
+    nx, ny, nz = cells
+    # 格子点が箱やセルの境界にちょうど乗らないように、a/4 だけずらしておく
+    shift = 0.25 * a
+    lx, ly, lz = nx * a, ny * a, nz * a
+
+    records = []
+    for ix in range(nx):
+        for iy in range(ny):
+            for iz in range(nz):
+                for bx, by, bz in basis:
+                    x = (ix + bx) * a + shift + rng.uniform(-jitter, jitter)
+                    y = (iy + by) * a + shift + rng.uniform(-jitter, jitter)
+                    z = (iz + bz) * a + shift + rng.uniform(-jitter, jitter)
+                    v = [rng.gauss(0.0, sigma_v) for _ in range(3)]
+                    records.append([x % lx, y % ly, z % lz] + v)
+
+    n = len(records)
+    vcm = [sum(r[3 + k] for r in records) / n for k in range(3)]
+    with open(path, "w") as f:
+        for r in records:
+            f.write("%s %.10g %.10g %.10g %.10g %.10g %.10g\n" % (
+                species, r[0], r[1], r[2],
+                r[3] - vcm[0], r[4] - vcm[1], r[5] - vcm[2]))
+    return n
+
+
+def write_case(path, initial_state, box, division, cells_per_proc, args):
+    with open(path, "w") as f:
+        f.write("initial_state_file %s\n" % initial_state)
+        f.write("restart_file restart.xyz\n")
+        f.write("trajectory_file trajectory.xyz\n")
+        f.write("energy_file energy.txt\n")
+        f.write("box_size %.10g %.10g %.10g\n" % box)
+        f.write("process_division %d %d %d\n" % division)
+        f.write("cell_division %d %d %d\n" % cells_per_proc)
+        f.write("delta_t %g\n" % args.delta_t)
+        f.write("duration %g\n" % (args.delta_t * args.steps))
+        f.write("output_interval %d\n" % args.output_interval)
+        f.write("cutoff_radius %g\n" % args.cutoff)
+
+
+def prepare_run(nprocs, args, run_dir):
+    """rank数 nprocs のための初期状態と計算条件ファイルを run_dir に作る。"""
+    division = process_division(nprocs)
+    nbasis = len(LATTICE_BASIS["fcc" if args.lattice == "liquid" else args.lattice])
+    a = args.lattice_constant
+    if args.mode == "strong":
+        # 総分子数を固定した立方体の箱
+        n = max(1, int(round((args.atoms / nbasis) ** (1.0 / 3.0))))
+        cells = (n, n, n)
+    else:
+        # rankあたりの分子数を固定し、プロセス分割に合わせて箱を伸ばす
+        n = max(1, int(round((args.atoms / nbasis) ** (1.0 / 3.0))))
+        cells = (n * division[0], n * division[1], n * division[2])
+    box = (cells[0] * a, cells[1] * a, cells[2] * a)
+
+    # プロセスセルあたりのカットオフセル数。セルの一辺がカットオフ半径以上になる最大の数。
+    cells_per_proc = []
+    for length, np_ in zip(box, division):
+        plen = length / np_
+        nc = int(plen // args.cutoff)
+        if nc < 1:
+            raise ValueError(
+                "process box %.3g is smaller than cutoff %.3g for %d ranks %s" %
+                (plen, args.cutoff, nprocs, division))
+        cells_per_proc.append(nc)
+
+    os.makedirs(run_dir, exist_ok=True)
+    initial_state = os.path.join(run_dir, "initial_state.txt")
+    natoms = write_initial_state(initial_state, cells, args.lattice, a, args.species,
+                                 args.temperature, args.seed)
+    write_case(os.path.join(run_dir, "case.txt"), "initial_state.txt", box,
+               division, tuple(cells_per_proc), args)
+    return division, natoms
+
+
+def run_mdlj(nprocs, args, run_dir):
+    """mdlj を実行し、フェーズ名 -> (max, avg) の辞書を返す。"""
+    cmd = [args.mpirun] + shlex.split(args.mpirun_args) + \
+          ["-np", str(nprocs), os.path.abspath(args.mdlj), "case.txt"]
+    print("running: %s (in %s)" % (" ".join(cmd), run_dir), file=sys.stderr)
+    proc = subprocess.run(cmd, cwd=run_dir, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    with open(os.path.join(run_dir, "mdlj.out"), "w") as f:
+        f.write(proc.stdout)
+    if proc.returncode != 0:
+        raise RuntimeError("mdlj failed with %d ranks, see %s/mdlj.out" % (nprocs, run_dir))
+    timings = {}
+    for line in proc.stdout.splitlines():
+        words = line.split()
+        if len(words) == 4 and words[0] == "phase":
+            timings[words[1]] = (float(words[2]), float(words[3]))
+    if "total" not in timings:
+        raise RuntimeError("no phase timings in output, see %s/mdlj.out" % run_dir)
+    return timings
+
+
+def make_report(results, args):
+    """結果の表（markdown）を組み立てる。"""
+    base_p, _, _, base_t = results[0]
+    t0 = base_t["total"][0]
+    lines = []
+    lines.append("# mdlj %s scaling : %s %s, a = %g, cutoff = %g, %d steps" % (
+        args.mode, args.lattice, args.species, args.lattice_constant, args.cutoff, args.steps))
+    lines.append("")
+    header = ["ranks", "division", "atoms"] + ["%s[s]" % p for p in PHASES] + \
+             ["speedup", "efficiency"]
+    lines.append("| " + " | ".join(header) + " |")
+    lines.append("|" + "---|" * len(header))
+    for p, division, natoms, t in results:
+        tp = t["total"][0]
+        if args.mode == "strong":
+            speedup = t0 / tp
+            efficiency = t0 * base_p / (tp * p)
+        else:
+            speedup = t0 / tp * p / base_p
+            efficiency = t0 / tp
+        row = [str(p), "%dx%dx%d" % division, str(natoms)] + \
+              ["%.4g" % t.get(name, (0.0, 0.0))[0] for name in PHASES] + \
+              ["%.3f" % speedup, "%.3f" % efficiency]
+        lines.append("| " + " | ".join(row) + " |")
+    lines.append("")
+    lines.append("Phase times are the maximum over ranks.")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="strong/weak scaling benchmark for mdlj")
+    parser.add_argument("--mode", choices=["strong", "weak"], default="strong")
+    parser.add_argument("--ranks", default="1,2,4,8",
+                        help="comma separated list of rank counts")
+    parser.add_argument("--atoms", type=int, default=4000,
+                        help="total atoms (strong) or atoms per rank (weak)")
+    parser.add_argument("--lattice", choices=["sc", "bcc", "fcc", "liquid"], default="fcc")
+    parser.add_argument("--lattice-constant", type=float, default=5.26,
+                        help="lattice constant [Angstrom] (Ar fcc: 5.26)")
+    parser.add_argument("--species", choices=sorted(MOLECULE_MASS), default="Ar")
+    parser.add_argument("--temperature", type=float, default=80.0, help="[K]")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--cutoff", type=float, default=8.5, help="[Angstrom]")
+    parser.add_argument("--delta-t", type=float, default=2.0, help="[fs]")
+    parser.add_argument("--steps", type=int, default=200)
+    parser.add_argument("--output-interval", type=int, default=100)
+    parser.add_argument("--mdlj", default="Release/mdlj")
+    parser.add_argument("--mpirun", default="mpirun")
+    parser.add_argument("--mpirun-args", default="--oversubscribe")
+    parser.add_argument("--workdir", default="bench_runs")
+    parser.add_argument("--report", default=None,
+                        help="file to write the report to (default: <workdir>/<mode>_report.md)")
+    args = parser.parse_args()
+
+    ranks = [int(r) for r in args.ranks.split(",")]
+    results = []
+    for p in ranks:
+        run_dir = os.path.join(args.workdir, "%s_p%d" % (args.mode, p))
+        division, natoms = prepare_run(p, args, run_dir)
+        timings = run_mdlj(p, args, run_dir)
+        results.append((p, division, natoms, timings))
+
+    report = make_report(results, args)
+    report_path = args.report or os.path.join(args.workdir, "%s_report.md" % args.mode)
+    with open(report_path, "w") as f:
+        f.write(report)
+    print(report)
+
+
+if __name__ == "__main__":
+    main()
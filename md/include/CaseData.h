@@ -8,12 +8,15 @@
 #define CASEDATA_H_
 
 #include <string>
+#include <vector>
 
 #include <BoxXYZ.h>
 #include <GridIterator3d.h>
 #include <IoException.h>
 #include <DataException.h>
 
+class FileReader;
+
 /*
  * 計算条件ファイルで指定されたパラメタや、時間発展計算の進行度合いを
  * 保持するクラス
@@ -32,17 +35,62 @@ public:
     double duration_;         // time to continue simulation [fs]
     int output_interval_;     // trajectory is written once per output_interval steps
 
+    // optional parameters. these lines may follow cutoff_radius in any order.
+    bool trajectory_output_;  // "trajectory_output on|off" : write trajectory file or not (default on)
+    bool trajectory_positions_;  // "trajectory_fields pos|vel|both" : positions and/or velocities are
+    bool trajectory_velocities_; // gathered and written (default both)
+    bool trajectory_float_;      // "trajectory_precision float|double" : values are gathered to root
+                                 // in single precision (float) or not (default double)
+    long long trajectory_serial_min_; // "trajectory_serials first last" : only molecules with these serials
+    long long trajectory_serial_max_; // are written (default all : 0 and -1)
+    std::vector<std::string> trajectory_species_; // "trajectory_species name..." : only molecules of these
+                                                  // species are written (default all : empty)
+    int rdf_bins_;            // "rdf_bins n" : number of r^2 bins for the radial distribution function
+    int msd_levels_;          // "msd_levels n" : number of levels of the multiple-tau correlator
+    int msd_points_;          // "msd_points n" : number of points per level (even)
+    int msd_interval_;        // "msd_interval n" : msd/vacf are sampled once per msd_interval steps
+    bool node_placement_;     // "rank_placement cart|node" : place compact blocks of processes on
+                              // each shared-memory node (node), or leave it to MPI_Cart_create (default cart)
+    bool shared_memory_halo_; // "shared_memory_halo on|off" : exchange ghost positions with peers on the
+                              // same node through a shared-memory window (default on)
+    bool rma_halo_;           // "rma_halo on|off" : write ghost positions for peers on other nodes directly
+                              // into their exposed buffers with MPI_Put (default off)
+    double respa_inner_radius_; // "respa_inner_radius r" : split the force at r for r-RESPA integration.
+                                // the inner part is computed every step (default 0 : r-RESPA is not used)
+    double respa_switch_width_; // "respa_switch_width w" : the inner part is switched off smoothly
+                                // over [r - w, r] [Ang] (default 1)
+    int respa_steps_;           // "respa_steps k" : the outer part is computed once per k steps, and
+                                // output_interval must be a multiple of k (default 1)
+    double skin_width_;         // "skin_width s" : ghost molecules are kept for rebuild_interval steps. cells
+                                // must be at least cutoff_radius + s wide. if a molecule leaves its cell by more
+                                // than s/2 between rebuilds, all processes rebuild in that step and the interval
+                                // restarts from there [Ang] (default 0 : ghosts are rebuilt every step)
+    int rebuild_interval_;      // "rebuild_interval n" : molecules migrate and ghosts are rebuilt once per n
+                                // steps. in between, molecules may be written slightly outside the box (default 1)
+    double memory_limit_mb_;    // "memory_limit_mb m" : stop at startup if the estimated memory of any process
+                                // exceeds m [MB] (default 0 : not checked)
+    std::string initial_lattice_; // "initial_lattice sc|bcc|fcc a" : each process generates its own molecules on
+    double lattice_constant_;     // this lattice instead of reading initial_state_file. the box must be a whole
+                                  // number of unit cells of size a [Ang] (default empty : the file is read)
+    std::vector<std::string> initial_species_; // "initial_species name fraction..." : species of the generated
+    std::vector<double> initial_fractions_;    // molecules, chosen at random in these proportions (default He 1)
+    double initial_temperature_;         // "initial_temperature T seed" : generated velocities follow the
+    unsigned long long initial_seed_;    // Maxwell-Boltzmann distribution at T [K], drawn with the random seed
+                                         // (default 0 0 : at rest)
+
     // path names for data files
     std::string initial_state_file_path_;
     std::string restart_file_path_;
     std::string trajectory_file_path_;
     std::string energy_file_path_;
+    std::string rdf_file_path_;  // "rdf_file path" : empty if rdf is not requested
+    std::string msd_file_path_;  // "msd_file path" : empty if msd/vacf are not requested
 
     // about this simulation run
     GridRange3d allProcessesRange_;  // range including all processes in the simulation
 
     // about this process
-    int my_rank_;                  // rank number assigned by MPI
+    int my_rank_;                  // rank number in the process grid communicator
     int num_procs_;                // total number of processes
     BoxXYZ localBox_;              // the box that this process is assigned to. [Ang]
     GridIterator3d localProcess_;  // the process coordinate for this process.
@@ -51,6 +99,7 @@ public:
     // current state
     double t_;       // time within simulation [fs]
     int step_count_; // number of steps simulated.
+    int rebuild_step_; // the step of the last rebuild forced by a molecule beyond the skin.
 
     /*
      * Read case file and initialize.
@@ -64,8 +113,22 @@ public:
      */
     void readCaseFile(const char *file_name);
 
+    /*
+     * Read optional parameter lines that follow the mandatory ones.
+     * Called within readCaseFile.
+     * throws IoException, DataException.
+     */
+    void readOptionalParams(FileReader &rdr, const char *file_name);
+
+    /*
+     * Change the rank of this process, and recalculate the process coordinate and box.
+     * Called when the ranks are placed on the process grid communicator (see MdCommunicator).
+     */
+    void setMyRank(int rank);
+
     /*
      * Calculate the process coordinate for a given rank.
+     * Ranks are numbered x-major (z fastest), which is the row-major order of MPI_Cart_create.
      */
     void setProcessIteratorForRank(GridIndex3d *procIdx, int rank) const;
 
@@ -74,6 +137,21 @@ public:
      */
     int getRankForProcess(const GridIndex3d &procIdx) const;
 
+    /*
+     * Find the shape of the block of processes that one node of node_size processes takes.
+     * The block must tile the process grid. Among such shapes, the one with the smallest
+     * surface is chosen. Returns false if there is no such shape.
+     */
+    bool findNodeBlock(int node_size, GridIndex3d *block) const;
+
+    /*
+     * Calculate the process coordinate for the local-th process on the node-th node,
+     * when every node has node_size processes and takes one block (see findNodeBlock).
+     * Blocks are assigned to nodes x-major, and processes within a block x-major.
+     * Returns false if there is no such block shape.
+     */
+    bool setProcessIteratorForNodeRank(GridIndex3d *procIdx, int node, int local, int node_size) const;
+
     /*
      * Calculate the process cell box coordinates for a given process coordinate.
      */
@@ -99,6 +177,70 @@ public:
         return (step_count_ % output_interval_) == 0;
     }
 
+    /*
+     * test if the radial distribution function should be accumulated.
+     */
+    bool rdfRequested() const {
+        return !rdf_file_path_.empty();
+    }
+
+    /*
+     * test if the mean squared displacement and velocity autocorrelation should be accumulated.
+     */
+    bool msdRequested() const {
+        return !msd_file_path_.empty();
+    }
+
+    /*
+     * test if the force is split for r-RESPA integration.
+     */
+    bool respaRequested() const {
+        return respa_inner_radius_ > 0;
+    }
+
+    /*
+     * test if the outer part of the r-RESPA force should be computed in the current step.
+     */
+    bool isRespaOuterRound() const {
+        return respaRequested() && (step_count_ % respa_steps_) == 0;
+    }
+
+    /*
+     * test if the initial state is generated on a lattice instead of being read from the file.
+     */
+    bool latticeRequested() const {
+        return !initial_lattice_.empty();
+    }
+
+    /*
+     * test if ghost molecules are kept between rebuilds.
+     */
+    bool skinRequested() const {
+        return skin_width_ > 0;
+    }
+
+    /*
+     * test if molecules should migrate and ghosts should be rebuilt in the current step.
+     */
+    bool isRebuildRound() const {
+        return !skinRequested() || ((step_count_ - rebuild_step_) % rebuild_interval_) == 0;
+    }
+
+    /*
+     * record that molecules migrated and ghosts were rebuilt in the current step out of schedule.
+     * the next scheduled rebuild is rebuild_interval steps later.
+     */
+    void restartRebuildInterval() {
+        rebuild_step_ = step_count_;
+    }
+
+    /*
+     * test if the current step is one of the steps that we should sample msd/vacf.
+     */
+    bool isCorrelationRound() const {
+        return msdRequested() && (step_count_ % msd_interval_) == 0;
+    }
+
     /*
      * increment the recorded step count and simulated time.
      */
@@ -114,6 +256,11 @@ public:
         return my_rank_ == 0;
     }
 
+    /*
+     * throw DataException if memory_limit_mb is given and the estimated memory [byte] exceeds it.
+     */
+    void checkMemoryLimit(double bytes) const;
+
 };
 
 #endif /* CASEDATA_H_ */
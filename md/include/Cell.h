@@ -11,6 +11,7 @@
 #include <BoxXYZ.h>
 #include <Logger.h>
 #include <LJParams.h>
+#include <RdfAccumulator.h>
 
 /*
  * ローカルセルクラス
@@ -25,9 +26,15 @@ class Cell {
     // このセルの占有する直方体
     BoxXYZ cellBox_;
 
-    // このセルに属している粒子のリスト
+    // このセルに属している粒子のリスト。
+    // 同じ種類の粒子はリスト上で連続して並ぶように保つ（種類ごとの「区間」）。
+    // 力の計算では区間の組ごとにパラメタを一度だけ取り出し、最内ループでの表引きを避ける。
     ParticleList list_;
 
+    // 種類ごとの区間の先頭と末尾の粒子。その種類の粒子がなければNULL。
+    Particle *kindHead_[LJ_MOLECULE_TYPES];
+    Particle *kindTail_[LJ_MOLECULE_TYPES];
+
     // 隣接セルのオブジェクトへのポインタ。[1][1][1] は自身に相当し、未使用。
     Cell *neighborCells_[3][3][3];
 
@@ -35,11 +42,60 @@ class Cell {
     // 単位系は原子レベルのスケールに沿ったものとし、外部に出力する場面で巨視的なスケールに直すものとする
     double up_, uk_; // [u*Angstrom*fs^-2]
 
+    // 粒子をリストから外し、種類ごとの区間を更新する
+    void removeParticle(Particle *p);
+
+    // 種類ごとの区間をすべて空にする
+    void clearKindRanges() {
+        for (int k = 0; k < LJ_MOLECULE_TYPES; k++) {
+            kindHead_[k] = kindTail_[k] = NULL;
+        }
+    }
+
+    // 区間の組ごとの力の計算。[begin, end) の粒子と pi の間に働く力を計算する。
+    // calcPairBlock は両方の粒子に、calcPairBlockOneSide は pi にだけ力を加える。
+    // Range で力を計算する距離の範囲を切り替える（LJFullRange参照）。
+    template <class Range>
+    static void calcPairBlock(Particle *pi, Particle *begin, Particle *end,
+            const LJScaledMoleculePairParam &pair, double ci, double cj);
+    template <class Range>
+    static void calcPairBlockAndUp(Particle *pi, Particle *begin, Particle *end,
+            const LJScaledMoleculePairParam &pair, double ci, double cj,
+            double &up, RdfAccumulator *rdf);
+    template <class Range>
+    static void calcPairBlockOneSide(Particle *pi, Particle *begin, Particle *end,
+            const LJScaledMoleculePairParam &pair, double ci);
+    template <class Range>
+    static void calcPairBlockOneSideAndUp(Particle *pi, Particle *begin, Particle *end,
+            const LJScaledMoleculePairParam &pair, double ci,
+            double &up, RdfAccumulator *rdf);
+
+    // 力の計算と積分の本体。Kinds（LJMixedKinds または LJSingleKind）で種類ごとのパラメタの
+    // 取り出し方を、UPで結果出力回用か否かを、Rangeで力を計算する距離の範囲を切り替える。
+    template <bool UP, class Range, class Kinds>
+    void calcForceWithinSelfFor(const Kinds &kinds, RdfAccumulator *rdf);
+    template <bool UP, class Range, class Kinds>
+    void calcForceWithLocalCellFor(Cell *cell, const Kinds &kinds, RdfAccumulator *rdf);
+    template <bool UP, class Range, class Kinds>
+    void calcForceWithSurroundingCellFor(Cell *cell, const Kinds &kinds, RdfAccumulator *rdf);
+
+    // 系が単一種類か否かでKindsを選んで、上記の本体を呼ぶ。各公開メソッドから呼ぶ。
+    template <bool UP, class Range>
+    void calcForceWithinSelfIn(RdfAccumulator *rdf);
+    template <bool UP, class Range>
+    void calcForceWithLocalCellIn(Cell *cell, RdfAccumulator *rdf);
+    template <bool UP, class Range>
+    void calcForceWithSurroundingCellIn(Cell *cell, RdfAccumulator *rdf);
+    template <class Kinds>
+    void updateVelocityHalfAndCalcUkFor(const Kinds &kinds);
+
 public:
 
     // コンストラクタ
-    // ここには何も書かないが、メンバ変数のコンストラクタが自動的に実行される
-    Cell() {}
+    // メンバ変数のコンストラクタが自動的に実行された後で、種類ごとの区間を空にする
+    Cell() {
+        clearKindRanges();
+    }
 
     ~Cell() {}
 
@@ -80,13 +136,31 @@ public:
         //Logger::out << "Cell" << cellBox() << ".addParticle" << p->pos_ << std::endl;
 
         assert(cellBox_.contains(p->pos_)); // セルの範囲外の座標の粒子が渡されていないか確認する。
-        list_.add(p);
+        assert(p->kind_ >= 0 && p->kind_ < LJ_MOLECULE_TYPES);
+        int k = p->kind_;
+        if (kindTail_[k] == NULL) {
+            // この種類の最初の粒子なので、新しい区間としてリストの末尾に置く
+            list_.add(p);
+            kindHead_[k] = p;
+        } else {
+            // 同じ種類の区間の末尾に挿入する
+            list_.insertAfter(kindTail_[k], p);
+        }
+        kindTail_[k] = p;
     }
 
     // 当セルの粒子数をゼロにする。セルが周辺セルである場合に使うメソッド。
     // セルが保持している全粒子のリストをそっくりそのまま、渡された粒子リストにつなげ替える。
     void moveAllParticlesTo(ParticleList *freeParticleList) {
         list_.moveAllTo(freeParticleList);
+        clearKindRanges();
+    }
+
+    // 粒子リストを空にする。粒子はcallerが把握していて、addParticleで組み直すことが前提。
+    // 粒子の再配置（MdProcData::rebinParticles）で使う。
+    void detachAllParticles() {
+        list_.detachAll();
+        clearKindRanges();
     }
 
     // 当セルが保持する粒子リストの先頭の粒子オブジェクトを返す。
@@ -95,6 +169,12 @@ public:
         return list_.head();
     }
 
+    // 粒子pが属する種類の区間の次の粒子（区間の終端）を返す。最後の区間ならNULL。
+    // リストの先頭から p = kindRangeEnd(p) とたどると、区間の先頭を順に訪れる。
+    Particle *kindRangeEnd(const Particle *p) const {
+        return kindTail_[p->kind_]->next_;
+    }
+
     // セルが空かどうか判定する
     bool empty() const {
         return list_.isEmpty();
@@ -104,20 +184,26 @@ public:
     void clearForces();
     void clearUp();
 
-    // セルに属する粒子同士の間に働く力を計算する
-    void calcForceWithinSelf();
+    // r-RESPAの遠距離の部分の力の計算値を全てゼロにする
+    void clearSlowForces();
 
-    void calcForceWithinSelfAndUp();
+    // セルに属する粒子同士の間に働く力を計算する。
+    // rangeで、r-RESPAの近距離の部分、遠距離の部分だけを計算するように指定できる。
+    void calcForceWithinSelf(LJForceRange range = LJ_FORCE_FULL);
+
+    // ...AndUp は結果出力回用。rdfがNULLでなければ、動径分布関数の集計も合わせて行う。
+    // Upとrdfは全ての組について集計するので、rangeに LJ_FORCE_INNER は指定できない。
+    void calcForceWithinSelfAndUp(RdfAccumulator *rdf = NULL, LJForceRange range = LJ_FORCE_FULL);
 
     //ローカルセル内の隣接セルとの力計算
-    void calcForceWithLocalCell(Cell *cell);
+    void calcForceWithLocalCell(Cell *cell, LJForceRange range = LJ_FORCE_FULL);
 
-    void calcForceWithLocalCellAndUp(Cell *cell);
+    void calcForceWithLocalCellAndUp(Cell *cell, RdfAccumulator *rdf = NULL, LJForceRange range = LJ_FORCE_FULL);
 
     //周辺セルとの間の（プロセスをまたぐ）力計算
-    void calcForceWithSurroundingCell(Cell *cell);
+    void calcForceWithSurroundingCell(Cell *cell, LJForceRange range = LJ_FORCE_FULL);
 
-    void calcForceWithSurroundingCellAndUp(Cell *cell);
+    void calcForceWithSurroundingCellAndUp(Cell *cell, RdfAccumulator *rdf = NULL, LJForceRange range = LJ_FORCE_FULL);
 
     // 粒子の位置を更新する
     void updatePosition();
@@ -125,10 +211,17 @@ public:
     //粒子の速度を半分更新する
     void updateVelocityHalf();
 
+    // 粒子の速度を半分更新し、続けて位置を更新する（粒子ごとに一度の走査で行う）。
+    // 全ての粒子がセルの箱を各方向に margin だけ広げた範囲に留まっていれば true を返す。
+    bool updateVelocityHalfAndPosition(double margin = 0);
+
     void updateVelocityHalfAndCalcUk();
 
+    // r-RESPAの遠距離の部分の力で、steps ステップ分の時間の半分だけ速度を更新する
+    void updateVelocitySlow(double steps);
+
     //ポテンシャルの計算をする
-    VectorXYZ calcLJforce(VectorXYZ const *dist, double r_2, LJScaledMoleculePairParam const *pair);
+    static VectorXYZ calcLJforce(VectorXYZ const *dist, double r_2, LJScaledMoleculePairParam const *pair);
 
     // 位置を更新した結果、セルの範囲を逸脱してしまった粒子を隣接セルに移動させる。
     // シミュレーションの1ステップでそれ以上遠くのセルまで粒子が移動した場合はエラーとして
@@ -114,6 +114,11 @@ public:
     //   DataException : int 値の読み出しに失敗した
     void readInt(int &val, const char *label);
 
+    // バッファからlong long値を読み込む。分子の通し番号など、intの範囲を超えうる値に使う。
+    // 例外:
+    //   DataException : long long 値の読み出しに失敗した
+    void readLongLong(long long &val, const char *label);
+
     // バッファからint値を読み込み、期待している値と一致していることを確認する。
     // 通し番号など、ファイルの中の値が規則的に決まっている場合に、ずれが生じていないことを確認する場合に使う。
     // 例外:
@@ -125,6 +130,10 @@ public:
     //   DataException : 読み込みに失敗した
     void readString(std::string &val, const char *label);
 
+    // バッファから単語を一つ読み込む。行にもう単語が残っていなければfalseを返す。
+    // 省略可能な項目の行のように、行頭のキーワードによって読み方を変える場合に使う。
+    bool readWord(std::string &val);
+
 private:
 
     // stringstreamに、読み込み中のファイル名と行番号を、エラーメッセージに適する形式で書き加える。
@@ -12,6 +12,8 @@
 #include <CaseData.h>
 #include <Particle.h>
 
+#include <cmath>
+
 /*
  * 本プログラムがLennard Jonesポテンシャルのためのパラメタを保持している分子の種類の数
  */
@@ -77,8 +79,32 @@ public:
     static LJScaledMoleculePairParam PAIR_PARAMS_[LJ_MOLECULE_TYPES][LJ_MOLECULE_TYPES];
     static double CUTOFF_SQ_; /* square of cutoff distance */
 
+    /*
+     * r-RESPAで力を分ける距離（CaseData::respa_inner_radius_参照）。
+     * 近距離の部分の力は、切り替え関数 S(r) を掛けたもので、
+     * RESPA_SWITCH_START_ までは 1、respa_inner_radius_ から先は 0 になる。
+     * 遠距離の部分の力は、残りの (1 - S(r)) を掛けたもの。
+     */
+    static double RESPA_INNER_SQ_;         /* square of respa_inner_radius_ */
+    static double RESPA_SWITCH_START_;     /* [Angstrom] */
+    static double RESPA_SWITCH_SQ_;        /* square of RESPA_SWITCH_START_ */
+    static double RESPA_SWITCH_INV_WIDTH_; /* [Angstrom^-1] */
+
+    // 系の全分子が同一種類であればその分子種別番号、混合系であれば -1。
+    // 初期状態ファイルの読み込み時に判定する（MdProcData::readInitialStateFile参照）。
+    static int SINGLE_KIND_;
+
     static void initParams(CaseData *caseData);
 
+    // 切り替え関数 S(r)。r^2 >= RESPA_SWITCH_SQ_ の場合に使う。
+    static double respaSwitch(double r2) {
+        double x = (std::sqrt(r2) - RESPA_SWITCH_START_) * RESPA_SWITCH_INV_WIDTH_;
+        if (x >= 1) {
+            return 0;
+        }
+        return 1 - x * x * (3 - 2 * x);
+    }
+
     // 分子の種類を表す文字列から、分子種別番号を見つけ出す。
     // 例外:
     //   DataException: 分子名がみつからなかった場合。
@@ -86,4 +112,112 @@ public:
 
 };
 
+/*
+ * 力の計算と積分の処理（Cell参照）を、分子の種類に関するパラメタの取り出し方で
+ * 型引数化するためのポリシークラス。
+ *
+ * LJMixedKinds は混合系用で、分子種別番号でパラメタの表を引く。
+ * LJSingleKind は単一種類の系用で、パラメタをメンバに持つ定数として扱う。
+ * SINGLE が true の場合、セル内の種類ごとの区間はセル全体の一つだけである。
+ */
+struct LJMixedKinds {
+    static const bool SINGLE = false;
+
+    const LJScaledMoleculePairParam &pair(int ki, int kj) const {
+        return LJParams::PAIR_PARAMS_[ki][kj];
+    }
+
+    double dt2By2m(int k) const {
+        return LJParams::MOLECULE_PARAMS_[k].dt2_by_2m_;
+    }
+
+    double mBy2dt2(int k) const {
+        return LJParams::MOLECULE_PARAMS_[k].m_by_2dt2_;
+    }
+};
+
+struct LJSingleKind {
+    static const bool SINGLE = true;
+
+    LJScaledMoleculePairParam pair_;
+    double dt2_by_2m_;
+    double m_by_2dt2_;
+
+    explicit LJSingleKind(int kind)
+        : pair_(LJParams::PAIR_PARAMS_[kind][kind]),
+          dt2_by_2m_(LJParams::MOLECULE_PARAMS_[kind].dt2_by_2m_),
+          m_by_2dt2_(LJParams::MOLECULE_PARAMS_[kind].m_by_2dt2_) {}
+
+    const LJScaledMoleculePairParam &pair(int, int) const {
+        return pair_;
+    }
+
+    double dt2By2m(int) const {
+        return dt2_by_2m_;
+    }
+
+    double mBy2dt2(int) const {
+        return m_by_2dt2_;
+    }
+};
+
+/*
+ * 力の計算（Cell参照）で、力を計算する距離の範囲を指定する。
+ */
+enum LJForceRange {
+    LJ_FORCE_FULL,  // カットオフ距離までの力
+    LJ_FORCE_INNER, // r-RESPAの近距離の部分
+    LJ_FORCE_OUTER  // r-RESPAの遠距離の部分
+};
+
+/*
+ * 力の計算（Cell参照）を、力を計算する距離の範囲で型引数化するためのポリシークラス。
+ * contains は力を計算する組の判定、weight は力に掛ける重み、acc は力を加える先の変数。
+ *
+ * LJFullRange はカットオフ距離までの力そのもので、重みは定数1なので最内ループに余分な処理は残らない。
+ * LJInnerRange と LJOuterRange は r-RESPA 用で、両者の力の和は LJFullRange の力に等しい。
+ * 結果出力回の計算（UP）では、Upの集計のためにカットオフ距離までの全ての組を訪れ、weightだけを使う。
+ */
+struct LJFullRange {
+    static bool contains(double r2) {
+        return r2 < LJParams::CUTOFF_SQ_;
+    }
+
+    static double weight(double) {
+        return 1.0;
+    }
+
+    static VectorXYZ &acc(Particle *p) {
+        return p->a_dt2_half_;
+    }
+};
+
+struct LJInnerRange {
+    static bool contains(double r2) {
+        return r2 < LJParams::RESPA_INNER_SQ_;
+    }
+
+    static double weight(double r2) {
+        return (r2 < LJParams::RESPA_SWITCH_SQ_) ? 1.0 : LJParams::respaSwitch(r2);
+    }
+
+    static VectorXYZ &acc(Particle *p) {
+        return p->a_dt2_half_;
+    }
+};
+
+struct LJOuterRange {
+    static bool contains(double r2) {
+        return r2 >= LJParams::RESPA_SWITCH_SQ_ && r2 < LJParams::CUTOFF_SQ_;
+    }
+
+    static double weight(double r2) {
+        return (r2 < LJParams::RESPA_SWITCH_SQ_) ? 0.0 : 1.0 - LJParams::respaSwitch(r2);
+    }
+
+    static VectorXYZ &acc(Particle *p) {
+        return p->a_slow_dt2_half_;
+    }
+};
+
 #endif /* LJPARAMS_H_ */
@@ -0,0 +1,169 @@
+/*
+ * MdBatchData.h
+ *
+ */
+
+#ifndef MDBATCHDATA_H_
+#define MDBATCHDATA_H_
+
+#include <CaseData.h>
+#include <MdCommData.h>
+#include <LJParams.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+/*
+ * 同じ大きさの小さな系のレプリカを複数、同じ歩調で時間発展させるためのデータ（バッチ版）。
+ *
+ * 分子数が数百程度の系では、セルの管理とステップごとの処理の固定費が計算時間の大半を占める。
+ * そこでセルは使わずに、全ての分子の組について最小像の距離で力を計算する。
+ * 座標、速度、加速度は、分子ごとに全レプリカの分を連続して並べて保持し
+ * （添字は 分子の通し番号 * replicas_ + レプリカ番号）、組ごとの最内ループを
+ * レプリカについて回す。最内ループには表引きも分岐もないので、コンパイラがベクトル化できる。
+ *
+ * 全レプリカで、箱の大きさと分子数、通し番号ごとの分子の種類は同じでなければならない。
+ * レプリカごとに異なるのは初期状態ファイルの座標と速度である。
+ * 最小像で組を一つに定めるため、箱の各辺はカットオフ半径の2倍以上とする。
+ */
+class MdBatchData {
+
+    friend class TestMdBatchData;
+
+    /*
+     * 計算条件
+     */
+    CaseData *caseData_;
+
+    /*
+     * トラジェクトリーに出力する分子の判定に使う（MdCommData::isTrajectoryMolecule）
+     */
+    MdCommData *commData_;
+
+    // レプリカの数
+    int replicas_;
+
+    // 一つのレプリカの分子数
+    int molecule_count_;
+
+    // 一つのレプリカのうち、トラジェクトリーに出力する分子の数
+    int trajectory_molecule_count_;
+
+    // 通し番号ごとの分子種別番号（全レプリカ共通）
+    std::vector<int> kinds_;
+
+    // 座標 [Angstrom]
+    std::vector<double> x_, y_, z_;
+
+    // 速度*Δt [Angstrom]（Particle::vel_dt_ と同じ）
+    std::vector<double> vx_, vy_, vz_;
+
+    // 加速度*Δt^2/2 [Angstrom]（Particle::a_dt2_half_ と同じ）
+    std::vector<double> ax_, ay_, az_;
+
+    // レプリカごとの運動エネルギー、ポテンシャルエネルギー [aeu]。結果出力回にだけ求める。
+    std::vector<double> uk_, up_;
+
+    // レプリカごとの出力ファイル
+    std::vector<std::ofstream *> tfiles_;
+    std::vector<std::ofstream *> efiles_;
+
+    /*
+     * 初期状態ファイルを一つ読み込み、分子の種類と座標、速度*Δt を
+     * ファイルの順に kinds, xv（分子一つあたり6個）に追加する。
+     * 例外:
+     *   IoException: ファイルが開けない場合。
+     *   DataException: 内容の誤り、箱の外の分子がある場合。
+     */
+    void readInitialStateFile(const std::string &path, std::vector<int> &kinds, std::vector<double> &xv);
+
+    /*
+     * 分子i, jの組の力を全レプリカについて計算し、加速度に加える。
+     * UPがtrueであれば、ポテンシャルエネルギーも集計する。
+     */
+    template <bool UP>
+    void calcPairForce(int i, int j);
+
+public:
+
+    MdBatchData();
+
+    ~MdBatchData();
+
+    /*
+     * レプリカごとの初期状態ファイルを読み込み、初期化する。
+     * 例外:
+     *   IoException, DataException: ファイルの読み込みに失敗した場合、
+     *   レプリカの分子数や種類の並びが揃っていない場合、箱がカットオフ半径の2倍より小さい場合。
+     */
+    void init(CaseData *caseData, MdCommData *commData, const std::vector<std::string> &state_files);
+
+    int replicaCount() const {
+        return replicas_;
+    }
+
+    int getMoleculeCount() const {
+        return molecule_count_;
+    }
+
+    /*
+     * 保持するデータのおおよそのメモリ量 [byte]
+     */
+    double estimateMemoryBytes() const;
+
+    /*
+     * 全レプリカの分子間力を計算する。upがtrueであれば、ポテンシャルエネルギーも集計する。
+     */
+    void calcForce(bool up = false);
+
+    /*
+     * a(t) と v(t) から v(t+Δt/2) を計算する。
+     */
+    void updateVelocityHalf();
+
+    /*
+     * v(t+Δt/2) を計算し、続けて位置を更新する。箱を出た分子は周期境界の反対側に折り返す。
+     */
+    void updateVelocityHalfAndPosition();
+
+    /*
+     * v(t+Δt) を計算し、運動エネルギーを集計する。
+     */
+    void updateVelocityHalfAndCalcUk();
+
+    double uk(int replica) const {
+        return uk_[replica];
+    }
+
+    double up(int replica) const {
+        return up_[replica];
+    }
+
+    /*
+     * レプリカの出力ファイルのパス。拡張子があればその前に、なければ末尾に、".レプリカ番号" を付ける。
+     * 例: "energy.txt" のレプリカ3は "energy.3.txt"
+     */
+    static std::string outputPathFor(const std::string &path, int replica);
+
+    /*
+     * 計算条件ファイルのトラジェクトリー、エネルギーの出力ファイルをレプリカごとに開く。
+     * 例外:
+     *   IoException: ファイルが開けない場合。
+     */
+    void openOutputFiles();
+
+    void closeOutputFiles();
+
+    /*
+     * 全レプリカのトラジェクトリーを、それぞれのファイルに書く（MdCommData::writeTrajectoryと同じ形式）。
+     */
+    void writeTrajectory();
+
+    /*
+     * 全レプリカのエネルギーを、それぞれのファイルに書く（MdCommData::writeTotalEnergyと同じ形式）。
+     */
+    void writeEnergy();
+};
+
+#endif /* MDBATCHDATA_H_ */
@@ -10,13 +10,18 @@
 #include <GridIterator3d.h>
 #include <Cell.h>
 #include <LJParams.h>
+#include <RdfAccumulator.h>
+#include <MultiTauCorrelator.h>
 #include <Logger.h>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <stdint.h>
 
 /*
- * トラジェクトリー出力用に分子のデータを授受するための構造体
+ * rootにおいて、トラジェクトリー出力用に分子のデータを保持するための構造体。
+ * rootへの送受信は、出力する項目だけを詰めたレコードで行う（MdCommData::addTrajectoryDataFrom参照）。
+ * 出力しない項目はゼロになる。
  */
 struct CommMoleculeTrajData {
     /*
@@ -26,7 +31,7 @@ struct CommMoleculeTrajData {
     /*
      * 分子の通し番号
      */
-    int serial_;
+    long long serial_;
     /*
      * 座標 [Angstrom]
      */
@@ -43,45 +48,44 @@ struct CommMoleculeTrajData {
 std::ostream &operator<<(std::ostream &os, const CommMoleculeTrajData &data);
 
 /*
- * プロセス間の移転のために分子のデータを授受するための構造体
+ * 周辺セル用に分子の座標を授受するための構造体（16バイト）
+ *
+ * 座標は、セルの原点からのセル内の相対位置を32ビットの固定小数点数で表す。
+ * 送信側は自身の表面セルの原点を、受信側はそれに対応する自身の周辺セルの原点を基準にするので、
+ * 周期境界の補正量を加える必要がない。復元した座標は、量子化の区間の中央とするので、
+ * 誤差はセルの辺の長さの 2^-33 倍以内であり、必ず受信側のセルの範囲内に収まる。
  */
-struct CommMoleculeFullData {
-    /*
-     * 分子種別番号 (See LJParams.cpp)
-     */
-    int kind_;
-    /*
-     * 分子の通し番号
-     */
-    int serial_;
-    /*
-     * 座標 [Angstrom]
-     */
-    double rx_, ry_, rz_;
+struct CommMoleculePosData {
     /*
-     * 速度×Δt [Angstrom]
+     * セル内の相対位置 [セルの辺の長さ * 2^-32]
      */
-    double vdtx_, vdty_, vdtz_;
+    uint32_t qx_, qy_, qz_;
     /*
-     * 加速度×Δt^2
+     * 分子種別番号 (See LJParams.cpp)
      */
-    double adt2x_, adt2y_, adt2z_;
-};
-
-/*
- * デバッグ用に上記構造体を印字するためのオペレータ
- */
-std::ostream &operator<<(std::ostream &os, const CommMoleculeFullData &data);
+    unsigned char kind_;
 
-struct CommMoleculePosData {
     /*
-     * 分子種別番号 (See LJParams.cpp)
+     * 座標xを、セルの下限lo、辺の長さの逆数inv_lenに対する固定小数点数に変換する
      */
-    int kind_;
+    static uint32_t quantize(double x, double lo, double inv_len) {
+        double f = (x - lo) * inv_len * 4294967296.0; // 2^32
+        // 境界の丸め誤差で範囲外になった場合は、端の値にする
+        if (f < 0) {
+            return 0;
+        }
+        if (f >= 4294967295.0) {
+            return 4294967295u;
+        }
+        return (uint32_t)f;
+    }
+
     /*
-     * 座標 [Angstrom]
+     * quantizeの逆変換。セルの下限lo、辺の長さlenに対する座標を返す。
      */
-    double rx_, ry_, rz_;
+    static double dequantize(uint32_t q, double lo, double len) {
+        return lo + (q + 0.5) * (len / 4294967296.0);
+    }
 };
 
 /*
@@ -107,19 +111,6 @@ public:
      * 相手から受信する分子数
      */
     size_t recv_count_;
-    /*
-     * 送信データにつけるMPIのタグ値
-     * 動作テストなどにおいて、MPIのプロセス総数が少ない場合、例えば2x2x2=8プロセスのような場合、
-     * 左隣のプロセスと、右隣のプロセスが、周期境界条件によって同一のプロセスになってしまう。
-     * そのような場合に、左向けに送出したデータと、右向けに送出したデータを、受信側で正しく区別
-     * できるようにするためには、データを送り出す26の方位ごとに別々のタグ値を割り振る必要がある。
-     */
-    int tag_for_send_;
-    /*
-     * 受信データとして受け入れるタグ値
-     */
-    int tag_for_recv_;
-
     /*
      * 送信データの個数の配列
      * 受信した側で、受信した分子のデータを簡単にセルに分配できるように、送信側と受信側で全く
@@ -133,39 +124,41 @@ public:
      */
     std::vector<int> recv_count_per_cell_;
     /*
-     * プロセス間の分子の移転のための送信分子のデータ
+     * プロセス間の分子の移転で送り出す粒子。
+     * 粒子のデータは中間バッファに詰め替えず、Particleオブジェクトから直接送信する
+     * （MdCommunicator::exchangeMoleculeFullData参照）。送信が完了するまで、
+     * これらの粒子はどのセルにも属さず、解放もされない。
+     * 座標は送信側のものなので、受信側で周期境界の補正を行う。
      */
-    std::vector <CommMoleculeFullData> send_molecule_full_;
+    std::vector <Particle *> send_particles_;
     /*
-     * プロセス間の分子の移転のための受信分子のデータ
+     * プロセス間の分子の移転で受け入れる粒子。受信データはこれらのParticleオブジェクトに直接書き込まれる。
+     * 加速度は移転の直後に計算し直すので送受信しない。
      */
-    std::vector <CommMoleculeFullData> recv_molecule_full_;
+    std::vector <Particle *> recv_particles_;
 
     std::vector <CommMoleculePosData> send_molecule_pos_;
 
     std::vector <CommMoleculePosData> recv_molecule_pos_;
 
-    VectorXYZ offset;
-
     /*
-     * 当バッファの相手先rankと送受信用のtag値を設定する。
-     * 初期化の過程で呼ばれる。
+     * MSD/VACFを集計する場合に、移転する分子に付随して送受信する、分子ごとの相関の状態。
+     * 分子一つあたり MultiTauCorrelator::stateSize() 個の値を、send_particles_ と同じ順に並べる。
      */
-    void setRankAndTags(int rank, int tag_for_send, int tag_for_recv);
+    std::vector<double> send_correlator_state_;
 
-    /*
-     * 送信用のタグ値を取得する
-     */
-    int tagForSend() const {
-        return tag_for_send_;
-    }
+    std::vector<double> recv_correlator_state_;
+
+    VectorXYZ offset;
 
     /*
-     * 受信用のタグ値を取得する
+     * 当バッファの相手先rankを設定する。
+     * 初期化の過程で呼ばれる。
+     * 動作テストなどでプロセス総数が少ない場合、例えば2x2x2=8プロセスの場合には、左隣と右隣の
+     * プロセスが周期境界条件によって同一のプロセスになる。それらの方位のデータの区別は、
+     * 通信クラスが方位の順序によって行う（MdCommunicator::initNeighborTopology参照）。
      */
-    int tagForRecv() const {
-        return tag_for_recv_;
-    }
+    void setRank(int rank);
 
     /*
      * 分子の移転用の送信バッファをクリアする。
@@ -175,11 +168,16 @@ public:
     void clearSendMoleculePosBuffer();
 
     /*
-     * 引数のcellに属する全分子のデータを分子の移転用のバッファに追加する。
+     * 引数のcellに属する全分子をcellから外し、移転用の送信粒子に追加する。
      */
     void addMoleculeFullDataFrom(Cell *cell);
 
-    void addMoleculePosDataFrom(Cell *cell);
+    /*
+     * 引数のcellに属する全分子の座標を、座標送信用のバッファに追加する。
+     * 座標はセルの各辺をmarginだけ両側に広げた範囲に対して量子化する。再構築の間の
+     * 座標の更新で、セルの外に少しはみ出した分子の座標も送れるようにするため。
+     */
+    void addMoleculePosDataFrom(Cell *cell, double margin = 0);
 
     /*
      * 送信分子数をベクターから取得して個数送信用の変数に格納する
@@ -189,8 +187,8 @@ public:
     void setMoleculePosDataSendCount();
 
     /*
-     * セル別の受信分子数を合計して、これから受信する分子データの総数を算出し、
-     * それに合わせて受信バッファのサイズを設定する。
+     * セル別の受信分子数を合計して、これから受信する分子データの総数を算出する。
+     * 受信用の粒子の割り当ては MdCommData::allocateRecvParticles で行う。
      */
     void setMoleculeFullDataRecvBuffer();
 
@@ -202,6 +200,16 @@ public:
     void setOffsetForSending(double x, double y, double z);
 };
 
+/*
+ * rootに集約する、系全体で合計すべき物理量の種類。
+ * 全て一つの配列に並べて、一回の集約で送る。物理量を増やす場合は ENERGY_TERMS の前に追加する。
+ */
+enum EnergyTerm {
+    ENERGY_UK = 0, // 運動エネルギー [u*Angstrom^2*fs^-2]
+    ENERGY_UP,     // ポテンシャルエネルギー [u*Angstrom^2*fs^-2]
+    ENERGY_TERMS   // 物理量の種類数
+};
+
 /*
  * 通信データクラス
  */
@@ -213,17 +221,14 @@ public:
 
     int num_procs_;
 
-    double total_uk_;
-
-    double total_up_;
-
-    double send_uk_;
+    // 各rankでの部分和。集約が完了するまで書き換えてはいけない。
+    double send_energy_[ENERGY_TERMS];
 
-    double send_up_;
+    // rootにおける集約結果
+    double recv_energy_[ENERGY_TERMS];
 
-    double recv_uk_;
-
-    double recv_up_;
+    // 集約中（または集約済みで未出力）のエネルギーの時刻 [fs]
+    double energy_time_;
 
     // トラジェクトリーファイル
     std::fstream tfile_;
@@ -231,31 +236,96 @@ public:
     // エネルギーファイル
     std::fstream efile_;
 
-    // 各プロセスからrank=0プロセスに向けて分子の情報をトラジェクトリー出力用に送るためのベクター
-    std::vector <CommMoleculeTrajData> send_molecule_traj_;
+    /*
+     * トラジェクトリーの送受信レコードの並び。レコードの大きさは traj_record_size_。
+     *   [0]  通し番号 (long long)
+     *   [8]  分子種別番号 (int)
+     *   [12] 座標、速度のうち出力するもの。traj_values_ 個の float または double
+     * 値は境界をそろえずに詰めているので、memcpy で読み書きする。
+     */
+    static const size_t TRAJ_SERIAL_OFFSET = 0;
+    static const size_t TRAJ_KIND_OFFSET = 8;
+    static const size_t TRAJ_VALUES_OFFSET = 12;
+
+    // トラジェクトリーの送受信レコード一つのバイト数（8の倍数に切り上げたもの）
+    size_t traj_record_size_;
+
+    // トラジェクトリーの送受信レコード一つに含める値の個数（3 または 6）
+    int traj_values_;
+
+    // 種類ごとに、トラジェクトリーに出力するか（trajectory_species）
+    bool traj_kinds_[LJ_MOLECULE_TYPES];
 
-    // rank=0において、他のプロセスから送られてくる1プロセス分の分子の情報を受信するためのベクター
-    std::vector <CommMoleculeTrajData> recv_molecule_traj_;
+    // trajectory_species で種類を絞り込んでいればtrue
+    bool traj_species_filter_;
 
-    // rank=0において、系の全分子の情報を保持するためのベクター
+    // 各プロセスからrank=0プロセスに向けて分子の情報をトラジェクトリー出力用に送るためのレコードの列
+    std::vector<char> send_molecule_traj_;
+
+    // rank=0において、他のプロセスから送られてくる分子の情報を受信するためのレコードの列
+    std::vector<char> recv_molecule_traj_;
+
+    // トラジェクトリーの収集中の、自rankの送信粒子数（収集が完了するまで書き換えてはいけない）
+    int traj_send_count_;
+
+    // rank=0において、トラジェクトリーの収集で各rankから受け取る粒子数と、受信バッファ内の位置
+    std::vector<int> traj_recv_counts_;
+    std::vector<int> traj_recv_displs_;
+
+    // rank=0において、トラジェクトリーに出力する全分子の情報を、通し番号順に保持するためのベクター
     std::vector <CommMoleculeTrajData> all_molecule_traj_;
 
     // 26方位の隣接プロセスに向けた送受信バッファ
     MdCommPeerBuffer peerBuffers_[3][3][3];
 
+    // 未使用のParticleのストック（MdProcData::freeParticleList_）。NULLの場合はnew/deleteする。
+    ParticleList *particle_pool_;
+
+    // 結果出力回に集計する動径分布関数。rootでは、集約後の値を保持する。
+    RdfAccumulator rdf_;
+
+    // 平均二乗変位と速度自己相関関数の集計。rootでは、集約後の値を保持する。
+    MultiTauCorrelator correlator_;
+
     // 初期化
     void init(CaseData *caseData);
 
     // 指定方位の隣接プロセスに向けた通信バッファオブジェクトを取得する
     MdCommPeerBuffer *bufferFor(const GridIndex3d &idx);
 
-    // 引数のローカルセル内の全分子のデータをトラジェクトリー用の送信バッファに転記する
+    // Particleを一つ割り当てる。ストックに在庫があればそれを再利用する。
+    Particle *allocateParticle();
+
+    // peerの受信分子数(recv_count_)の分だけ、受信用の粒子を割り当てる
+    void allocateRecvParticles(MdCommPeerBuffer *peer);
+
+    // 送信の完了した移転用の粒子をストックに戻し、送信バッファを空にする
+    void releaseSentParticles(MdCommPeerBuffer *peer);
+
+    // 計算条件から、トラジェクトリーの送受信レコードの形式と、出力する分子の種類を決める
+    void initTrajectoryFormat();
+
+    // トラジェクトリーに出力する分子か（trajectory_serials, trajectory_species）
+    bool isTrajectoryMolecule(int kind, long long serial) const {
+        return traj_kinds_[kind] && serial >= caseData_->trajectory_serial_min_ &&
+                (caseData_->trajectory_serial_max_ < 0 || serial <= caseData_->trajectory_serial_max_);
+    }
+
+    // 引数のローカルセル内の分子のうち、トラジェクトリーに出力するもののデータを送信バッファに転記する
     void addTrajectoryDataFrom(Cell *cell);
 
+    // トラジェクトリー用の送信バッファのレコード数
+    size_t sendTrajectoryCount() const {
+        return send_molecule_traj_.size() / traj_record_size_;
+    }
+
+    // トラジェクトリーの送受信レコード一つを、出力用の構造体に展開する
+    void unpackTrajectoryRecord(const char *rec, CommMoleculeTrajData *data) const;
+
     // rank=0において、自プロセスで送信バッファに格納したデータを、自プロセスの受信バッファに転記する
     void appendSendTrajectoryDataToRecvTrajectoryData();
 
-    // rank=0において、トラジェクトリーデータ用の受信バッファを十分な量割り当てる
+    // rank=0において、トラジェクトリーデータ用の受信バッファをcountレコード分割り当てる
     void setRecvTrajectoryBufferSize(size_t count);
 
     // トラジェクトリー用の送信バッファを空にする
@@ -266,11 +336,11 @@ public:
     //（カウンタをゼロにするだけでメモリの開放はしない）
     void clearRecvTrajectory();
 
-    // 全分子のトラジェクトリー用データを保持するベクターの長さを設定する
+    // トラジェクトリーに出力する全分子のデータを保持するベクターの長さを設定する
     // この中でメモリ領域の割り当てが行われる。
-    void setAllMoleculeCount(int all_atom_count);
+    void setAllMoleculeCount(long long all_molecule_count);
 
-    // root=0において、他のいずれかのプロセスから受信した、１プロセス分の分子データを
+    // root=0において、他のプロセスから受信した分子データを
     // 個々の分子の通し番号に基づいて、全分子用の配列の該当箇所に転記する。
     void orderRecvTrajectoryToAllTrajectory();
 
@@ -283,8 +353,14 @@ public:
     // 全分子のトラジェクトリーをトラジェクトリーファイルに追記する。
     void writeTrajectory();
 
-    // 総エネルギーをエネルギーファイルに追記する
+    // 集約済みの総エネルギーを、集約を開始した時点の時刻とともにエネルギーファイルに追記する
     void writeTotalEnergy();
+
+    // rootにおいて、集約済みの動径分布関数を出力ファイルに書く
+    void writeRdf();
+
+    // rootにおいて、集約済みのMSD/VACFを出力ファイルに書く
+    void writeCorrelations();
 };
 
 
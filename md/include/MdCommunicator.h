@@ -12,11 +12,44 @@
 
 #include <mpi.h>
 
+/*
+ * 近傍集団通信（MPI_Neighbor_alltoallw）の、近傍ごとの送受信データの指定。
+ * データのアドレスは MPI_BOTTOM からの変位として持つので、近傍ごとに別々の配列を
+ * そのまま指定できる。非ブロッキングの通信では、完了するまで書き換えてはいけない。
+ */
+struct MdNeighborBlocks {
+    int send_counts_[26];
+    MPI_Aint send_displs_[26];
+    MPI_Datatype send_types_[26];
+    int recv_counts_[26];
+    MPI_Aint recv_displs_[26];
+    MPI_Datatype recv_types_[26];
+
+    // 第k近傍に送るデータの先頭アドレス、個数、型を設定する。addrにはMPI_BOTTOMも指定できる。
+    void setSend(int k, const void *addr, int count, MPI_Datatype type);
+
+    // 第k近傍から受け取るデータの先頭アドレス、個数、型を設定する。
+    void setRecv(int k, void *addr, int count, MPI_Datatype type);
+
+    // 設定した型を全て解放する（通信ごとに作った型の場合）
+    void freeTypes();
+};
+
 /*
  * 通信処理を実行するクラス
  */
 class MdCommunicator {
 
+    friend class TestMdCommunicator;
+
+public:
+    /*
+     * 隣接プロセスの方位の数
+     */
+    static const int NEIGHBORS = 26;
+
+private:
+
     /*
      * MPIのライブラリにユーザ定義のデータ型を登録する時に与えられるコードを保持しておく変数
      * 本プログラムではいくつかの構造体(struct)の構造をMPIに登録して、MPIで送受信するデータ型
@@ -32,16 +65,147 @@ class MdCommunicator {
      */
     CaseData *caseData_;
 
+    /*
+     * 実行中のエネルギーの集約（MPI_Ireduce）の完了待ち用
+     */
+    MPI_Request energy_request_;
+
+    /*
+     * エネルギーの集約を開始して、まだ完了を確認していなければtrue
+     */
+    bool energy_pending_;
+
+    /*
+     * 実行中のトラジェクトリーの収集の完了待ち用。
+     * [0] 粒子数の収集（MPI_Igather）、[1] 粒子データの収集（MPI_Igatherv）。
+     * 一対一で収集する場合は、[1] が自身の送信（MPI_Isend）で、rootでは
+     * [2 + rank] が各rankからの受信（MPI_Irecv）。
+     */
+    std::vector<MPI_Request> traj_requests_;
+
+    /*
+     * トラジェクトリーの粒子データを、MPI_Igathervではなく一対一の通信で収集するならtrue。
+     * 系全体の分子数がintの範囲を超えると、MPI_Igathervの受信位置を表せないので
+     * （initTrajectoryGather参照）。
+     */
+    bool traj_point_to_point_;
+
+    /*
+     * 一対一で収集する場合のメッセージのタグ
+     */
+    static const int TRAJ_TAG = 1;
+
+    /*
+     * トラジェクトリーの収集を開始して、まだ完了を確認していなければtrue
+     */
+    bool traj_pending_;
+
     /*
      * 送受信データ
      */
     MdCommData *commData_;
 
+    /*
+     * このジョブ（アンサンブル実行ではレプリカ）の全プロセスのコミュニケータ。
+     * プロセス格子のコミュニケータは、これを元に作る。
+     */
+    MPI_Comm world_;
+
+    /*
+     * プロセス格子のCartesianトポロジーのコミュニケータ（initProcessComm参照）。
+     * 全ての通信はこのコミュニケータ（またはこれから作ったもの）で行い、rankはこのコミュニケータでの番号。
+     */
+    MPI_Comm comm_;
+
+    /*
+     * 26方位の隣接プロセスを登録した分散グラフトポロジーのコミュニケータ（initNeighborTopology参照）
+     */
+    MPI_Comm neighbor_comm_;
+
+    /*
+     * 近傍集団通信の第k近傍への送信に使うバッファと、第k近傍からの受信に使うバッファ
+     */
+    MdCommPeerBuffer *send_peers_[NEIGHBORS];
+    MdCommPeerBuffer *recv_peers_[NEIGHBORS];
+
+    /*
+     * 近傍集団通信の送受信データの指定。
+     * セル別の粒子数、移転する粒子、分子ごとの相関の状態、周辺セルの座標用。
+     */
+    MdNeighborBlocks count_blocks_;
+    MdNeighborBlocks particle_blocks_;
+    MdNeighborBlocks state_blocks_;
+    MdNeighborBlocks pos_blocks_;
+
+    /*
+     * 共有メモリを介した周辺セルの座標の授受（initSharedHalo参照）
+     */
+    // 区画のヘッダの int の個数（第k近傍ごとに4個）
+    static const int HALO_HEADER_INTS = NEIGHBORS * 4;
+    // 同じノードのプロセスを集めたコミュニケータ
+    MPI_Comm node_comm_;
+    // 第k近傍への送信先、第k近傍からの受信元の、node_comm_でのrank。ノード外なら MPI_UNDEFINED
+    int dest_node_rank_[NEIGHBORS];
+    int src_node_rank_[NEIGHBORS];
+    // 共有メモリのウィンドウと、自身の区画の先頭、大きさ [バイト]
+    MPI_Win halo_win_;
+    char *halo_segment_;
+    MPI_Aint halo_capacity_;
+    // 第k近傍からの受信元の区画の先頭（同じノードの場合）
+    char *src_segment_[NEIGHBORS];
+
+    /*
+     * 一方向通信（MPI_Put）による周辺セルの座標の授受（initRmaHalo参照）
+     */
+    // rma_halo on の場合にtrue
+    bool rma_active_;
+    // 受信用の領域を公開する動的ウィンドウ
+    MPI_Win rma_win_;
+    // post-start-complete-wait の相手。受信元（ノード外）と送信先（ノード外）のグループ
+    MPI_Group rma_src_group_;
+    MPI_Group rma_dest_group_;
+    // 第k近傍からの受信用の領域と、格納できる粒子数
+    char *rma_recv_seg_[NEIGHBORS];
+    MPI_Aint rma_recv_cap_[NEIGHBORS];
+    // 第k近傍への送信先の領域のアドレスと、格納できる粒子数
+    MPI_Aint rma_target_addr_[NEIGHBORS];
+    MPI_Aint rma_target_cap_[NEIGHBORS];
+    // 一つの方位に面するセルの数の上限
+    int rma_max_cells_;
+    // 第k近傍に書き込むヘッダ（粒子数の合計と、セル別の粒子数）
+    std::vector<int> rma_send_header_[NEIGHBORS];
+
+    // 第k近傍への送信、第k近傍からの受信を、共有メモリで行うか
+    bool sendsShared(int k) const {
+        return dest_node_rank_[k] != MPI_UNDEFINED;
+    }
+    bool recvsShared(int k) const {
+        return src_node_rank_[k] != MPI_UNDEFINED;
+    }
+
+    // 第k近傍への送信、第k近傍からの受信を、一方向通信で行うか
+    bool sendsRma(int k) const {
+        return rma_active_ && !sendsShared(k);
+    }
+    bool recvsRma(int k) const {
+        return rma_active_ && !recvsShared(k);
+    }
+
+    // 受信用の領域のヘッダのバイト数
+    int rmaHeaderBytes() const;
+
+    /*
+     * particlesの各粒子の移転用のメンバーを、粒子のアドレス（MPI_BOTTOM基準）で並べた型を作る。
+     * 呼び出し側で MPI_Type_free すること。
+     */
+    static MPI_Datatype createParticleListType(std::vector<Particle *> &particles);
+
 public:
     /*
-     * 初期化する
+     * 初期化する。worldには、このジョブ（アンサンブル実行ではレプリカ）の全プロセスの
+     * コミュニケータを渡す。
      */
-    void init(CaseData *caseData, MdCommData *commData_);
+    void init(CaseData *caseData, MdCommData *commData_, MPI_Comm world = MPI_COMM_WORLD);
 
     /*
      * MPIにデータを登録する。
@@ -49,28 +213,141 @@ public:
      */
     void initMpiTypes();
 
+    /*
+     * プロセス格子のコミュニケータを作り、caseDataの自身のrankとプロセス座標を
+     * そのコミュニケータでのものに設定し直す。initメソッドの最初に呼ぶ。
+     */
+    void initProcessComm();
+
+    /*
+     * rank_placement node の場合に、ノードごとにプロセス格子のブロックを受け持つように
+     * rankを付け直したコミュニケータを作る。適用できない場合は MPI_COMM_NULL を返す。
+     */
+    MPI_Comm createNodeBlockComm();
+
+    /*
+     * 隣接プロセスのうち同じノードにいるものを調べ、共有メモリを介した座標の授受を準備する。
+     * initNeighborTopologyの後に呼ぶ。
+     */
+    void initSharedHalo();
+
+    /*
+     * 共有メモリのウィンドウを、各rankの区画がbytesバイトになるように割り当て直す。
+     * ノード内の全rankで呼ぶこと。
+     */
+    void allocateHaloWindow(MPI_Aint bytes);
+
+    /*
+     * 同じノードの相手に向けた周辺セルの座標を自身の区画に書き込み、
+     * ノード内の全rankの書き込みの完了を待つ。
+     * ノード内の全rankで呼ぶこと（同じノードの相手がいないrankも含む）。
+     */
+    void publishHaloSegment();
+
+    /*
+     * ノード外の隣接プロセスとの座標の授受を一方向通信で行う準備をする。
+     * initSharedHaloの後に呼ぶ。
+     */
+    void initRmaHalo();
+
+    /*
+     * 第k近傍からの受信用に、capacity個の粒子を格納できる領域を確保してウィンドウに公開する。
+     */
+    void attachRmaRecvSegment(int k, MPI_Aint capacity);
+
+    /*
+     * ノード外の相手に向けた周辺セルの座標を、相手の受信用の領域に書き込み、
+     * 自身の受信用の領域に書き込まれたものを受信バッファに取り出す。
+     */
+    void exchangeRmaHalo();
+
+    /*
+     * 26方位の隣接プロセスを分散グラフトポロジーとしてMPIに登録する。
+     * initメソッドから、各方位のバッファの相手rankを設定した後に呼ぶ。
+     */
+    void initNeighborTopology();
+
     /*
      * プロセス間の分子の移転の送受信を実行する
      */
     void exchangeMoleculeFullData();
 
     /*
-     * プロセス間の表面セルの分子の座標、原子の種類の送受信を実行する
+     * プロセス間の表面セルの分子の座標、原子の種類の送受信を実行する。
+     * refreshの場合（再構築の間の座標の更新）は、各相手からの分子数が前回の再構築の回から
+     * 変わらないので、メッセージで送受信する相手とは粒子数の配列を送り合わない。
      */
-    void exchangeMoleculePosData();
+    void exchangeMoleculePosData(bool refresh = false);
 
     /*
-     * トラジェクトリーデータをルートrankプロセスに送る
+     * 通信の終了処理。MPI_Finalizeの前に呼ぶ。
      */
-    void sendTrajectroyDataToRoot();
+    void finalize();
 
     /*
-     * ルートrankプロセスにおいて、各プロセスから送られてくる
-     * トラジェクトリーデータを受信する。
+     * 各rankのトラジェクトリー送信バッファ(commData_->send_molecule_traj_)の内容を
+     * rootの受信バッファ(commData_->recv_molecule_traj_)に収集する通信を開始する。
+     * 粒子数をMPI_Igatherで集め、rootはその完了だけを待ってMPI_Igathervを発行する。
+     * 粒子データの収集の完了は待たない。送信バッファは、finishTrajectoryGatherを
+     * 呼ぶまで書き換えてはいけない。
      */
-    void recvTrajectoryDataAtRoot();
+    void startTrajectoryGather();
 
-    void calcEnergy();
+    /*
+     * 系全体の分子数から、トラジェクトリーの収集方法を決める。全rankで同じ値を渡すこと。
+     */
+    void initTrajectoryGather(long long molecule_count);
+
+    /*
+     * startTrajectoryGatherで開始した収集の完了を待ち、送信バッファを空にする。
+     * 収集中のものがあればtrueを返し、rootでは全分子のトラジェクトリー配列に
+     * 通し番号順に転記済みになっている。収集中のものがなければ何もせずにfalseを返す。
+     */
+    bool finishTrajectoryGather();
+
+    /*
+     * 各rankのエネルギーの部分和(commData_->send_energy_)をrootに集約する通信を開始する。
+     * 完了は待たない。send_energy_は、finishEnergyReductionを呼ぶまで書き換えてはいけない。
+     */
+    void startEnergyReduction();
+
+    /*
+     * startEnergyReductionで開始した集約の完了を待つ。
+     * 集約中のものがあればtrueを返し、rootではcommData_->recv_energy_に結果が入っている。
+     * 集約中のものがなければ何もせずにfalseを返す。
+     */
+    bool finishEnergyReduction();
+
+    /*
+     * 各rankのcount個の計測時間localを、rootにおいて最大値tmaxと合計値tsumに集約する。
+     * tmax, tsumはrootでのみ有効。
+     */
+    void reduceTimes(const double *local, double *tmax, double *tsum, int count);
+
+    /*
+     * 各rankのvalueの最大値を全rankで求める
+     */
+    double maxOverRanks(double value);
+
+    /*
+     * いずれかのrankのvalueがtrueであるかを全rankで求める
+     */
+    bool anyOverRanks(bool value);
+
+    /*
+     * 各rankのn個の値valuesの合計を全rankで求め、valuesに上書きする
+     */
+    void sumOverRanks(double *values, int n);
+
+    /*
+     * 各rankで集計した動径分布関数をrootに集約する。集約結果はrootのcommData_->rdf_に残る。
+     */
+    void reduceRdf();
+
+    /*
+     * 各rankで集計したMSD/VACFをrootに集約する。集約結果はrootのcommData_->correlator_に残る。
+     */
+    void reduceCorrelations();
 };
 
 #endif /* COMMUNICATOR_H_ */
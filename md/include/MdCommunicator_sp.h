@@ -11,7 +11,8 @@
 #include <MdCommData.h>
 
 /*
- * 通信処理を実行するクラス
+ * 通信処理を実行するクラス（シングルプロセス版）。
+ * 周期境界での分子の折り返しと周辺セルの像は、MdProcData がセル間で直接扱う。
  */
 class MdCommunicator_sp {
 
@@ -31,11 +32,6 @@ public:
      */
     void init(CaseData *caseData, MdCommData *commData_);
 
-    /*
-     * プロセス間の分子の移転の送受信を実行する
-     */
-    void exchangeMoleculeFullData();
-
     /*
      * ルートrankプロセスにおいて、各プロセスから送られてくる
      * トラジェクトリーデータを受信する。
@@ -11,6 +11,7 @@
 #include <MdCommData.h>
 #include <MdProcData.h>
 #include <MdCommunicator.h>
+#include <PhaseTimer.h>
 
 /*
  * ドライバークラス。
@@ -34,6 +35,10 @@ class MdDriver {
      * 送受信処理実行クラス
      */
     MdCommunicator communicator_;
+    /*
+     * フェーズ別の経過時間の計測
+     */
+    PhaseTimer timer_;
 
 public:
 
@@ -42,9 +47,10 @@ public:
     MdDriver();
 
     /*
-     * 初期化
+     * 初期化。worldには、このジョブ（アンサンブル実行ではレプリカ）の全プロセスの
+     * コミュニケータを渡す。
      */
-    void init(CaseData *caseData);
+    void init(CaseData *caseData, MPI_Comm world = MPI_COMM_WORLD);
 
     /*
      * 時間発展計算を１ステップ実行し、ファイルにデータを出力すべき回次であれば
@@ -55,10 +61,37 @@ public:
     void doStepWithoutOutput();
     void doInitialStep();
 
+    /*
+     * 分子間力を計算する。r-RESPAでは近距離の部分を計算し、outerがtrueであれば遠距離の部分も計算する。
+     * kickがtrueなら、（近距離の部分の）力の計算に続けて速度を半分更新する。
+     */
+    void calcForces(bool outer, bool kick = false);
+
+    /*
+     * 結果出力回で分子間力の計算とエネルギー計算をする。
+     */
+    void calcForcesAndUp();
+
+    /*
+     * 集約中のエネルギーがあれば集約の完了を待ち、rootではエネルギーファイルに書く。
+     */
+    void flushEnergyData();
+
+    /*
+     * 収集中のトラジェクトリーがあれば収集の完了を待ち、rootではトラジェクトリーファイルに書く。
+     */
+    void flushTrajectoryData();
+
     /*
      * 所望の回数、時間発展処理を実行し終えた後で、ファイルのクローズなどの後処理を行う。
      */
     void finalize();
+
+    /*
+     * フェーズ別の経過時間を全rankで集約し、rootで標準出力に書き出す。
+     * 全rankから呼ぶこと。
+     */
+    void reportPhaseTimes();
 };
 
 #endif /* MDDRIVER_H_ */
@@ -0,0 +1,64 @@
+#ifndef _MDDRIVER_BATCH_H
+#define _MDDRIVER_BATCH_H
+
+#include <CaseData.h>
+#include <MdCommData.h>
+#include <MdBatchData.h>
+
+#include <vector>
+#include <string>
+
+/*
+ * バッチ版ドライバークラス。
+ *
+ * 同じ計算条件で初期状態だけが異なる小さな系のレプリカを、一つのプロセスで
+ * 同じ歩調で時間発展させる（MdBatchData参照）。ステップの進め方と出力の回次はマルチプロセス版
+ * （mdlj.cpp のループと MdDriver）と同じで、レプリカごとにトラジェクトリーとエネルギーを出力する。
+ *
+ * r-RESPA、動径分布関数、MSD/VACF の集計には対応しない。
+ */
+class MdDriver_batch {
+    /*
+     * 計算条件
+     */
+    CaseData *caseData_;
+    /*
+     * トラジェクトリーに出力する分子の判定に使う
+     */
+    MdCommData commData_;
+    /*
+     * 全レプリカの計算対象データ
+     */
+    MdBatchData batchData_;
+
+public:
+
+    /*
+     * 初期化。state_files はレプリカごとの初期状態ファイル。
+     * 例外:
+     *   IoException, DataException: 読み込みに失敗した場合、対応しない計算条件が指定された場合。
+     */
+    void init(CaseData *caseData, const std::vector<std::string> &state_files);
+
+    /*
+     * 最初の回の処理。初期状態での力を求め、速度を半分更新する。
+     */
+    void doInitialStep();
+
+    /*
+     * 時間発展計算を１ステップ実行し、エネルギーとトラジェクトリーをファイルに出力する。
+     */
+    void doStepWithOutput();
+
+    /*
+     * 時間発展計算を１ステップ実行する。
+     */
+    void doStepWithoutOutput();
+
+    /*
+     * 所望の回数、時間発展処理を実行し終えた後で、ファイルのクローズなどの後処理を行う。
+     */
+    void finalize();
+};
+
+#endif
@@ -38,6 +38,9 @@ public:
 
     /*
      * 初期化
+     * 例外:
+     *   IoException, DataException: 読み込みに失敗した場合、対応しない計算条件
+     *   （r-RESPA、スキン）が指定された場合。
      */
     void init(CaseData *caseData);
 
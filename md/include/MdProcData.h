@@ -13,6 +13,27 @@
 #include <GridIterator3d.h>
 #include <vector>
 
+/*
+ * 力の計算で処理するセルの組の種類
+ */
+enum CellPairKind {
+    CELL_PAIR_SELF,         // セルの中の粒子同士
+    CELL_PAIR_LOCAL,        // 隣接するローカルセルとの間（作用反作用の両方を加える）
+    CELL_PAIR_SURROUNDING,  // 周辺セルとの間（自セルの粒子にだけ加える）
+    CELL_PAIR_KICK          // 組ではなく、ここまででセルの力が揃ったことを表す印
+};
+
+/*
+ * 力の計算で処理するセルの組。CELL_PAIR_SELF, CELL_PAIR_KICK では other_ は cell_ と同じ。
+ */
+struct CellPair {
+    Cell *cell_;
+    Cell *other_;
+    CellPairKind kind_;
+
+    CellPair(Cell *cell, Cell *other, CellPairKind kind) : cell_(cell), other_(other), kind_(kind) {}
+};
+
 /*
  * per process data クラス
  * 1プロセスがシミュレーションの範囲のデータを保持するクラス
@@ -52,6 +73,16 @@ class MdProcData {
      * 方位別の周辺セルを覆うレンジ
      */
     GridRange3d surroundingRanges_[3][3][3];
+    /*
+     * 方位別の表面セル、周辺セルの cells_ 上の添字を、レンジを GridIterator3d で
+     * たどる順に並べたもの。通信の前後で毎ステップたどるので initRanges で作っておく。
+     */
+    std::vector<int> surfaceCells_[3][3][3];
+    std::vector<int> surroundingCells_[3][3][3];
+    /*
+     * 全方位の周辺セルの cells_ 上の添字
+     */
+    std::vector<int> allSurroundingCells_;
     /*
      * 周辺セルの分を含んだセルの個数
      */
@@ -61,7 +92,72 @@ class MdProcData {
      * シミュレーション対象の分子の総数。
      * 全プロセスに分配される分子の総数。
      */
-    int total_molecule_count_;
+    long long total_molecule_count_;
+
+    /*
+     * 初期状態ファイルから本プロセスが取り込んだ（または生成した）分子の数
+     */
+    long long local_molecule_count_;
+
+    /*
+     * トラジェクトリーに出力する分子の総数（trajectory_serials, trajectory_species で絞り込んだもの）
+     * 初期状態を生成した場合は、finishGeneratedState で全rankの和を設定するまでは本プロセスの分。
+     */
+    long long trajectory_molecule_count_;
+
+    /*
+     * 周期境界の折り返し（wrapExitingMolecules）で、周辺セルから外した粒子の作業用配列
+     */
+    std::vector<Particle *> wrap_particles_;
+
+    /*
+     * 粒子の再配置（rebinParticles）の作業用配列。毎ステップ使うので、領域は使い回す。
+     */
+    std::vector<Particle *> rebin_particles_; // ローカルセルから収集した粒子
+    std::vector<int> rebin_src_;              // 収集元のセルの一次元添字
+    std::vector<int> rebin_dest_;             // 移動先のセルの一次元添字
+    std::vector<int> rebin_start_;            // 移動先のセルごとの、rebin_sorted_での開始位置
+    std::vector<int> rebin_fill_;             // 移動先のセルごとの、rebin_sorted_への次の書き込み位置
+    std::vector<Particle *> rebin_sorted_;    // 移動先のセル順に並べ替えた粒子
+
+    /*
+     * 位置を更新した後で、全ローカルセルの粒子を所属すべきセルに一括して配置し直す。
+     * 移動先のセルを求め、セルごとの数のヒストグラムと累積和から、移動先のセル順に
+     * 粒子を並べ替え（計数ソート）、各セルの粒子リストを一度に組み直す。
+     * 1ステップで隣接セルより遠くへ移動した粒子はエラーとする（assertによる確認）。
+     */
+    void rebinParticles();
+
+    /*
+     * rebinParticles の後半。rebin_particles_, rebin_src_, rebin_dest_ に収集した粒子を、
+     * 移動先のセル順に並べ替え、各セルの粒子リストを組み直す。
+     */
+    void relinkRebinnedParticles();
+
+    /*
+     * 表面セルcellの分子の座標を、peerの座標送信バッファに追加する。
+     * デバッグ版では、分子がセルの各辺をmarginだけ広げた範囲に収まっていることを確かめる。
+     */
+    void addSurfacingMoleculePosData(MdCommPeerBuffer *peer, Cell *cell, double margin);
+
+    /*
+     * 力の計算で処理するセルの組の並び。initCellPairs で一度だけ作る。
+     * ローカルセルの辞書順に、セル自身、辞書順で前の隣接ローカルセル、周辺セルとの組を並べ、
+     * その後に、そこまでの組で力が揃ったセルの CELL_PAIR_KICK を並べる。
+     */
+    std::vector<CellPair> cellPairs_;
+
+    /*
+     * cellPairs_ を作る。initCells から呼ばれる。
+     * セルの力は、辞書順で最後の隣接ローカルセル（各軸の添字に1を足し、ローカルセルの範囲で
+     * 頭打ちにしたセル）の組を処理した時に揃う。
+     */
+    void initCellPairs();
+
+    /*
+     * 力の計算の前に、rangeの力を加える変数を0にする
+     */
+    void clearForcesFor(Cell *cell, LJForceRange range);
 
 public:
 
@@ -93,6 +189,26 @@ public:
      */
     void readInitialStateFile();
 
+    /*
+     * 計算条件の格子（CaseData::initial_lattice_）の格子点のうち、本プロセスの担当範囲にあるものに
+     * 分子を置く。通し番号は格子点の番号で、種類と速度は乱数の種と通し番号だけから決まるので、
+     * 全rankで一つの初期状態ファイルを読んだ場合と同じく、系全体で矛盾のない初期状態になる。
+     * 重心速度はまだ除いていない（finishGeneratedState参照）。
+     * 例外:
+     *   DataException: 分子名がみつからなかった場合。
+     */
+    void generateInitialState();
+
+    /*
+     * 初期状態の分子を一つ、座標に対応するセルに置く。velは速度 [Angstrom/fs]
+     */
+    void placeInitialParticle(int kind, long long serial, const VectorXYZ &pos, const VectorXYZ &vel);
+
+    /*
+     * 系に現れた分子の種類から、LJParams::SINGLE_KIND_ を設定する。
+     */
+    void setSingleKind(const bool *kind_seen);
+
     /*
      * Particle構造体のメモリを割り当てる。
      * 未使用のParticleのストック（在庫）がfreeParticleList_あればそれを優先的に再利用する。
@@ -118,9 +234,15 @@ public:
         assert(cellIdx.ix_ >= 0 && cellIdx.ix_ < acx_);
         assert(cellIdx.iy_ >= 0 && cellIdx.iy_ < acy_);
         assert(cellIdx.iz_ >= 0 && cellIdx.iz_ < acz_);
+        return &cells_[cellIndexFor(cellIdx)];
+    }
+
+    /*
+     * 引数で座標が指定されたセルの cells_ 上の添字を取得する
+     */
+    int cellIndexFor(const GridIndex3d &cellIdx) const {
         // acy_*acz_の値は常に同一なので、その積を変数に保存しておけば、多少高速化できる。
-        int index = cellIdx.ix_*acy_*acz_ + cellIdx.iy_*acz_ + cellIdx.iz_;
-        return &cells_[index];
+        return cellIdx.ix_*acy_*acz_ + cellIdx.iy_*acz_ + cellIdx.iz_;
     }
 
     /*
@@ -150,33 +272,105 @@ public:
         return surroundingRanges_[rangeIdx.ix_][rangeIdx.iy_][rangeIdx.iz_];
     }
 
+    /*
+     * 引数で示された方位の表面セル、周辺セルの cells_ 上の添字の並びを取得する
+     */
+    const std::vector<int> &surfaceCellsFor(const GridIndex3d &rangeIdx) const {
+        return surfaceCells_[rangeIdx.ix_][rangeIdx.iy_][rangeIdx.iz_];
+    }
+
+    const std::vector<int> &surroundingCellsFor(const GridIndex3d &rangeIdx) const {
+        return surroundingCells_[rangeIdx.ix_][rangeIdx.iy_][rangeIdx.iz_];
+    }
+
     /*
      * 初期状態ファイルに記載されていた分子の総数を返す。
      */
-    int getMoleculeCount() const {
+    long long getMoleculeCount() const {
         return total_molecule_count_;
     }
 
+    /*
+     * 初期状態ファイルに記載されていた分子のうち、トラジェクトリーに出力するものの数を返す。
+     */
+    long long getTrajectoryMoleculeCount() const {
+        return trajectory_molecule_count_;
+    }
+
+    /*
+     * 初期状態を生成した場合の後処理（generateInitialState参照）に使う、本プロセスの分の集計値。
+     * sums[0..2] は質量*速度*Δtの和、sums[3] は質量の和、sums[4] はトラジェクトリーに出力する分子の数。
+     */
+    static const int GENERATED_SUMS = 5;
+    void sumGeneratedState(double *sums) const;
+
+    /*
+     * sumGeneratedState の全rankの和を受け取り、重心速度を除き、トラジェクトリーに出力する分子の総数を設定する。
+     */
+    void finishGeneratedState(const double *sums);
+
+    /*
+     * 初期状態での分子の数から、本プロセスが使うメモリ量 [byte] を大まかに見積もる。
+     * 粒子と通信バッファの他に、all_trajectory であれば、rootが全分子のトラジェクトリーを
+     * 集めるための配列の分を含める。
+     */
+    double estimateMemoryBytes(bool all_trajectory) const;
+
     /*
      * 本プロセスの担当領域から転出した分子のデータを、周辺セルから送信バッファに転記する
      */
     void exportExitingMoleculeFullData();
 
     /*
-     * 本プロセスの担当領域から転出した分子のデータを、表面セルから送信バッファに転記する
+     * 本プロセスの担当領域から転出した分子のデータを、表面セルから送信バッファに転記する。
+     * refreshの場合は、再構築の間の座標の更新用に、スキンの幅の半分だけ広げたセルの範囲で
+     * 座標を量子化する。分子の並びはセル内のリストの順で、再構築の回と変わらない。
      */
-    void exportSurfacingMoleculePosData();
+    void exportSurfacingMoleculePosData(bool refresh = false);
 
     /*
      * 本プロセスの担当領域から転出した分子のデータを、受信バッファから表面セルに転記する
      */
     void importSurroundingMoleculePosData();
 
+    /*
+     * 再構築の回に周辺セルに置いた分子の座標を、受信バッファの座標で置き換える。
+     * 受信した座標は、相手の表面セルのリストの順に並んでいる。周辺セルのリストは
+     * 受信した順に作ったものなので、同じ順に対応する。
+     */
+    void refreshSurroundingMoleculePosData();
+
     /*
      * 本プロセスの担当領域に転入した分子のデータを、受信バッファから、該当する表面セルに転記する
      */
     void importEnteringMoleculeFullData();
 
+    /*
+     * 周辺セルcellIdxに対応する、周期境界の反対側のローカルセルの座標をsrcIdxに設定し、
+     * ローカルセルの座標に加えると周辺セルの像の座標になる補正量を返す。
+     * 全領域を一つのプロセスで受け持つ場合（シングルプロセス版）に使う。
+     */
+    VectorXYZ periodicImageFor(const GridIndex3d &cellIdx, GridIndex3d *srcIdx) const;
+
+    /*
+     * 周辺セルに移動した分子を、周期境界の反対側の表面セルに、座標を補正して直接移す。
+     * シングルプロセス版で、exportExitingMoleculeFullData から
+     * importEnteringMoleculeFullData までの代わりに使う。
+     */
+    void wrapExitingMolecules();
+
+    /*
+     * 周辺セルに、周期境界の反対側の表面セルの分子の像を置く。
+     * シングルプロセス版で、exportSurfacingMoleculePosData から
+     * importSurroundingMoleculePosData までの代わりに使う。
+     */
+    void fillPeriodicGhostCells();
+
+    /*
+     * 全ローカルセルの分子の座標と速度を、MSD/VACFのサンプルとして集計する
+     */
+    void sampleCorrelations();
+
     /*
      * トラジェクトリー用のデータを送信バッファに転記する
      */
@@ -189,19 +383,47 @@ public:
     void clearSurroundingCells();
 
     /*
-     * 分子間力の計算をする
+     * 分子間力の計算をする。
+     * rangeで、r-RESPAの近距離の部分、遠距離の部分だけを計算するように指定できる。
+     * kickがtrueなら、力が揃ったセルから順に、続けて速度を半分更新する
+     * （calcForceの後に updateVelocityHalf を呼ぶのと同じ）。
+     */
+    void calcForce(LJForceRange range = LJ_FORCE_FULL, bool kick = false);
+
+    /*
+     * 結果出力回で分子間力の計算とエネルギー計算をする。
+     * r-RESPAでは遠距離の部分の計算で、全ての組のエネルギーを集計する。
+     */
+    void calcForceAndUp(LJForceRange range = LJ_FORCE_FULL);
+
+    /*
+     * r-RESPAの遠距離の部分の力で、速度の更新計算をする
+     */
+    void updateVelocitySlow();
+
+    /*
+     * 位置の更新計算をし、セルから逸脱した粒子を隣接セル（周辺セルを含む）に移す。
+     * rebinがfalseなら（再構築の間の回）、粒子はセルから少しはみ出していても元のセルに残す。
      */
-    void calcForce();
+    void updatePosition(bool rebin = true);
 
     /*
-     * 結果出力回で分子間力の計算とエネルギー計算をする
+     * updateVelocityHalf と updatePosition を、粒子ごとに一度の走査で行う。
+     * rebuildなら、同じ走査で移動先のセルを求め、rebinParticles と同様に配置し直す。
+     * rebuildでない回（再構築の間の回）は、表面セルの分子の座標をそのまま座標送信バッファに詰める。
+     * その場合、exportSurfacingMoleculePosData(true) は呼ばない。
+     * 再構築の間の回に、セルの箱からスキンの幅の半分を超えてはみ出した分子があれば false を返す。
+     * その場合、周辺セルの座標は正しく送れず、カットオフ内の組を取りこぼすおそれもあるので、
+     * 呼び出し側は全rankでこの回を再構築の回に切り替える（abandonHaloRefresh 参照）。
      */
-    void calcForceAndUp();
+    bool updateVelocityHalfAndPosition(bool rebuild = true);
 
     /*
-     * 位置の更新計算をする
+     * 再構築の間の回として updateVelocityHalfAndPosition(false) を行った後で、この回を再構築の回に
+     * 切り替える。詰めかけた座標送信バッファと保持していた周辺セルの分子を捨て、
+     * 粒子を所属すべきセルに配置し直す（rebuildで updateVelocityHalfAndPosition を行った後と同じ状態になる）。
      */
-    void updatePosition();
+    void abandonHaloRefresh();
 
     /*
      * 速度の更新計算をする
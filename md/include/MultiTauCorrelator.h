@@ -0,0 +1,143 @@
+/*
+ * MultiTauCorrelator.h
+ *
+ */
+
+#ifndef MULTITAUCORRELATOR_H_
+#define MULTITAUCORRELATOR_H_
+
+#include <VectorXYZ.h>
+
+#include <vector>
+#include <ostream>
+#include <cassert>
+
+/*
+ * 平均二乗変位(MSD)と速度自己相関関数(VACF)を、multiple-tau法で
+ * 時間発展の途中で集計するクラス。
+ *
+ * 分子ごとに、レベル数 levels_ 段のシフトレジスタ（各段 points_ 個）を持つ。
+ * 第0段にはサンプルそのものを入れ、第l段には第l-1段の連続する2サンプルの平均を入れる。
+ * 第l段の遅れ j は 2^l * j サンプル分の時間に相当する。第l段(l>0)の j < points_/2 は
+ * 第l-1段で計算済みの時間幅なので集計しない。
+ *
+ * 分子ごとの状態（シフトレジスタ、周期境界補正量）は本クラスの持つプールの「スロット」に
+ * 保持し、Particle はスロット番号だけを持つ。分子がプロセス間を移転する際には、
+ * スロットの内容を送信バッファに詰めて送り、受信側で新たなスロットに展開する。
+ *
+ * 集計結果（遅れごとのMSD, VACFの和とサンプル数）は一つの配列に並べて保持しているので、
+ * rank間の集約は一回の MPI_Reduce で済む。
+ */
+class MultiTauCorrelator {
+
+    friend class TestMultiTauCorrelator;
+
+    // シフトレジスタの段数
+    int levels_;
+
+    // 一段あたりの点数（偶数）
+    int points_;
+
+    // サンプルの時間間隔 [fs]
+    double sample_dt_;
+
+    // 分子一つ分の状態の double の個数
+    int state_size_;
+
+    // 分子ごとの状態を保持するプール。state_size_ 個ずつのスロットに分けて使う。
+    std::vector<double> pool_;
+
+    // 未使用のスロット番号
+    std::vector<int> free_slots_;
+
+    /*
+     * 集計値
+     * [0, L*P)     : 遅れごとの変位の二乗の和 [Angstrom^2]
+     * [L*P, 2*L*P) : 遅れごとの速度の内積の和 [Angstrom^2*fs^-2]
+     * [2*L*P, 3*L*P) : 遅れごとのサンプル数
+     */
+    std::vector<double> data_;
+
+    // スロット内の各段の先頭位置
+    int levelBase(int level) const {
+        return 3 + level * (9 + points_ * 6);
+    }
+
+    // 第level段に値(x, v)を追加し、相関を集計する
+    void push(double *state, int level, const double *xv);
+
+public:
+
+    MultiTauCorrelator() : levels_(0), points_(0), sample_dt_(0), state_size_(0) {}
+
+    // 段数、点数、サンプルの時間間隔を設定し、集計値をゼロにする
+    void init(int levels, int points, double sample_dt);
+
+    // 集計するように設定されているか
+    bool isActive() const {
+        return levels_ > 0;
+    }
+
+    // 分子一つ分の状態の double の個数
+    int stateSize() const {
+        return state_size_;
+    }
+
+    // スロットを一つ割り当て、初期状態にして番号を返す。
+    int allocateSlot();
+
+    // スロットを返却する
+    void freeSlot(int slot);
+
+    // スロットの状態の先頭アドレス。プールの再割り当てで変わるので、保持しないこと。
+    double *stateFor(int slot) {
+        assert(slot >= 0 && (size_t)(slot + 1) * state_size_ <= pool_.size());
+        return &pool_[(size_t)slot * state_size_];
+    }
+
+    /*
+     * 分子の移転の際に、スロットの内容をbufに追加し、スロットを返却する。
+     * offsetは移転の際に座標に加える周期境界の補正量で、展開後に補正前の座標に
+     * 戻せるように状態の補正量から差し引いておく。
+     */
+    void packState(int slot, const VectorXYZ &offset, std::vector<double> &buf);
+
+    // srcから分子一つ分の状態を新たなスロットに展開し、その番号を返す。
+    int unpackState(const double *src);
+
+    // 周期境界で分子の座標にoffsetが加えられた際に、補正前の座標に戻せるように
+    // 補正量を更新する。プロセス内で折り返す場合（シングルプロセス版）に使う。
+    void wrapPosition(int slot, const VectorXYZ &offset);
+
+    // 分子一つ分のサンプルを集計する。posは周期境界で折り返された座標、velは速度[Angstrom/fs]
+    void sample(int slot, const VectorXYZ &pos, const VectorXYZ &vel);
+
+    // 集計値をゼロにする
+    void clear();
+
+    // rank間の集約用に集計値の配列を取得する
+    double *data() {
+        return &data_[0];
+    }
+
+    int dataSize() const {
+        return (int)data_.size();
+    }
+
+    // 第level段、遅れjの時間幅 [fs]
+    double lagTime(int level, int j) const {
+        return sample_dt_ * (1 << level) * j;
+    }
+
+    // 第level段、遅れjのMSD, VACF, サンプル数
+    double msd(int level, int j) const;
+    double vacf(int level, int j) const;
+    double count(int level, int j) const {
+        return data_[2 * levels_ * points_ + level * points_ + j];
+    }
+
+    // 遅れ時間の順にMSD, VACFをosに出力する
+    void write(std::ostream &os) const;
+};
+
+#endif /* MULTITAUCORRELATOR_H_ */
@@ -25,9 +25,16 @@ public:
     int kind_;
 
     /*
-     * 粒子の通し番号
+     * MSD/VACFの集計用の状態を保持するスロットの番号（MultiTauCorrelator参照）。
+     * 集計しない場合や、周辺セルの粒子では -1
+     * （kind_と並べて、serial_の8バイト境界の詰め物を生じないようにしている）
      */
-    int serial_;
+    int corr_slot_;
+
+    /*
+     * 粒子の通し番号。系全体の分子数は2^31を超えうるので64ビットとする。
+     */
+    long long serial_;
 
     /*
      * 位置
@@ -42,6 +49,11 @@ public:
      * 加速度×Δt^2/2
      */
     VectorXYZ a_dt2_half_; // acc * dt^2 * 0.5 [Angstrom]
+    /*
+     * r-RESPAの遠距離の部分の力による加速度×Δt^2/2（CaseData::respa_steps_参照）。
+     * 計算したステップの中で使い切るので、分子の移転では送らない。
+     */
+    VectorXYZ a_slow_dt2_half_; // acc * dt^2 * 0.5 [Angstrom]
 
 };
 
@@ -112,6 +124,22 @@ public:
         }
     }
 
+    /*
+     * リスト中の要素posの直後に要素pを挿入する。posが末尾ならaddと同じ。
+     */
+    void insertAfter(Particle *pos, Particle *p) {
+        assert(pos != NULL);
+        if (pos == tail_) {
+            add(p);
+        } else {
+            assert(pos->next_ && pos->next_->prev_ == pos);
+            p->prev_ = pos;
+            p->next_ = pos->next_;
+            pos->next_->prev_ = p;
+            pos->next_ = p;
+        }
+    }
+
     /*
      * リストから要素を取り除く。
      * 追加の場合よりも場合分けが多いので注意を要する。
@@ -210,6 +238,14 @@ public:
         }
     }
 
+    /*
+     * 要素の所有をやめて空になる。要素は削除しない。
+     * 要素をすべて別の場所で把握していて、リストを組み直す場合に使う。
+     */
+    void detachAll() {
+        head_ = tail_ = NULL;
+    }
+
     /*
      * 要素を数える。
      * 全要素のtraverse(走査)が発生するため、双方向リストでは苦手な処理である。
@@ -0,0 +1,108 @@
+/*
+ * PhaseTimer.h
+ *
+ */
+
+#ifndef PHASETIMER_H_
+#define PHASETIMER_H_
+
+#include <omp.h>
+#include <cassert>
+
+/*
+ * 時間発展ループを構成する処理段階（フェーズ）の種類。
+ * 添字としてPhaseTimerの配列に使う。
+ */
+enum MdPhase {
+    PHASE_INTEGRATE = 0, // 速度・位置の積分
+    PHASE_MIGRATE,       // プロセス間の分子の移転（送信バッファへの転記、送受信、セルへの分配）
+    PHASE_HALO,          // 周辺セルへの座標の送受信と周辺セルのクリア
+    PHASE_FORCE,         // 分子間力（とポテンシャル）の計算
+    PHASE_OUTPUT,        // トラジェクトリー、エネルギーの集約とファイル出力
+    PHASE_COUNT          // フェーズの種類数
+};
+
+/*
+ * フェーズごとの経過時間（wall clock）を積算するクラス。
+ * MPIに依存しないように、時刻の取得には omp_get_wtime を使う。
+ *
+ * 使い方:
+ *   timer.start(PHASE_FORCE);
+ *   procData_.calcForce();
+ *   timer.stop();
+ */
+class PhaseTimer {
+
+    // フェーズごとの積算時間 [sec]
+    double elapsed_[PHASE_COUNT];
+
+    // 計測中のフェーズ。計測中でなければ -1
+    int current_;
+
+    // 計測中のフェーズの開始時刻
+    double started_at_;
+
+    // reset()からの経過時間を求めるための基準時刻
+    double origin_;
+
+public:
+
+    PhaseTimer() {
+        reset();
+    }
+
+    // 全フェーズの積算時間をゼロにする
+    void reset() {
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            elapsed_[i] = 0;
+        }
+        current_ = -1;
+        started_at_ = 0;
+        origin_ = omp_get_wtime();
+    }
+
+    // phaseの計測を開始する。計測中のフェーズがあれば、そのフェーズの計測を終えてから開始する。
+    void start(int phase) {
+        assert(phase >= 0 && phase < PHASE_COUNT);
+        double now = omp_get_wtime();
+        if (current_ >= 0) {
+            elapsed_[current_] += now - started_at_;
+        }
+        current_ = phase;
+        started_at_ = now;
+    }
+
+    // 計測中のフェーズの計測を終える
+    void stop() {
+        assert(current_ >= 0);
+        elapsed_[current_] += omp_get_wtime() - started_at_;
+        current_ = -1;
+    }
+
+    // フェーズの積算時間を返す [sec]
+    double elapsed(int phase) const {
+        assert(phase >= 0 && phase < PHASE_COUNT);
+        return elapsed_[phase];
+    }
+
+    // フェーズごとの積算時間の配列を返す。MPIで集約する時に使う。
+    const double *elapsedArray() const {
+        return elapsed_;
+    }
+
+    // reset()からの経過時間を返す [sec]
+    double total() const {
+        return omp_get_wtime() - origin_;
+    }
+
+    // 出力用のフェーズ名
+    static const char *phaseName(int phase) {
+        static const char *names[PHASE_COUNT] = {
+            "integrate", "migrate", "halo", "force", "output"
+        };
+        assert(phase >= 0 && phase < PHASE_COUNT);
+        return names[phase];
+    }
+};
+
+#endif /* PHASETIMER_H_ */
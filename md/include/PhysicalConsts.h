@@ -17,4 +17,10 @@
  */
 #define M_AMU 1.660538e-27
 
+/*
+ * Boltzmann constant
+ * [J/K]
+ */
+#define K_BOLTZMANN 1.380649e-23
+
 #endif /* PHYSICALCONSTS_H_ */
@@ -0,0 +1,134 @@
+/*
+ * RdfAccumulator.h
+ *
+ */
+
+#ifndef RDFACCUMULATOR_H_
+#define RDFACCUMULATOR_H_
+
+#include <LJParams.h>
+
+#include <vector>
+#include <ostream>
+#include <cassert>
+
+/*
+ * 動径分布関数 g(r) を力計算のループの中で集計するクラス。
+ *
+ * 力計算で既に求めている距離の二乗 r^2 をそのままビンに振り分ける（平方根を取らない）ため、
+ * ビンは r^2 について等間隔 [0, rc^2) である。分子種の組み合わせ (ki <= kj) ごとに別々に集計する。
+ *
+ * プロセスをまたぐ組は双方のプロセスで一回ずつ数えられるので、ローカルな組は重み2、
+ * 周辺セルとの組は重み1で数え、出力時に2で割る。
+ *
+ * ヒストグラム、分子種別の分子数、サンプル数を一つの配列に並べて保持しているので、
+ * rank間の集約は一回の MPI_Reduce で済む。
+ */
+class RdfAccumulator {
+
+    friend class TestRdfAccumulator;
+
+    // 分子種の組み合わせの数（上三角）
+    static const int PAIR_TYPES = LJ_MOLECULE_TYPES * (LJ_MOLECULE_TYPES + 1) / 2;
+
+    // ビン数。0ならば集計しない。
+    int nbins_;
+
+    // 集計範囲の上限（カットオフ半径の二乗）[Angstrom^2]
+    double r2_max_;
+
+    // r^2 からビン番号への換算係数
+    double bins_per_r2_;
+
+    /*
+     * 集計値
+     * [0, PAIR_TYPES*nbins_)                 : 組み合わせ別のヒストグラム（重み付きの組の数）
+     * [PAIR_TYPES*nbins_, +LJ_MOLECULE_TYPES) : 分子種別の分子数（サンプルの合計）
+     * 最後の要素                              : サンプル数
+     */
+    std::vector<long long> data_;
+
+public:
+
+    RdfAccumulator() : nbins_(0), r2_max_(0), bins_per_r2_(0) {}
+
+    // ビン数と集計範囲を設定し、集計値をゼロにする
+    void init(int nbins, double cutoff_radius);
+
+    // 集計するように設定されているか
+    bool isActive() const {
+        return nbins_ > 0;
+    }
+
+    // 分子種の組み合わせの番号
+    static int pairIndex(int ki, int kj) {
+        if (ki > kj) {
+            int k = ki;
+            ki = kj;
+            kj = k;
+        }
+        assert(ki >= 0 && kj < LJ_MOLECULE_TYPES);
+        return ki * LJ_MOLECULE_TYPES - ki * (ki - 1) / 2 + (kj - ki);
+    }
+
+    // 距離の二乗がr2の組を重みweightで数える。r2はカットオフ半径の二乗未満であること。
+    void addPair(int ki, int kj, double r2, int weight) {
+        int bin = (int)(r2 * bins_per_r2_);
+        if (bin >= nbins_) {
+            bin = nbins_ - 1; // 丸め誤差対策
+        }
+        data_[pairIndex(ki, kj) * nbins_ + bin] += weight;
+    }
+
+    // 分子数の集計に分子を一つ加える
+    void addMolecule(int kind) {
+        data_[PAIR_TYPES * nbins_ + kind]++;
+    }
+
+    // 一回分のサンプルの集計を終える
+    void endSample() {
+        data_.back()++;
+    }
+
+    // 集計値をゼロにする
+    void clear();
+
+    // rank間の集約用に集計値の配列を取得する
+    long long *data() {
+        return &data_[0];
+    }
+
+    int dataSize() const {
+        return (int)data_.size();
+    }
+
+    int binCount() const {
+        return nbins_;
+    }
+
+    // ビンbinに数えられた組の数（重みを除いたもの）
+    double pairCount(int ki, int kj, int bin) const {
+        return data_[pairIndex(ki, kj) * nbins_ + bin] * 0.5;
+    }
+
+    // 分子種kindの分子数（全サンプルの合計）
+    long long moleculeCount(int kind) const {
+        return data_[PAIR_TYPES * nbins_ + kind];
+    }
+
+    long long sampleCount() const {
+        return data_.back();
+    }
+
+    // ビンbinの下限・上限の距離 [Angstrom]
+    double rLower(int bin) const;
+    double rUpper(int bin) const;
+
+    /*
+     * 体積volumeの系の g(r) を組み合わせごとの列としてosに出力する。
+     * 分子が存在しない分子種を含む組み合わせは出力しない。
+     */
+    void write(std::ostream &os, double volume) const;
+};
+
+#endif /* RDFACCUMULATOR_H_ */
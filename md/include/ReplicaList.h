@@ -0,0 +1,80 @@
+/*
+ * ReplicaList.h
+ *
+ */
+
+#ifndef REPLICALIST_H_
+#define REPLICALIST_H_
+
+#include <string>
+#include <vector>
+#include <cassert>
+
+/*
+ * アンサンブル実行（一つのMPIジョブの中で、独立な複数のレプリカを並べて実行する）の
+ * レプリカの一覧。一覧ファイルの各行に、レプリカのプロセス数と計算条件ファイルのパスを書く。
+ *
+ *   27 sweep/eps08/case.txt
+ *   27 sweep/eps09/case.txt
+ *
+ * 空行と # で始まる行は読み飛ばす。出力ファイルのパスは各レプリカの計算条件ファイルで
+ * 指定するので、レプリカごとに別のパスにしておくこと。
+ * ジョブ全体のrankを、一覧の順に、各レプリカのプロセス数ずつ連続して割り当てる。
+ */
+class ReplicaList {
+
+    // レプリカごとのプロセス数
+    std::vector<int> procs_;
+
+    // レプリカごとの、割り当てたrankの先頭
+    std::vector<int> first_rank_;
+
+    // レプリカごとの計算条件ファイルのパス
+    std::vector<std::string> case_files_;
+
+    // 全レプリカのプロセス数の合計
+    int total_procs_;
+
+public:
+
+    ReplicaList() : total_procs_(0) {}
+
+    /*
+     * 一覧ファイルを読み込む。
+     * 例外:
+     *   IoException : ファイルを開けない
+     *   DataException : 書式の誤り、レプリカが一つもない
+     */
+    void read(const char *file_name);
+
+    // レプリカの数
+    int size() const {
+        return (int)procs_.size();
+    }
+
+    // 全レプリカのプロセス数の合計。ジョブのプロセス数と一致していなければならない。
+    int totalProcs() const {
+        return total_procs_;
+    }
+
+    // ジョブ全体でのrankがrankのプロセスが受け持つレプリカの番号
+    int replicaForRank(int rank) const;
+
+    // レプリカの番号replicaのプロセス数、rankの先頭、計算条件ファイルのパス
+    int procs(int replica) const {
+        assert(replica >= 0 && replica < size());
+        return procs_[replica];
+    }
+
+    int firstRank(int replica) const {
+        assert(replica >= 0 && replica < size());
+        return first_rank_[replica];
+    }
+
+    const std::string &caseFile(int replica) const {
+        assert(replica >= 0 && replica < size());
+        return case_files_[replica];
+    }
+};
+
+#endif /* REPLICALIST_H_ */
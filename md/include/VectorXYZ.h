@@ -73,6 +73,12 @@ public:
         z_ += v.z_;
     }
 
+    void operator-=(VectorXYZ const &v) {
+        x_ -= v.x_;
+        y_ -= v.y_;
+        z_ -= v.z_;
+    }
+
     /*
      * binary operators
      */
@@ -10,6 +10,9 @@
 
 #include <mpi.h>
 
+#include <algorithm>
+#include <climits>
+
 /*
  * MPIにユーザ定義の型の構造を登録して、識別コード(MPI_Datatype型の値)を発行してもらう。
  * その値を覚えておくための変数
@@ -18,9 +21,18 @@ MPI_Datatype MdCommunicator::MPI_MOLECULE_FULL_DATA_TYPE;
 MPI_Datatype MdCommunicator::MPI_MOLECULE_POS_DATA_TYPE;
 MPI_Datatype MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE;
 
-void MdCommunicator::init(CaseData *caseData, MdCommData *commData) {
+void MdCommunicator::init(CaseData *caseData, MdCommData *commData, MPI_Comm world) {
     caseData_ = caseData;
     commData_ = commData;
+    world_ = world;
+    energy_request_ = MPI_REQUEST_NULL;
+    energy_pending_ = false;
+    traj_requests_.assign(2, MPI_REQUEST_NULL);
+    traj_point_to_point_ = false;
+    traj_pending_ = false;
+
+    // プロセス格子のコミュニケータを作り、自身のrankとプロセス座標を決め直す
+    initProcessComm();
 
     GridIndex3d myIndex;
     // 自身のプロセス座標を取得する
@@ -56,21 +68,9 @@ void MdCommunicator::init(CaseData *caseData, MdCommData *commData) {
         // 考察中の方角に向けてのpeerBufferを取得する
         MdCommPeerBuffer *peer = commData_->bufferFor(peerIt);
 
-        // MPIでは、同時期に複数のプロセスからデータが到着する時に、送り主のrank番号を
-        // 指定して、自分が受け取りたいデータを指定することができるが、同時期に同一の
-        // プロセスから意味合いの違う複数のデータが立て続けに送られてくる場合には、
-        // rankでは識別できない。そのような場合ではrankに加えてtag番号を自由に決めて
-        // 指定し、rankとtagの値の対でもってデータを識別することができる。
-        // 本プログラムに即して言うと、例えばテスト段階で 2x2x2 プロセス
-        // の分割を行った場合、あるプロセスから見て、左隣のプロセスと右隣のプロセスは、
-        // 周期境界条件により、同一のプロセスになる。そこで、送信の方位ごとにタグ番号
-        // を決めておくことにする。右に送り出すときのtagと、右から受信する時のtagは
-        // 異なることに注意。右から受信するデータは、相手から見れば、左に送り出した
-        // データなので、右側からは、「左向きのデータ」が到着する。
-        int dir = peerIt.ix_ * 9 + peerIt.iy_ * 3 + peerIt.iz_;
-        peer->setRankAndTags(pr, dir, 26 - dir); // 26 is the magic number. (27-1)
-
-        // rank, tagに加えて、さきほどの「補正量」もpeerに設定しておく。
+        peer->setRank(pr);
+
+        // rankに加えて、さきほどの「補正量」もpeerに設定しておく。
         peer->setOffsetForSending(offset_x, offset_y, offset_z);
 
       //  Logger::out << "For direction : ["
@@ -79,9 +79,147 @@ void MdCommunicator::init(CaseData *caseData, MdCommData *commData) {
       //  Logger::out << "Peer Rank = " << pr << std::endl;
     }
 
+    initNeighborTopology();
+    initSharedHalo();
+    initRmaHalo();
     initMpiTypes();
 }
 
+void MdCommunicator::initProcessComm() {
+    /*
+     * プロセス分割に合わせた3次元の周期的なCartesianトポロジーのコミュニケータを作る。
+     * MPIがプロセスの配置に合わせてrankを付け直せるように、reorderを許す。
+     * rankとプロセス座標の対応は row-major (z が最も速く変わる) で、
+     * CaseData::setProcessIteratorForRank と同じ。
+     * rank_placement node の場合は、ノードごとにプロセス格子の直方体のブロックを受け持つように
+     * 自分でrankを付け直したコミュニケータを元にし、reorderはしない。
+     */
+    int dims[3] = {caseData_->npx_, caseData_->npy_, caseData_->npz_};
+    int periods[3] = {1, 1, 1};
+    MPI_Comm base = world_;
+    MPI_Comm placed = MPI_COMM_NULL;
+    int reorder = 1;
+    if (caseData_->node_placement_) {
+        placed = createNodeBlockComm();
+        if (placed != MPI_COMM_NULL) {
+            base = placed;
+            reorder = 0;
+        }
+    }
+    MPI_Cart_create(base, 3, dims, periods, reorder, &comm_);
+    if (placed != MPI_COMM_NULL) {
+        MPI_Comm_free(&placed);
+    }
+
+    int rank;
+    MPI_Comm_rank(comm_, &rank);
+    caseData_->setMyRank(rank);
+#ifndef NDEBUG
+    int coords[3];
+    MPI_Cart_coords(comm_, rank, 3, coords);
+    assert(coords[0] == caseData_->localProcess_.ix_);
+    assert(coords[1] == caseData_->localProcess_.iy_);
+    assert(coords[2] == caseData_->localProcess_.iz_);
+#endif
+}
+
+MPI_Comm MdCommunicator::createNodeBlockComm() {
+    int world_rank;
+    MPI_Comm_rank(world_, &world_rank);
+    // 同じノード（共有メモリ）のプロセスを集めたコミュニケータ
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(world_, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &node_comm);
+    int local, node_size;
+    MPI_Comm_rank(node_comm, &local);
+    MPI_Comm_size(node_comm, &node_size);
+    // ノード番号は、各ノードの先頭のプロセスだけを集めたコミュニケータでのrankとする
+    MPI_Comm leader_comm;
+    MPI_Comm_split(world_, (local == 0) ? 0 : MPI_UNDEFINED, world_rank, &leader_comm);
+    int node = 0;
+    if (leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_rank(leader_comm, &node);
+        MPI_Comm_free(&leader_comm);
+    }
+    MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    // 全ノードのプロセス数がそろっていて、ブロックの形が決まる場合だけ使う。
+    // 判定は全プロセスで同じ結果になる。
+    int size_range[2] = {node_size, -node_size};
+    MPI_Allreduce(MPI_IN_PLACE, size_range, 2, MPI_INT, MPI_MAX, world_);
+    GridIndex3d procIdx;
+    if (size_range[0] != -size_range[1]
+            || !caseData_->setProcessIteratorForNodeRank(&procIdx, node, local, node_size)) {
+        Logger::out << "rank_placement node is not applicable for " << node_size
+                    << " processes per node, using cart" << std::endl;
+        return MPI_COMM_NULL;
+    }
+    // プロセス座標に対応するrankの順に並べ直す
+    MPI_Comm placed;
+    MPI_Comm_split(world_, 0, caseData_->getRankForProcess(procIdx), &placed);
+    return placed;
+}
+
+void MdCommunicator::initNeighborTopology() {
+    /*
+     * 26方位の隣接プロセスを、MPIの分散グラフトポロジーとして登録する。
+     * 以後の隣接プロセスとの送受信は、このコミュニケータ上の近傍集団通信
+     * （MPI_Neighbor_alltoallw）一回で、26方位分をまとめて行う。
+     *
+     * 第k近傍への送信は、方位 d_k （GridPeerIterator3dの順）に向けたもの。
+     * 第k近傍からの受信は、反対の方位 (2,2,2)-d_k にいるプロセスが、そのプロセスから見て
+     * 方位 d_k に向けて送り出したもので、こちらの方位 (2,2,2)-d_k のバッファで受け取る。
+     *
+     * 例えば 2x2x2 プロセスの分割では、左隣と右隣が周期境界条件により同一のプロセスになり、
+     * 1プロセスでは26方位の全てが自分自身になる。同じ相手との間に辺が複数ある場合、
+     * 近傍集団通信は辺の並び順に対応づけられる。送信側の相手Bへの辺は d_k の順、
+     * 受信側の相手Aからの辺も、Aが送り出した方位 d_k の順に並ぶので、方位ごとに
+     * タグ値を分けなくても、データを取り違えることはない。
+     */
+    int destinations[NEIGHBORS];
+    int sources[NEIGHBORS];
+    GridPeerIterator3d peerIt;
+    int k = 0;
+    while (peerIt.next()) {
+        send_peers_[k] = commData_->bufferFor(peerIt);
+        recv_peers_[k] = commData_->bufferFor(GridIndex3d(2, 2, 2) - peerIt);
+        destinations[k] = send_peers_[k]->rank_;
+        sources[k] = recv_peers_[k]->rank_;
+        ++k;
+    }
+    assert(k == NEIGHBORS);
+    // rank番号は変えない（reorder = 0）ので、rankとプロセス座標の対応はそのまま使える。
+    MPI_Dist_graph_create_adjacent(comm_,
+                                   NEIGHBORS, sources, MPI_UNWEIGHTED,
+                                   NEIGHBORS, destinations, MPI_UNWEIGHTED,
+                                   MPI_INFO_NULL, 0, &neighbor_comm_);
+}
+
+void MdNeighborBlocks::setSend(int k, const void *addr, int count, MPI_Datatype type) {
+    send_counts_[k] = count;
+    send_displs_[k] = 0;
+    if (addr != MPI_BOTTOM && count > 0) {
+        MPI_Get_address(addr, &send_displs_[k]);
+    }
+    send_types_[k] = type;
+}
+
+void MdNeighborBlocks::setRecv(int k, void *addr, int count, MPI_Datatype type) {
+    recv_counts_[k] = count;
+    recv_displs_[k] = 0;
+    if (addr != MPI_BOTTOM && count > 0) {
+        MPI_Get_address(addr, &recv_displs_[k]);
+    }
+    recv_types_[k] = type;
+}
+
+void MdNeighborBlocks::freeTypes() {
+    for (int k = 0; k < MdCommunicator::NEIGHBORS; k++) {
+        MPI_Type_free(&send_types_[k]);
+        MPI_Type_free(&recv_types_[k]);
+    }
+}
+
 void MdCommunicator::initMpiTypes() {
     /*
      * 粒子データをMPIで授受する時に使うstructの構造をMPIに登録して
@@ -93,390 +231,740 @@ void MdCommunicator::initMpiTypes() {
      * MPI_Type_create_struct, MPI_Type_commit 関数を利用する。
      */
     // Full
-    int count_full = 11;
-    int blocklengths_full[] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
-    MPI_Aint displacements_full[11];
-    MPI_Datatype types_full[11] = {MPI_INT, MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE,
-                                   MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE};
+    // 移転する分子は、Particleオブジェクトの必要なメンバーだけを直接送受信する。
+    // 型の先頭はParticleの先頭とし、メンバーの位置をMPI_Get_addressで求める。
+    // （Particleは標準レイアウトではないのでoffsetofは使わない）
+    int count_full = 4;
+    int blocklengths_full[] = {1, 1, 3, 3};
+    MPI_Aint displacements_full[4];
+    MPI_Datatype types_full[4] = {MPI_INT, MPI_LONG_LONG, MPI_DOUBLE, MPI_DOUBLE};
+    Particle sample;
     MPI_Aint base_address_full;
-    displacements_full[0] = offsetof(CommMoleculeFullData, kind_);
-    displacements_full[1] = offsetof(CommMoleculeFullData, serial_);
-    displacements_full[2] = offsetof(CommMoleculeFullData, rx_);
-    displacements_full[3] = offsetof(CommMoleculeFullData, ry_);
-    displacements_full[4] = offsetof(CommMoleculeFullData, rz_);
-    displacements_full[5] = offsetof(CommMoleculeFullData, vdtx_);
-    displacements_full[6] = offsetof(CommMoleculeFullData, vdty_);
-    displacements_full[7] = offsetof(CommMoleculeFullData, vdtz_);
-    displacements_full[8] = offsetof(CommMoleculeFullData, adt2x_);
-    displacements_full[9] = offsetof(CommMoleculeFullData, adt2y_);
-    displacements_full[10] = offsetof(CommMoleculeFullData, adt2z_);
+    MPI_Get_address(&sample, &base_address_full);
+    MPI_Get_address(&sample.kind_, &displacements_full[0]);
+    MPI_Get_address(&sample.serial_, &displacements_full[1]);
+    MPI_Get_address(&sample.pos_.x_, &displacements_full[2]);
+    MPI_Get_address(&sample.vel_dt_.x_, &displacements_full[3]);
+    for (int i = 0; i < count_full; i++) {
+        displacements_full[i] = MPI_Aint_diff(displacements_full[i], base_address_full);
+    }
     MPI_Type_create_struct(count_full, blocklengths_full, displacements_full, types_full,
                            &MdCommunicator::MPI_MOLECULE_FULL_DATA_TYPE);
     MPI_Type_commit(&MdCommunicator::MPI_MOLECULE_FULL_DATA_TYPE);
 
     // Pos
     int count_pos = 4;
-    MPI_Datatype types_pos[4] = {MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE};
+    MPI_Datatype types_pos[4] = {MPI_UINT32_T, MPI_UINT32_T, MPI_UINT32_T, MPI_UNSIGNED_CHAR};
     int blocklengths_pos[4] = {1, 1, 1, 1};
     MPI_Aint displacements_pos[4];
-    displacements_pos[0] = offsetof(CommMoleculePosData, kind_);
-    displacements_pos[1] = offsetof(CommMoleculePosData, rx_);
-    displacements_pos[2] = offsetof(CommMoleculePosData, ry_);
-    displacements_pos[3] = offsetof(CommMoleculePosData, rz_);
-    MPI_Type_create_struct(count_pos, blocklengths_pos, displacements_pos, types_pos,
-                           &MdCommunicator::MPI_MOLECULE_POS_DATA_TYPE);
+    displacements_pos[0] = offsetof(CommMoleculePosData, qx_);
+    displacements_pos[1] = offsetof(CommMoleculePosData, qy_);
+    displacements_pos[2] = offsetof(CommMoleculePosData, qz_);
+    displacements_pos[3] = offsetof(CommMoleculePosData, kind_);
+    // 末尾の詰め物を含めた構造体の大きさを、配列の要素の間隔としてMPIに教える
+    MPI_Datatype pos_struct;
+    MPI_Type_create_struct(count_pos, blocklengths_pos, displacements_pos, types_pos, &pos_struct);
+    MPI_Type_create_resized(pos_struct, 0, sizeof(CommMoleculePosData),
+                            &MdCommunicator::MPI_MOLECULE_POS_DATA_TYPE);
+    MPI_Type_free(&pos_struct);
     MPI_Type_commit(&MdCommunicator::MPI_MOLECULE_POS_DATA_TYPE);
 
     // Traj
-    int count_traj = 8;
-    MPI_Datatype types_traj[8] = {MPI_INT, MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE,
-                                  MPI_DOUBLE};
-    int blocklengths_traj[8] = {1, 1, 1, 1, 1, 1, 1, 1};
-    MPI_Aint displacements_traj[8];
-    displacements_traj[0] = offsetof(CommMoleculeTrajData, kind_);
-    displacements_traj[1] = offsetof(CommMoleculeTrajData, serial_);
-    displacements_traj[2] = offsetof(CommMoleculeTrajData, rx_);
-    displacements_traj[3] = offsetof(CommMoleculeTrajData, ry_);
-    displacements_traj[4] = offsetof(CommMoleculeTrajData, rz_);
-    displacements_traj[5] = offsetof(CommMoleculeTrajData, vx_);
-    displacements_traj[6] = offsetof(CommMoleculeTrajData, vy_);
-    displacements_traj[7] = offsetof(CommMoleculeTrajData, vz_);
-
-    MPI_Type_create_struct(count_traj, blocklengths_traj, displacements_traj, types_traj,
-                           &MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE);
+    // 計算条件で選んだ項目だけを詰めたレコード（MdCommData::TRAJ_SERIAL_OFFSET 参照）。
+    // レコード末尾の詰め物は送らない。
+    int count_traj = 3;
+    MPI_Datatype types_traj[3] = {MPI_LONG_LONG, MPI_INT,
+                                  caseData_->trajectory_float_ ? MPI_FLOAT : MPI_DOUBLE};
+    int blocklengths_traj[3] = {1, 1, commData_->traj_values_};
+    MPI_Aint displacements_traj[3];
+    displacements_traj[0] = MdCommData::TRAJ_SERIAL_OFFSET;
+    displacements_traj[1] = MdCommData::TRAJ_KIND_OFFSET;
+    displacements_traj[2] = MdCommData::TRAJ_VALUES_OFFSET;
+    MPI_Datatype traj_struct;
+    MPI_Type_create_struct(count_traj, blocklengths_traj, displacements_traj, types_traj, &traj_struct);
+    MPI_Type_create_resized(traj_struct, 0, commData_->traj_record_size_,
+                            &MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE);
+    MPI_Type_free(&traj_struct);
     MPI_Type_commit(&MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE);
 
     //Logger::out << "initMpiTypes:done" << std::endl;
 }
 
+MPI_Datatype MdCommunicator::createParticleListType(std::vector<Particle *> &particles) {
+    MPI_Datatype type;
+    size_t n = particles.size();
+    if (n == 0) {
+        // 送受信する粒子がない場合は、長さ0のデータとする
+        MPI_Type_contiguous(0, MPI_BYTE, &type);
+        MPI_Type_commit(&type);
+        return type;
+    }
+    std::vector<MPI_Aint> addresses(n);
+    for (size_t i = 0; i < n; i++) {
+        MPI_Get_address(particles[i], &addresses[i]);
+    }
+    MPI_Type_create_hindexed_block(n, 1, &addresses[0], MPI_MOLECULE_FULL_DATA_TYPE, &type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
 void MdCommunicator::exchangeMoleculeFullData() {
     /*
      * プロセス間の粒子の転移のための送受信を行う
+     * 26方位の送受信は、近傍集団通信でまとめて行う（initを参照）。
      */
     /*
-     * 送信と受信の対を26方位に対して行う。
+     * まず、相手との境界に面したセルごとに、お互いに送信予定の粒子数を伝え合う。
+     * 方位が決まると、その方位のpeerに面しているセルの数が決まる。
+     * こちらから送信する粒子の数は、総合計ではなく、セルごとの粒子数の配列として送る
+     * 向こうからも、同じ長さの配列で、セル別の粒子数を送ってくる。
      */
-    MPI_Request reqs[26 + 26];//個々のsend/recvのための構造体の配列
-    MPI_Status stats[26 + 26];
-
-    GridPeerIterator3d pidx; // このイテレータは [1,1,1]を飛ばして [0,0,0] - [2,2,2] の間の26方位を発生する。
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        MdCommPeerBuffer *rpeer = recv_peers_[k];
+        speer->setMoleculeFullDataSendCount(); //送信分子数をsend_count_に格納
+        // 受信用の配列の長さは、同じ方位の送信用の配列と同じ
+        rpeer->recv_count_per_cell_.resize(rpeer->send_count_per_cell_.size());
+        count_blocks_.setSend(k, speer->send_count_per_cell_.data(),
+                speer->send_count_per_cell_.size(), MPI_INT);
+        count_blocks_.setRecv(k, rpeer->recv_count_per_cell_.data(),
+                rpeer->recv_count_per_cell_.size(), MPI_INT);
+    }
+    MPI_Neighbor_alltoallw(MPI_BOTTOM, count_blocks_.send_counts_, count_blocks_.send_displs_,
+                           count_blocks_.send_types_,
+                           MPI_BOTTOM, count_blocks_.recv_counts_, count_blocks_.recv_displs_,
+                           count_blocks_.recv_types_, neighbor_comm_);
 
-    int reqi = 0; //構造体のためのカウンタ
-    while (pidx.next()) {
-        // この方位のpeer buffer を取得する
-        MdCommPeerBuffer *peer = commData_->bufferFor(pidx);
-        peer->setMoleculeFullDataSendCount(); //送信分子数をsend_count_に格納
-        // 方位が決まると、その方位のpeerに面しているセルの数が決まる。
-        // こちらから送信する粒子の数は、総合計ではなく、セルごとの粒子数の配列として送る
-        // 向こうからも、同じ長さの配列で、セル別の粒子数を送ってくる。
-        // つまり、同じ長さの整数配列を相互に送り合うことになる。
-        size_t cell_count = peer->send_count_per_cell_.size(); // 相手に面しているセルの数
-        // 本メソッドが呼ばれる時点では、送信用の配列にはすでに値がつまっているが、
-        // 受信用の配列は、領域すら準備されていない（初回の時点では）
-        // そこで、受信用のバッファの長さを割り当てる。
-        // この長さは毎回同じなので、初期化処理に移してもよい（大きな性能向上は望めないが）
-        peer->recv_count_per_cell_.resize(cell_count);
-        // 送り出したいデータが始まるアドレス
-        int *send_count_addr = &peer->send_count_per_cell_.front();
-        // 受信データを受け取る配列が待ち受けているアドレス
-        int *recv_count_addr = &peer->recv_count_per_cell_.front();
-
-        // デバッグ用のログの例を示すが、この箇所は呼び出し回数が多いのでリリース版では
-        // #ifdefによる抑止が必須である。
-        //Logger::out << "Exchanging migrating particle counts for " << cell_count;
-        //Logger::out << " boundary cells with rank " << peer->rank_;
-        ///Logger::out << " with tag " << peer->tagForSend() << "/" << peer->tagForRecv() << std::endl;
-
-        MPI_Isend(send_count_addr,
-                  cell_count,
-                  MPI_INT,
-                  peer->rank_,
-                  peer->tagForSend(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi]);
-
-        MPI_Irecv(recv_count_addr,
-                  cell_count,
-                  MPI_INT,
-                  peer->rank_,
-                  peer->tagForRecv(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi + 1]);
-        reqi += 2;
-    }
-
-    MPI_Waitall(reqi, reqs, stats);
     /*
-     * 上記で、相手との境界に面したセルごとに、お互いに送信予定の粒子数を、相互に伝えることができた。
-     * 続いて、実際の粒子の座標データの授受に移る。
+     * 続いて、実際の粒子のデータの授受に移る。
+     * 粒子はメモリ上に散らばっているので、方位ごとに粒子のアドレスを並べた型を作り、
+     * 中間バッファを介さずに粒子オブジェクトから直接送受信する。
      */
+    MPI_Request reqs[2];
+    int reqi = 0;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        MdCommPeerBuffer *rpeer = recv_peers_[k];
+        // 先に受信した粒子数の配列から、受信予定の総粒子数を求め、その数だけ
+        // 受信データを直接書き込む粒子を割り当てる。
+        rpeer->setMoleculeFullDataRecvBuffer(); // Note 'FullData'
+        commData_->allocateRecvParticles(rpeer);
+        //Logger::out << "Exchaning molecules with rank " << speer->rank_;
+        //Logger::out << " sending " << speer->send_count_ << ", receiving " << rpeer->recv_count_ << std::endl;
+        particle_blocks_.setSend(k, MPI_BOTTOM, 1, createParticleListType(speer->send_particles_));
+        particle_blocks_.setRecv(k, MPI_BOTTOM, 1, createParticleListType(rpeer->recv_particles_));
+    }
+    MPI_Ineighbor_alltoallw(MPI_BOTTOM, particle_blocks_.send_counts_, particle_blocks_.send_displs_,
+                            particle_blocks_.send_types_,
+                            MPI_BOTTOM, particle_blocks_.recv_counts_, particle_blocks_.recv_displs_,
+                            particle_blocks_.recv_types_, neighbor_comm_, &reqs[reqi++]);
+
+    if (commData_->correlator_.isActive()) {
+        // 分子ごとのMSD/VACFの状態も、粒子と並行して送受信する。
+        int state_size = commData_->correlator_.stateSize();
+        for (int k = 0; k < NEIGHBORS; k++) {
+            MdCommPeerBuffer *speer = send_peers_[k];
+            MdCommPeerBuffer *rpeer = recv_peers_[k];
+            assert(speer->send_correlator_state_.size() == speer->send_count_ * state_size);
+            rpeer->recv_correlator_state_.resize(rpeer->recv_count_ * state_size);
+            state_blocks_.setSend(k, speer->send_correlator_state_.data(),
+                    speer->send_correlator_state_.size(), MPI_DOUBLE);
+            state_blocks_.setRecv(k, rpeer->recv_correlator_state_.data(),
+                    rpeer->recv_correlator_state_.size(), MPI_DOUBLE);
+        }
+        MPI_Ineighbor_alltoallw(MPI_BOTTOM, state_blocks_.send_counts_, state_blocks_.send_displs_,
+                                state_blocks_.send_types_,
+                                MPI_BOTTOM, state_blocks_.recv_counts_, state_blocks_.recv_displs_,
+                                state_blocks_.recv_types_, neighbor_comm_, &reqs[reqi++]);
+    }
+    MPI_Waitall(reqi, reqs, MPI_STATUSES_IGNORE);
+    // 粒子ごとに作った型は、通信が完了したので解放する
+    particle_blocks_.freeTypes();
 
-    pidx.reset(); // 先ほど使ったイテレータを初期状態に戻す。
-    reqi = 0;
+    /*
+     * 送受信が終わったので、送り出した粒子はもう必要ない。ストックに戻して
+     * 送信バッファを空にしておく。
+     * 受信した粒子の座標は送信側のものなので、周期境界の補正を行う。
+     * 受信側の相手方向の補正量は、送信側の補正量の符号を反転したものなので、それを差し引く。
+     */
+    GridPeerIterator3d pidx;
     while (pidx.next()) {
         MdCommPeerBuffer *peer = commData_->bufferFor(pidx);
-        // 送信する粒子数の合計値を求める
-        //peer->setMoleculeFullDataSendCount();
-        // 先に受信した粒子数の配列から、受信予定の総粒子数を求め、その数に合わせて
-        // 粒子の座標データ用の受信バッファを用意する。
-        peer->setMoleculeFullDataRecvBuffer(); // Note 'FullData'
-        //Logger::out << "Exchaning molecules with rank " << peer->rank_;
-        //Logger::out << " with tag " << peer->tagForSend() << "/" << peer->tagForRecv();
-        //Logger::out << " sending " << peer->send_count_ << ", receiving " << peer->recv_count_ << std::endl;
-        // 送信データの先頭アドレス
-        CommMoleculeFullData *send_addr = &peer->send_molecule_full_.front();
-        // 受信データを受け取る配列の先頭アドレス
-        CommMoleculeFullData *recv_addr = &peer->recv_molecule_full_.front();
-
-        // 通信のための適切な関数を呼ぶ
-        MPI_Isend(send_addr,
-                  peer->send_count_,
-                  MdCommunicator::MPI_MOLECULE_FULL_DATA_TYPE,
-                  peer->rank_,
-                  peer->tagForSend(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi]);
-        MPI_Irecv(recv_addr,
-                  peer->recv_count_,
-                  MdCommunicator::MPI_MOLECULE_FULL_DATA_TYPE,
-                  peer->rank_,
-                  peer->tagForRecv(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi + 1]);
-        reqi += 2;
-    }
-    MPI_Waitall(reqi, reqs, stats);
+        commData_->releaseSentParticles(peer);
+        std::vector<Particle *>::iterator it;
+        for (it = peer->recv_particles_.begin(); it != peer->recv_particles_.end(); ++it) {
+            (*it)->pos_ -= peer->offset;
+        }
+    }
+}
+
+void MdCommunicator::initTrajectoryGather(long long molecule_count) {
+    traj_point_to_point_ = molecule_count > INT_MAX;
+}
+
+void MdCommunicator::startTrajectoryGather() {
+    assert(!traj_pending_);
+    const int root = 0;
+    // 一つのrankの粒子数はintに収まる（系全体の数は収まるとは限らない）
+    assert(commData_->sendTrajectoryCount() <= (size_t)INT_MAX);
+    commData_->traj_send_count_ = commData_->sendTrajectoryCount();
+    char *send_data = commData_->send_molecule_traj_.empty()
+            ? NULL : &commData_->send_molecule_traj_.front();
+
+    if (!caseData_->isRootRank()) {
+        // root以外は、粒子数とそれに続く粒子データの送信を発行するだけで戻る。
+        MPI_Igather(&commData_->traj_send_count_, 1, MPI_INT,
+                    NULL, 1, MPI_INT,
+                    root, comm_, &traj_requests_[0]);
+        if (traj_point_to_point_) {
+            MPI_Isend(send_data, commData_->traj_send_count_, MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                      root, TRAJ_TAG, comm_, &traj_requests_[1]);
+        } else {
+            MPI_Igatherv(send_data, commData_->traj_send_count_,
+                         MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                         NULL, NULL, NULL, MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                         root, comm_, &traj_requests_[1]);
+        }
+    } else {
+        // rootは、各rankの粒子数がそろうまで待ってから、受信位置を決めて粒子データの収集を発行する。
+        // root自身の分も、他のrankと同様に送信バッファから収集される。
+        int np = caseData_->num_procs_;
+        commData_->traj_recv_counts_.resize(np);
+        commData_->traj_recv_displs_.resize(np);
+        MPI_Igather(&commData_->traj_send_count_, 1, MPI_INT,
+                    &commData_->traj_recv_counts_.front(), 1, MPI_INT,
+                    root, comm_, &traj_requests_[0]);
+        MPI_Wait(&traj_requests_[0], MPI_STATUS_IGNORE);
+        size_t total = 0;
+        for (int r = 0; r < np; r++) {
+            total += commData_->traj_recv_counts_[r];
+        }
+        commData_->setRecvTrajectoryBufferSize(total);
+        char *recv_data = (total > 0) ? &commData_->recv_molecule_traj_.front() : NULL;
+        if (traj_point_to_point_) {
+            // 受信位置がintに収まらないので、rankごとの受信を受信バッファ内の位置を指定して発行する
+            traj_requests_.resize(2 + np, MPI_REQUEST_NULL);
+            size_t pos = 0;
+            for (int r = 0; r < np; r++) {
+                int count = commData_->traj_recv_counts_[r];
+                MPI_Irecv((count > 0) ? recv_data + pos * commData_->traj_record_size_ : NULL,
+                          count, MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                          r, TRAJ_TAG, comm_, &traj_requests_[2 + r]);
+                pos += count;
+            }
+            MPI_Isend(send_data, commData_->traj_send_count_, MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                      root, TRAJ_TAG, comm_, &traj_requests_[1]);
+        } else {
+            int displ = 0;
+            for (int r = 0; r < np; r++) {
+                commData_->traj_recv_displs_[r] = displ;
+                displ += commData_->traj_recv_counts_[r];
+            }
+            MPI_Igatherv(send_data, commData_->traj_send_count_,
+                         MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                         recv_data, &commData_->traj_recv_counts_.front(),
+                         &commData_->traj_recv_displs_.front(),
+                         MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
+                         root, comm_, &traj_requests_[1]);
+        }
+    }
+    traj_pending_ = true;
+}
+
+bool MdCommunicator::finishTrajectoryGather() {
+    if (!traj_pending_) {
+        return false;
+    }
+    MPI_Waitall(traj_requests_.size(), &traj_requests_.front(), MPI_STATUSES_IGNORE);
+    traj_pending_ = false;
+    /* 送信が済んだので、送信バッファを空にする */
+    commData_->clearSendTrajectory();
+    if (caseData_->isRootRank()) {
+        // 全rankの分がrank順に並んでいる受信データを、粒子の通し番号順の配列に移す
+        commData_->orderRecvTrajectoryToAllTrajectory();
+        commData_->clearRecvTrajectory();
+    }
+    return true;
+}
+
+void MdCommunicator::initSharedHalo() {
     /*
-     * 送受信が終わったので、送信バッファの内容はもう必要ない。
-     * 送信バッファの内容を空にしておく。
-     * バッファ用のメモリは、次回も使うので解放するわけではない。
-     * カウンタをゼロに戻すだけ。
+     * 同じノードにいる隣接プロセスとの周辺セルの座標の授受は、メッセージではなく、
+     * 共有メモリのウィンドウ（MPI_Win_allocate_shared）を介して行う。
+     * 各rankはウィンドウ内の自分の区画に、方位ごとの送信データを書き込み、
+     * 同期の後に、相手の区画から自分宛てのデータを直接読み出す。
+     * ノード外の相手とは、これまでどおり近傍集団通信で送受信する。
      */
-    pidx.reset();
-    while (pidx.next()) {
-        commData_->bufferFor(pidx)->clearSendMoleculeFullBuffer();
+    MPI_Comm_split_type(comm_, MPI_COMM_TYPE_SHARED, caseData_->my_rank_, MPI_INFO_NULL, &node_comm_);
+    MPI_Group group, node_group;
+    MPI_Comm_group(comm_, &group);
+    MPI_Comm_group(node_comm_, &node_group);
+    int dest_ranks[NEIGHBORS];
+    int src_ranks[NEIGHBORS];
+    for (int k = 0; k < NEIGHBORS; k++) {
+        dest_ranks[k] = send_peers_[k]->rank_;
+        src_ranks[k] = recv_peers_[k]->rank_;
+    }
+    // ノード内でのrankに変換する。ノード外のプロセスは MPI_UNDEFINED になる。
+    MPI_Group_translate_ranks(group, NEIGHBORS, dest_ranks, node_group, dest_node_rank_);
+    MPI_Group_translate_ranks(group, NEIGHBORS, src_ranks, node_group, src_node_rank_);
+    MPI_Group_free(&group);
+    MPI_Group_free(&node_group);
+    if (!caseData_->shared_memory_halo_) {
+        for (int k = 0; k < NEIGHBORS; k++) {
+            dest_node_rank_[k] = MPI_UNDEFINED;
+            src_node_rank_[k] = MPI_UNDEFINED;
+        }
     }
+    halo_win_ = MPI_WIN_NULL;
+    halo_capacity_ = 0;
+    halo_segment_ = NULL;
+}
 
+void MdCommunicator::allocateHaloWindow(MPI_Aint bytes) {
+    if (halo_win_ != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(halo_win_);
+        MPI_Win_free(&halo_win_);
+    }
+    // 各rankの区画は、そのrankの近くのメモリに置かれるようにする
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    MPI_Win_allocate_shared(bytes, 1, info, node_comm_, &halo_segment_, &halo_win_);
+    MPI_Info_free(&info);
+    halo_capacity_ = bytes;
+    // 同期は MPI_Win_sync と MPI_Barrier で行うので、ロックは開きっぱなしにする
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, halo_win_);
+    for (int k = 0; k < NEIGHBORS; k++) {
+        src_segment_[k] = NULL;
+        if (src_node_rank_[k] != MPI_UNDEFINED) {
+            MPI_Aint size;
+            int disp_unit;
+            MPI_Win_shared_query(halo_win_, src_node_rank_[k], &size, &disp_unit, &src_segment_[k]);
+        }
+    }
 }
 
-void MdCommunicator::sendTrajectroyDataToRoot() {
-    //Logger::out << "sendTrajectroyDataToRoot" << std::endl;
+void MdCommunicator::publishHaloSegment() {
+    /*
+     * 区画の構成
+     *   ヘッダ : 第k近傍ごとに int 4個
+     *            (セル別の粒子数の位置[int単位], セルの数, 座標データの位置[バイト単位], 粒子数)
+     *            位置はいずれも区画の先頭から数える。
+     *   セル別の粒子数 : int の配列
+     *   座標データ : CommMoleculePosData の配列（16バイト境界から）
+     */
+    int cell_total = 0;
+    int data_total = 0;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (sendsShared(k)) {
+            cell_total += send_peers_[k]->send_count_per_cell_.size();
+            data_total += send_peers_[k]->send_count_;
+        }
+    }
+    MPI_Aint cells_top = HALO_HEADER_INTS * sizeof(int);
+    MPI_Aint data_top = (cells_top + cell_total * sizeof(int) + 15) / 16 * 16;
+    MPI_Aint bytes = data_top + (MPI_Aint)data_total * sizeof(CommMoleculePosData);
+
+    // ノード内の全rankが前回の読み出しを終えてから書き込む。
+    // 区画が足りないrankがあれば、全rankで余裕をもって割り当て直す。
+    MPI_Aint needed = bytes;
+    MPI_Allreduce(MPI_IN_PLACE, &needed, 1, MPI_AINT, MPI_MAX, node_comm_);
+    if (needed > halo_capacity_) {
+        allocateHaloWindow(needed + needed / 2);
+    }
+
+    int *header = (int *)halo_segment_;
+    int ci = HALO_HEADER_INTS;
+    MPI_Aint di = data_top;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        int *h = header + k * 4;
+        h[0] = ci;
+        h[1] = 0;
+        h[2] = di;
+        h[3] = 0;
+        if (!sendsShared(k)) {
+            continue;
+        }
+        h[1] = speer->send_count_per_cell_.size();
+        h[3] = speer->send_count_;
+        std::copy(speer->send_count_per_cell_.begin(), speer->send_count_per_cell_.end(), header + ci);
+        std::copy(speer->send_molecule_pos_.begin(), speer->send_molecule_pos_.end(),
+                  (CommMoleculePosData *)(halo_segment_ + di));
+        ci += h[1];
+        di += h[3] * sizeof(CommMoleculePosData);
+    }
+    // 書き込みを他のrankから見えるようにしてから、全rankの書き込みの完了を待つ
+    MPI_Win_sync(halo_win_);
+    MPI_Barrier(node_comm_);
+    MPI_Win_sync(halo_win_);
+}
 
+void MdCommunicator::initRmaHalo() {
     /*
-     * 自身がrootの場合は扱いが違うので、自身がroot以外の場合にだけ送信する。
+     * ノード外の隣接プロセスとの周辺セルの座標の授受を、一方向通信で行う準備をする。
+     * 各rankは第k近傍からの受信用の領域を動的ウィンドウに公開し、送信側はそこに
+     * MPI_Put で、セル別の粒子数と座標データを直接書き込む。同期は隣接プロセスだけを
+     * 対象にした post-start-complete-wait で行う。
+     *
+     * 受信用の領域の大きさ（粒子数）は、送信側と受信側で同じ値を持っておく。
+     * 粒子数が領域に収まらなかった場合だけ、そのステップの分をメッセージで送り、
+     * 受信側が大きな領域を公開し直して、そのアドレスを送信側に知らせる。
+     * 通常のステップでは、受信側は受信の待ち受け（メッセージの照合）をしない。
      */
-    if (!caseData_->isRootRank()) {
-        int send_count = commData_->send_molecule_traj_.size();
-        CommMoleculeTrajData *send_data = &commData_->send_molecule_traj_.front();
-      //  Logger::out << "Sending " << send_count
-        //            << " molecules from rank " << caseData_->my_rank_ << std::endl;
-
-        /*
-        for(int k = 0; k < send_count; ++k){
-          std::cout << " send_mol = " << send_data[k] << std::endl;
+    rma_active_ = caseData_->rma_halo_;
+    rma_win_ = MPI_WIN_NULL;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        rma_recv_seg_[k] = NULL;
+        rma_recv_cap_[k] = 0;
+        rma_target_addr_[k] = 0;
+        rma_target_cap_[k] = 0;
+    }
+    if (!rma_active_) {
+        return;
+    }
+    MPI_Win_create_dynamic(MPI_INFO_NULL, comm_, &rma_win_);
+
+    // PSCWの相手のグループ。同じ相手は一度だけ含める。
+    std::vector<int> srcs, dests;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (recvsRma(k)) {
+            srcs.push_back(recv_peers_[k]->rank_);
+        }
+        if (sendsRma(k)) {
+            dests.push_back(send_peers_[k]->rank_);
         }
-        */
-
-        /* データをルートrankに送る。粒子数を表す整数を送り、それに続いて粒子の座標データを送る */
-        MPI_Send(&send_count,
-                 1,
-                 MPI_INT,
-                 0,
-                 0,
-                 MPI_COMM_WORLD);
-
-        MPI_Send(send_data,
-                 send_count,
-                 MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
-                 0,
-                 0,
-                 MPI_COMM_WORLD);
-
-        /* 送信が済んだので、送信バッファを空にする */
-        commData_->clearSendTrajectory();
-    }
-    //Logger::out << "sendTrajectoryDataToRoot: done" << std::endl;
+    }
+    std::sort(srcs.begin(), srcs.end());
+    srcs.erase(std::unique(srcs.begin(), srcs.end()), srcs.end());
+    std::sort(dests.begin(), dests.end());
+    dests.erase(std::unique(dests.begin(), dests.end()), dests.end());
+    MPI_Group group;
+    MPI_Comm_group(comm_, &group);
+    MPI_Group_incl(group, srcs.size(), srcs.data(), &rma_src_group_);
+    MPI_Group_incl(group, dests.size(), dests.data(), &rma_dest_group_);
+    MPI_Group_free(&group);
+
+    // 一つの方位に面するセルの数は、最も大きい面のセル数を超えない
+    rma_max_cells_ = std::max(caseData_->ncx_ * caseData_->ncy_,
+                              std::max(caseData_->ncy_ * caseData_->ncz_, caseData_->ncz_ * caseData_->ncx_));
+
+    // 粒子数0の領域を公開し、そのアドレスを送信元に知らせる。
+    // 第k近傍に送ったものは、相手の第k近傍からの受信として届く。
+    // こちらの受信の第k近傍は、送信の第(25-k)近傍にいるので、そこに向けて送る。
+    MPI_Aint info_send[NEIGHBORS * 2];
+    MPI_Aint info_recv[NEIGHBORS * 2];
+    for (int j = 0; j < NEIGHBORS; j++) {
+        if (recvsRma(j)) {
+            attachRmaRecvSegment(j, 0);
+        }
+    }
+    for (int k = 0; k < NEIGHBORS; k++) {
+        int j = NEIGHBORS - 1 - k;
+        MPI_Aint addr = 0;
+        if (rma_recv_seg_[j] != NULL) {
+            MPI_Get_address(rma_recv_seg_[j], &addr);
+        }
+        info_send[k * 2] = addr;
+        info_send[k * 2 + 1] = rma_recv_cap_[j];
+    }
+    MPI_Neighbor_alltoall(info_send, 2, MPI_AINT, info_recv, 2, MPI_AINT, neighbor_comm_);
+    for (int j = 0; j < NEIGHBORS; j++) {
+        int k = NEIGHBORS - 1 - j;
+        rma_target_addr_[k] = info_recv[j * 2];
+        rma_target_cap_[k] = info_recv[j * 2 + 1];
+    }
+}
+
+int MdCommunicator::rmaHeaderBytes() const {
+    // 粒子数の合計と、セル別の粒子数。座標データは16バイト境界から置く。
+    return ((1 + rma_max_cells_) * sizeof(int) + 15) / 16 * 16;
+}
+
+void MdCommunicator::attachRmaRecvSegment(int k, MPI_Aint capacity) {
+    MPI_Aint bytes = rmaHeaderBytes() + capacity * sizeof(CommMoleculePosData);
+    rma_recv_seg_[k] = new char[bytes];
+    rma_recv_cap_[k] = capacity;
+    MPI_Win_attach(rma_win_, rma_recv_seg_[k], bytes);
 }
 
-void MdCommunicator::recvTrajectoryDataAtRoot() {
-    // このメソッドは、rootでだけ呼ばれる
-    assert(caseData_->isRootRank());
-
-    //Logger::out << "recvTrajectroyDataToRoot" << std::endl;
-
-    // 全rankのそれぞれから順にデータを受信する。
-    GridIterator3d procIt(caseData_->allProcessesRange_);
-    while (procIt.next()) {
-        //MdCommPeerBuffer *peer = commData_->bufferFor(procIt);いらない
-        //peer->setMoleculeFullDataRecvBuffer();
-
-        int rank = caseData_->getRankForProcess(procIt);
-        // root自身の分のデータは通信によらずに、単なるデータの転記で済ませる。
-        if (rank == 0) {
-            // データをもらってくる相手は rank == 0 つまり、自身である。
-            // rootであっても、他のrank同様に、送信データバッファにデータが入っているので、
-            // それを受信データバッファに転記する。
-            commData_->appendSendTrajectoryDataToRecvTrajectoryData();
-            // 送信を終えた場合と同様に、送信データバッファをクリアする
-            commData_->clearSendTrajectory();
+void MdCommunicator::exchangeRmaHalo() {
+    // 受信元に対する公開と、送信先に対するアクセスのエポックを開始する
+    MPI_Win_post(rma_src_group_, 0, rma_win_);
+    MPI_Win_start(rma_dest_group_, 0, rma_win_);
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (!sendsRma(k)) {
+            continue;
+        }
+        MdCommPeerBuffer *speer = send_peers_[k];
+        int cells = speer->send_count_per_cell_.size();
+        assert(cells <= rma_max_cells_);
+        // ヘッダはエポックが終わるまで書き換えないように、近傍ごとに持つ
+        std::vector<int> &header = rma_send_header_[k];
+        header.resize(1 + cells);
+        header[0] = speer->send_count_;
+        std::copy(speer->send_count_per_cell_.begin(), speer->send_count_per_cell_.end(),
+                  header.begin() + 1);
+        MPI_Put(header.data(), 1 + cells, MPI_INT,
+                speer->rank_, rma_target_addr_[k], 1 + cells, MPI_INT, rma_win_);
+        int n = speer->send_count_;
+        if (n > 0 && n <= rma_target_cap_[k]) {
+            MPI_Put(speer->send_molecule_pos_.data(), n, MPI_MOLECULE_POS_DATA_TYPE,
+                    speer->rank_, MPI_Aint_add(rma_target_addr_[k], rmaHeaderBytes()),
+                    n, MPI_MOLECULE_POS_DATA_TYPE, rma_win_);
+        }
+    }
+    MPI_Win_complete(rma_win_);
+    MPI_Win_wait(rma_win_);
+
+    // 書き込まれた粒子数を読み、領域に収まらなかった分はメッセージで送受信する。
+    // タグは近傍の番号で、同じ相手との間の複数の方位を区別する。
+    MPI_Request reqs[NEIGHBORS * 2];
+    int reqi = 0;
+    bool overflow = false;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (!recvsRma(k)) {
+            continue;
+        }
+        MdCommPeerBuffer *rpeer = recv_peers_[k];
+        const int *header = (const int *)rma_recv_seg_[k];
+        std::copy(header + 1, header + 1 + rpeer->recv_count_per_cell_.size(), rpeer->recv_count_per_cell_.begin());
+        rpeer->setMoleculePosDataRecvBuffer(); // Note 'PosData'
+        assert(header[0] == (int)rpeer->recv_count_);
+        int n = rpeer->recv_count_;
+        if (n <= rma_recv_cap_[k]) {
+            const CommMoleculePosData *data =
+                    (const CommMoleculePosData *)(rma_recv_seg_[k] + rmaHeaderBytes());
+            std::copy(data, data + n, rpeer->recv_molecule_pos_.begin());
         } else {
-            // データをもらってくる相手はルート以外なので、実際に通信をする。
-            int recv_count = 0;
-            MPI_Status status;
-            MPI_Recv(&recv_count,
-                     1,
-                     MPI_INT,
-                     rank,
-                     0,
-                     MPI_COMM_WORLD,
-                     &status);
-
-            commData_->recv_molecule_traj_.resize(recv_count);
-
-            //  Logger::out << "Receiving " << recv_count
-            //            << " molecules from rank " << caseData_->my_rank_ << std::endl;
-
-            // データ数に続いて、粒子のデータを受信する。
-            CommMoleculeTrajData *recv_data = &commData_->recv_molecule_traj_.front();
-            MPI_Recv(recv_data,
-                     recv_count,
-                     MdCommunicator::MPI_MOLECULE_TRAJECTORY_DATA_TYPE,
-                     rank,
-                     0,
-                     MPI_COMM_WORLD,
-                     &status);
-
-            /*
-             if(caseData_->isRootRank()){
-                for(int k = 0; k < recv_count; ++k){
-                  Logger::out << " recv_mol = " << recv_data[k] << std::endl;
-                }
-             }
-             */
+            overflow = true;
+            MPI_Irecv(rpeer->recv_molecule_pos_.data(), n, MPI_MOLECULE_POS_DATA_TYPE,
+                      rpeer->rank_, k, comm_, &reqs[reqi++]);
+        }
+    }
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        if (sendsRma(k) && (MPI_Aint)speer->send_count_ > rma_target_cap_[k]) {
+            overflow = true;
+            MPI_Isend(speer->send_molecule_pos_.data(), speer->send_count_, MPI_MOLECULE_POS_DATA_TYPE,
+                      speer->rank_, k, comm_, &reqs[reqi++]);
+        }
+    }
+    MPI_Waitall(reqi, reqs, MPI_STATUSES_IGNORE);
+    if (!overflow) {
+        return;
+    }
 
+    // 収まらなかった近傍について、受信側は余裕をもった領域を公開し直し、
+    // そのアドレスと粒子数を送信側に知らせる。
+    MPI_Aint new_info[NEIGHBORS][2];
+    char *retired[NEIGHBORS];
+    int nretired = 0;
+    reqi = 0;
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (!recvsRma(k) || (MPI_Aint)recv_peers_[k]->recv_count_ <= rma_recv_cap_[k]) {
+            continue;
+        }
+        MPI_Aint n = recv_peers_[k]->recv_count_;
+        retired[nretired++] = rma_recv_seg_[k];
+        attachRmaRecvSegment(k, n + n / 2 + 16);
+        MPI_Get_address(rma_recv_seg_[k], &new_info[k][0]);
+        new_info[k][1] = rma_recv_cap_[k];
+        MPI_Isend(new_info[k], 2, MPI_AINT, recv_peers_[k]->rank_, NEIGHBORS + k, comm_, &reqs[reqi++]);
+    }
+    MPI_Aint target_info[NEIGHBORS][2];
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (sendsRma(k) && (MPI_Aint)send_peers_[k]->send_count_ > rma_target_cap_[k]) {
+            MPI_Irecv(target_info[k], 2, MPI_AINT, send_peers_[k]->rank_, NEIGHBORS + k, comm_, &reqs[reqi++]);
+        }
+    }
+    MPI_Waitall(reqi, reqs, MPI_STATUSES_IGNORE);
+    for (int k = 0; k < NEIGHBORS; k++) {
+        if (sendsRma(k) && (MPI_Aint)send_peers_[k]->send_count_ > rma_target_cap_[k]) {
+            rma_target_addr_[k] = target_info[k][0];
+            rma_target_cap_[k] = target_info[k][1];
         }
-        // 受信を終えた場合と同様に、受信データをトラジェクトリ配列に分配する（粒子の通し番号順に）
-        commData_->orderRecvTrajectoryToAllTrajectory();
-        // 受信データをトラジェクトリ配列に格納したら、受信バッファをクリアする
-        commData_->clearRecvTrajectory();
     }
-    //Logger::out << "recvTrajectoryDataToRoot: done" << std::endl;
+    // 古い領域に書き込む送信側はもういない
+    for (int i = 0; i < nretired; i++) {
+        MPI_Win_detach(rma_win_, retired[i]);
+        delete[] retired[i];
+    }
 }
 
-void MdCommunicator::exchangeMoleculePosData() {
-    MPI_Request reqs[26 + 26];
-    MPI_Status stats[26 + 26];
-    GridPeerIterator3d pidx; // このイテレータは [1,1,1]を飛ばして [0,0,0] - [2,2,2] の間の26方位を発生する。
-    int reqi = 0;
-    while (pidx.next()) {
-        // この方位のpeer buffer を取得する
-        MdCommPeerBuffer *peer = commData_->bufferFor(pidx);
-        peer->setMoleculePosDataSendCount();
-        // 方位が決まると、その方位のpeerに面しているセルの数が決まる。
-        // こちらから送信する粒子の数は、総合計ではなく、セルごとの粒子数の配列として送る
-        // 向こうからも、同じ長さの配列で、セル別の粒子数を送ってくる。
-        // つまり、同じ長さの整数配列を相互に送り合うことになる。
-        size_t cell_count = peer->send_count_per_cell_.size();
-        // 本メソッドが呼ばれる時点では、送信用の配列にはすでに値がつまっているが、
-        // 受信用の配列は、領域すら準備されていない（初回の時点では）
-        // そこで、受信用のバッファの長さを割り当てる。
-        // この長さは毎回同じなので、初期化処理に移してもよい（大きな性能向上は望めないが）
-        peer->recv_count_per_cell_.resize(cell_count);
-        // 送り出したいデータが始まるアドレス
-        int *send_count_addr = &peer->send_count_per_cell_.front();
-        // 受信データを受け取る配列が待ち受けているアドレス
-        int *recv_count_addr = &peer->recv_count_per_cell_.front();
-
-        // デバッグ用のログの例を示すが、この箇所は呼び出し回数が多いのでリリース版では
-        // #ifdefによる抑止が必須である。
-        //  Logger::out << "Exchanging migrating particle counts for " << cell_count;
-        //  Logger::out << " boundary cells with rank " << peer->rank_;
-        //  Logger::out << " with tag " << peer->tagForSend() << "/" << peer->tagForRecv()<<std::endl;
-
-        // 必要な通信をここで行う。
-        MPI_Isend(send_count_addr,
-                  cell_count,
-                  MPI_INT,
-                  peer->rank_,
-                  peer->tagForSend(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi]);
-        MPI_Irecv(recv_count_addr,
-                  cell_count,
-                  MPI_INT,
-                  peer->rank_,
-                  peer->tagForRecv(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi + 1]);
-        reqi += 2;
-    }
-    MPI_Waitall(reqi, reqs, stats);
+void MdCommunicator::exchangeMoleculePosData(bool refresh) {
     /*
-     * 上記で、相手との境界に面したセルごとに、お互いに送信予定の粒子数を、相互に伝えることができた。
-     * 続いて、実際の粒子の座標データの授受に移る。
+     * セル別の粒子数の配列を送り合い、続いて粒子の座標データを送り合う。
+     * 手順は exchangeMoleculeFullData と同じ。
+     * 同じノードの相手の分は、共有メモリの区画に書き込み、相手の区画から読み出す。
+     * 一方向通信を使う場合、ノード外の相手の分は相手の受信用の領域に直接書き込む。
+     * 近傍集団通信では、それらの相手の分は長さ0として送受信しない。
      */
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        MdCommPeerBuffer *rpeer = recv_peers_[k];
+        speer->setMoleculePosDataSendCount();
+        rpeer->recv_count_per_cell_.resize(rpeer->send_count_per_cell_.size());
+        if (sendsShared(k) || sendsRma(k)) {
+            count_blocks_.setSend(k, NULL, 0, MPI_INT);
+        } else {
+            count_blocks_.setSend(k, speer->send_count_per_cell_.data(),
+                    speer->send_count_per_cell_.size(), MPI_INT);
+        }
+        if (recvsShared(k) || recvsRma(k)) {
+            count_blocks_.setRecv(k, NULL, 0, MPI_INT);
+        } else {
+            count_blocks_.setRecv(k, rpeer->recv_count_per_cell_.data(),
+                    rpeer->recv_count_per_cell_.size(), MPI_INT);
+        }
+    }
+    if (caseData_->shared_memory_halo_) {
+        // ノード内の全rankの同期を含むので、同じノードの相手がいなくても呼ぶ
+        publishHaloSegment();
+    }
+    if (rma_active_) {
+        exchangeRmaHalo();
+    }
+    if (!refresh) {
+        MPI_Neighbor_alltoallw(MPI_BOTTOM, count_blocks_.send_counts_, count_blocks_.send_displs_,
+                               count_blocks_.send_types_,
+                               MPI_BOTTOM, count_blocks_.recv_counts_, count_blocks_.recv_displs_,
+                               count_blocks_.recv_types_, neighbor_comm_);
+    }
 
-    pidx.reset(); // 先ほど使ったイテレータを初期状態に戻す。
-    reqi = 0;
-    while (pidx.next()) {
-        MdCommPeerBuffer *peer = commData_->bufferFor(pidx);
-        // 送信する粒子数の合計値を求める
-        peer->setMoleculePosDataSendCount();
-        // 先に受信した粒子数の配列から、受信予定の総粒子数を求め、その数に合わせて
-        // 粒子の座標データ用の受信バッファを用意する。
-        peer->setMoleculePosDataRecvBuffer(); // Note 'PosData'
-        //  Logger::out << "Exchaning molecules with rank " << peer->rank_;
-        //  Logger::out << " with tag " << peer->tagForSend() << "/" << peer->tagForRecv();
-        //  Logger::out << " sending " << peer->send_count_ << ", receiving " << peer->recv_count_ << std::endl;
-        // 送信データの先頭アドレス
-        CommMoleculePosData *send_addr = &peer->send_molecule_pos_.front();
-        // 受信データを受け取る配列の先頭アドレス
-        CommMoleculePosData *recv_addr = &peer->recv_molecule_pos_.front();
-
-        //  Logger::out <<"one direction"<<std::endl;
-        //for (int k = 0; k < peer->send_count_; k++) {
-        //    Logger::out << peer->send_molecule_pos_[k] << std::endl;
-        //}
-
-        // 通信のための適切な関数を呼ぶ
-        MPI_Isend(send_addr,
-                  peer->send_count_,
-                  MPI_MOLECULE_POS_DATA_TYPE,
-                  peer->rank_,
-                  peer->tagForSend(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi]);
-
-        MPI_Irecv(recv_addr,
-                  peer->recv_count_,
-                  MPI_MOLECULE_POS_DATA_TYPE,
-                  peer->rank_,
-                  peer->tagForRecv(),
-                  MPI_COMM_WORLD,
-                  &reqs[reqi + 1]);
-        reqi += 2;
-    }
-
-    MPI_Waitall(reqi, reqs, stats);
+    for (int k = 0; k < NEIGHBORS; k++) {
+        MdCommPeerBuffer *speer = send_peers_[k];
+        MdCommPeerBuffer *rpeer = recv_peers_[k];
+        if (recvsShared(k)) {
+            // 同じノードの相手の区画から、第k近傍向けに書かれたセル別の粒子数と座標データを読み出す
+            const char *segment = src_segment_[k];
+            const int *h = (const int *)segment + k * 4;
+            const int *cells = (const int *)segment + h[0];
+            assert(h[1] == (int)rpeer->recv_count_per_cell_.size());
+            std::copy(cells, cells + h[1], rpeer->recv_count_per_cell_.begin());
+            rpeer->setMoleculePosDataRecvBuffer(); // Note 'PosData'
+            assert(h[3] == (int)rpeer->recv_count_);
+            const CommMoleculePosData *data = (const CommMoleculePosData *)(segment + h[2]);
+            std::copy(data, data + h[3], rpeer->recv_molecule_pos_.begin());
+            pos_blocks_.setRecv(k, NULL, 0, MPI_MOLECULE_POS_DATA_TYPE);
+        } else if (recvsRma(k)) {
+            // exchangeRmaHalo で受信済み
+            pos_blocks_.setRecv(k, NULL, 0, MPI_MOLECULE_POS_DATA_TYPE);
+        } else {
+            // 先に受信した粒子数の配列から、受信予定の総粒子数を求め、その数に合わせて
+            // 粒子の座標データ用の受信バッファを用意する。
+            // refreshの場合は、前回の再構築の回に求めた総粒子数をそのまま使う。
+            if (refresh) {
+                rpeer->recv_molecule_pos_.resize(rpeer->recv_count_);
+            } else {
+                rpeer->setMoleculePosDataRecvBuffer(); // Note 'PosData'
+            }
+            pos_blocks_.setRecv(k, rpeer->recv_molecule_pos_.data(), rpeer->recv_count_,
+                    MPI_MOLECULE_POS_DATA_TYPE);
+        }
+        if (sendsShared(k) || sendsRma(k)) {
+            pos_blocks_.setSend(k, NULL, 0, MPI_MOLECULE_POS_DATA_TYPE);
+        } else {
+            pos_blocks_.setSend(k, speer->send_molecule_pos_.data(), speer->send_count_,
+                    MPI_MOLECULE_POS_DATA_TYPE);
+        }
+    }
+    MPI_Neighbor_alltoallw(MPI_BOTTOM, pos_blocks_.send_counts_, pos_blocks_.send_displs_,
+                           pos_blocks_.send_types_,
+                           MPI_BOTTOM, pos_blocks_.recv_counts_, pos_blocks_.recv_displs_,
+                           pos_blocks_.recv_types_, neighbor_comm_);
     /*
      * 送受信が終わったので、送信バッファの内容はもう必要ない。
      * 送信バッファの内容を空にしておく。
      * バッファ用のメモリは、次回も使うので解放するわけではない。
      * カウンタをゼロに戻すだけ。
+     * 共有メモリの区画は、次回の書き込みの前に、ノード内の全rankの読み出しの完了を待つ。
      */
-    pidx.reset();
-    while (pidx.next()) {
-        commData_->bufferFor(pidx)->clearSendMoleculePosBuffer();
+    for (int k = 0; k < NEIGHBORS; k++) {
+        send_peers_[k]->clearSendMoleculePosBuffer();
     }
     //Logger::out << "Pos comm finish" << std::endl;
 }
 
-void MdCommunicator::calcEnergy() {
-    MPI_Reduce(&commData_->send_uk_, &commData_->recv_uk_, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-    MPI_Reduce(&commData_->send_up_, &commData_->recv_up_, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-    commData_->total_uk_ = commData_->recv_uk_;
-    commData_->total_up_ = commData_->recv_up_;
-    commData_->recv_up_ = 0;
-    commData_->recv_uk_ = 0;
+void MdCommunicator::finalize() {
+    if (halo_win_ != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(halo_win_);
+        MPI_Win_free(&halo_win_);
+    }
+    MPI_Comm_free(&node_comm_);
+    if (rma_win_ != MPI_WIN_NULL) {
+        for (int k = 0; k < NEIGHBORS; k++) {
+            if (rma_recv_seg_[k] != NULL) {
+                MPI_Win_detach(rma_win_, rma_recv_seg_[k]);
+                delete[] rma_recv_seg_[k];
+                rma_recv_seg_[k] = NULL;
+            }
+        }
+        MPI_Win_free(&rma_win_);
+        MPI_Group_free(&rma_src_group_);
+        MPI_Group_free(&rma_dest_group_);
+    }
+}
+
+void MdCommunicator::startEnergyReduction() {
+    assert(!energy_pending_);
+    // Uk, Upなどを一つの配列にまとめて、一回の集約で送る。
+    // 完了を待たずに戻り、待ち時間を次のステップの計算と重ねる。
+    MPI_Ireduce(commData_->send_energy_, commData_->recv_energy_, ENERGY_TERMS,
+                MPI_DOUBLE, MPI_SUM, 0, comm_, &energy_request_);
+    energy_pending_ = true;
+}
+
+bool MdCommunicator::finishEnergyReduction() {
+    if (!energy_pending_) {
+        return false;
+    }
+    MPI_Wait(&energy_request_, MPI_STATUS_IGNORE);
+    energy_pending_ = false;
     //Logger::out << "recvEnergyDataAtRoot" << std::endl;
+    return true;
+}
+
+void MdCommunicator::reduceTimes(const double *local, double *tmax, double *tsum, int count) {
+    MPI_Reduce(const_cast<double *>(local), tmax, count, MPI_DOUBLE, MPI_MAX, 0, comm_);
+    MPI_Reduce(const_cast<double *>(local), tsum, count, MPI_DOUBLE, MPI_SUM, 0, comm_);
+}
+
+double MdCommunicator::maxOverRanks(double value) {
+    double result;
+    MPI_Allreduce(&value, &result, 1, MPI_DOUBLE, MPI_MAX, comm_);
+    return result;
+}
+
+bool MdCommunicator::anyOverRanks(bool value) {
+    int local = value ? 1 : 0;
+    int result;
+    MPI_Allreduce(&local, &result, 1, MPI_INT, MPI_LOR, comm_);
+    return result != 0;
+}
+
+void MdCommunicator::sumOverRanks(double *values, int n) {
+    MPI_Allreduce(MPI_IN_PLACE, values, n, MPI_DOUBLE, MPI_SUM, comm_);
+}
+
+void MdCommunicator::reduceCorrelations() {
+    MultiTauCorrelator *correlator = &commData_->correlator_;
+    double *data = correlator->data();
+    if (caseData_->isRootRank()) {
+        MPI_Reduce(MPI_IN_PLACE, data, correlator->dataSize(), MPI_DOUBLE, MPI_SUM, 0, comm_);
+    } else {
+        MPI_Reduce(data, NULL, correlator->dataSize(), MPI_DOUBLE, MPI_SUM, 0, comm_);
+    }
+}
+
+void MdCommunicator::reduceRdf() {
+    // ヒストグラム、分子数、サンプル数が一つの配列に並んでいるので、一回の集約で済む
+    RdfAccumulator *rdf = &commData_->rdf_;
+    long long *data = rdf->data();
+    if (caseData_->isRootRank()) {
+        MPI_Reduce(MPI_IN_PLACE, data, rdf->dataSize(), MPI_LONG_LONG, MPI_SUM, 0, comm_);
+    } else {
+        MPI_Reduce(data, NULL, rdf->dataSize(), MPI_LONG_LONG, MPI_SUM, 0, comm_);
+    }
 }
@@ -7,6 +7,8 @@
 #include <MdDriver.h>
 #include <Logger.h>
 
+#include <iostream>
+
 MdDriver::~MdDriver() {
 
 }
@@ -15,26 +17,123 @@ MdDriver::MdDriver() {
 
 }
 
-void MdDriver::init(CaseData *caseData) {
+void MdDriver::init(CaseData *caseData, MPI_Comm world) {
     // caseDataは初期化済みのものが渡ってくる
     caseData_ = caseData;
     // commData（通信バッファ）を初期化する
     commData_.init(caseData);
     // communicator（通信機能）を初期化する
-    communicator_.init(caseData_, &commData_);
+    communicator_.init(caseData_, &commData_, world);
     // 本プロセスの保持する物理計算のデータを初期化する（データファイル読み込みはここで起きる）
     procData_.init(caseData_, &commData_);
+    if (caseData_->latticeRequested()) {
+        // 生成した初期状態の重心速度と、トラジェクトリーに出力する分子の数を全rankで集計する
+        double sums[MdProcData::GENERATED_SUMS];
+        procData_.sumGeneratedState(sums);
+        communicator_.sumOverRanks(sums, MdProcData::GENERATED_SUMS);
+        procData_.finishGeneratedState(sums);
+    }
+    // 見積もったメモリ量が上限を超えるrankがあれば、全rankで止める
+    if (caseData_->memory_limit_mb_ > 0) {
+        bool all_trajectory = caseData_->isRootRank() && caseData_->trajectory_output_;
+        caseData_->checkMemoryLimit(communicator_.maxOverRanks(procData_.estimateMemoryBytes(all_trajectory)));
+    }
+    communicator_.initTrajectoryGather(procData_.getTrajectoryMoleculeCount());
     if (caseData_->isRootRank()) {
         // rootである場合はさらに、トラジェクトリーデータ受信用に
-        // 全粒子数分の配列を割当てる
-        commData_.setAllMoleculeCount(procData_.getMoleculeCount());
+        // 出力する全分子の数の分の配列を割当てる
+        if (caseData_->trajectory_output_) {
+            commData_.setAllMoleculeCount(procData_.getTrajectoryMoleculeCount());
+        }
         // データ出力用ファイルを開く。
         commData_.openOutputFiles();
     }
+    // 初期化にかかった時間は計測対象に含めない
+    timer_.reset();
+}
+
+
+void MdDriver::calcForces(bool outer, bool kick) {
+    if (!caseData_->respaRequested()) {
+        procData_.calcForce(LJ_FORCE_FULL, kick);
+        return;
+    }
+    // r-RESPAでは、近距離の部分を毎ステップ、遠距離の部分を respa_steps_ ステップに一回計算する。
+    // 速度の半分の更新は近距離の部分の力によるので、近距離の部分の計算に続けて行う。
+    procData_.calcForce(LJ_FORCE_INNER, kick);
+    if (outer) {
+        procData_.calcForce(LJ_FORCE_OUTER);
+    }
+}
+
+void MdDriver::calcForcesAndUp() {
+    if (!caseData_->respaRequested()) {
+        procData_.calcForceAndUp();
+        return;
+    }
+    // 結果出力回は遠距離の部分を計算する回なので、Upはそちらで全ての組について集計する
+    assert(caseData_->isRespaOuterRound());
+    procData_.calcForce(LJ_FORCE_INNER);
+    procData_.calcForceAndUp(LJ_FORCE_OUTER);
+}
+
+void MdDriver::flushEnergyData() {
+    // 集約中のエネルギーがあれば完了を待ち、rootはファイルに書く
+    if (communicator_.finishEnergyReduction() && caseData_->isRootRank()) {
+        procData_.writeEnergyData();
+    }
 }
 
+void MdDriver::flushTrajectoryData() {
+    // 収集中のトラジェクトリーがあれば完了を待ち、rootはファイルに書く
+    if (communicator_.finishTrajectoryGather() && caseData_->isRootRank()) {
+        procData_.writeTrajectoryData();
+    }
+}
 
 void MdDriver::finalize() {
+    // 最後の出力回のエネルギーとトラジェクトリーは、まだファイルに書かれていない
+    flushEnergyData();
+    flushTrajectoryData();
+    if (commData_.rdf_.isActive()) {
+        // 各rankで集計した動径分布関数をrootに集約して出力する
+        communicator_.reduceRdf();
+        if (caseData_->isRootRank()) {
+            commData_.writeRdf();
+        }
+    }
+    if (commData_.correlator_.isActive()) {
+        // 各rankで集計したMSD/VACFをrootに集約して出力する
+        communicator_.reduceCorrelations();
+        if (caseData_->isRootRank()) {
+            commData_.writeCorrelations();
+        }
+    }
     // 出力用ファイルを一通りクローズする
     commData_.closeOutputFiles();
+    // 通信の終了処理
+    communicator_.finalize();
+}
+
+void MdDriver::reportPhaseTimes() {
+    // 各フェーズの積算時間と、時間発展ループ全体の経過時間を一つの配列にまとめて集約する
+    const int n = PHASE_COUNT + 1;
+    double local[n], tmax[n], tsum[n];
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        local[i] = timer_.elapsed(i);
+    }
+    local[PHASE_COUNT] = timer_.total();
+    communicator_.reduceTimes(local, tmax, tsum, n);
+
+    if (caseData_->isRootRank()) {
+        // ベンチマークスクリプト(bench/scaling_bench.py)が解析する形式で出力する。
+        // 最も遅いrankの値(max)が並列実行時の所要時間を決めるので、平均(avg)と並べて出力する。
+        int np = caseData_->num_procs_;
+        std::cout << "# phase timings [sec] : name max avg (ranks = " << np
+                  << ", steps = " << caseData_->step_count_ << ")" << std::endl;
+        for (int i = 0; i < n; i++) {
+            const char *name = (i < PHASE_COUNT) ? PhaseTimer::phaseName(i) : "total";
+            std::cout << "phase " << name << " " << tmax[i] << " " << tsum[i] / np << std::endl;
+        }
+    }
 }
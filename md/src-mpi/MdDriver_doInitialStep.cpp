@@ -4,20 +4,33 @@
 
 void MdDriver::doInitialStep() {
     Logger::out << "MdDriver::doStep  t = " << caseData_->t_ << std::endl;
+    // r-RESPAの遠距離の部分の力を計算する回か（ステップを進める前に判定しておく）
+    bool outer = caseData_->isRespaOuterRound();
 
     // HINT: some steps are skipped here. add them.
+    timer_.start(PHASE_HALO);
     procData_.exportSurfacingMoleculePosData();
     communicator_.exchangeMoleculePosData();
     procData_.importSurroundingMoleculePosData();
 
-    // 分子間力を計算する
-    procData_.calcForce();
+    // 分子間力を計算し、力の揃ったセルから順に速度を半分更新する
+    timer_.start(PHASE_FORCE);
+    calcForces(outer, true);
 
     // HINT: some steps are skipped here. add them.
-    procData_.clearSurroundingCells();
-
-    //a(t+Δt)とv(t+1/2Δt)からv(t+Δt)を計算
-    procData_.updateVelocityHalf();
+    // スキンを使う場合は、周辺セルの分子を次の再構築の回まで保持する
+    if (!caseData_->skinRequested()) {
+        timer_.start(PHASE_HALO);
+        procData_.clearSurroundingCells();
+    }
+
+    timer_.start(PHASE_INTEGRATE);
+    if (outer) {
+        // 遠距離の部分の力による速度の更新。近距離の部分と同様に、次の回の前半の分も続けて行う。
+        procData_.updateVelocitySlow();
+        procData_.updateVelocitySlow();
+    }
+    timer_.stop();
 
 
     // 時間発展の回が１ステップ進んだことを記録する
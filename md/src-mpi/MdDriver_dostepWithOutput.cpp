@@ -4,57 +4,111 @@
 
 void MdDriver::doStepWithOutput() {
     Logger::out << "MdDriver::doStep  t = " << caseData_->t_ << std::endl;
+    // r-RESPAの遠距離の部分の力を計算する回か（ステップを進める前に判定しておく）
+    bool outer = caseData_->isRespaOuterRound();
+    // 分子の移転と周辺セルの再構築を行う回か
+    bool rebuild = caseData_->isRebuildRound();
+
+    if (rebuild && caseData_->skinRequested()) {
+        // 前回の再構築の回から保持していた周辺セルの分子を捨てる
+        timer_.start(PHASE_HALO);
+        procData_.clearSurroundingCells();
+    }
 
-    //a(t)とv(t)からv(t+1/2Δt)を計算
-    procData_.updateVelocityHalf(); //done
-    // 位置を更新する
-    procData_.updatePosition(); //done
-
-    // 周辺セルに移動した粒子を、プロセスの外に転出する粒子として送信バッファに転記する
-    procData_.exportExitingMoleculeFullData();
-    // 転記が終わったので、全ての周辺セルを空にする
-    procData_.clearSurroundingCells();
-    // 周囲のプロセスとバッファ上のデータを送受信する
-    communicator_.exchangeMoleculeFullData();
-    // 受信バッファに受け取ったデータを表面セルに分配する
-    procData_.importEnteringMoleculeFullData();
-
+    //a(t)とv(t)からv(t+1/2Δt)を計算し、続けて位置を更新する。
+    // 再構築の間の回は、セルからはみ出した粒子もそのセルに残し、表面セルの座標を送信バッファに詰める。
+    timer_.start(PHASE_INTEGRATE);
+    bool inside = procData_.updateVelocityHalfAndPosition(rebuild);
+    if (!rebuild && communicator_.anyOverRanks(!inside)) {
+        // スキンの幅の半分を超えてはみ出した分子があるので、全rankでこの回を再構築の回に切り替える
+        Logger::out << "skin exceeded: rebuild at step " << caseData_->step_count_ << std::endl;
+        procData_.abandonHaloRefresh();
+        caseData_->restartRebuildInterval();
+        rebuild = true;
+    }
 
-    // HINT: some steps are skipped here. add them.
-    procData_.exportSurfacingMoleculePosData();
-    communicator_.exchangeMoleculePosData();
-    procData_.importSurroundingMoleculePosData();
+    if (rebuild) {
+        // 周辺セルに移動した粒子を、プロセスの外に転出する粒子として送信バッファに転記する
+        timer_.start(PHASE_MIGRATE);
+        procData_.exportExitingMoleculeFullData();
+        // 転記が終わったので、全ての周辺セルを空にする
+        procData_.clearSurroundingCells();
+        // 周囲のプロセスとバッファ上のデータを送受信する
+        communicator_.exchangeMoleculeFullData();
+        // 受信バッファに受け取ったデータを表面セルに分配する
+        procData_.importEnteringMoleculeFullData();
+
+
+        // HINT: some steps are skipped here. add them.
+        timer_.start(PHASE_HALO);
+        procData_.exportSurfacingMoleculePosData();
+        communicator_.exchangeMoleculePosData();
+        procData_.importSurroundingMoleculePosData();
+    } else {
+        // 再構築の回と同じ並びで、周辺セルの分子の座標だけを更新する。
+        // 送信バッファには updateVelocityHalfAndPosition で詰めてある。
+        timer_.start(PHASE_HALO);
+        communicator_.exchangeMoleculePosData(true);
+        procData_.refreshSurroundingMoleculePosData();
+    }
 
     // 分子間力を計算する
-    procData_.calcForceAndUp();
+    timer_.start(PHASE_FORCE);
+    calcForcesAndUp();
 
     // HINT: some steps are skipped here. add them.
-    procData_.clearSurroundingCells();
+    // スキンを使う場合は、周辺セルの分子を次の再構築の回まで保持する
+    if (!caseData_->skinRequested()) {
+        timer_.start(PHASE_HALO);
+        procData_.clearSurroundingCells();
+    }
 
     //a(t+Δt)とv(t+1/2Δt)からv(t+Δt)を計算
+    timer_.start(PHASE_INTEGRATE);
+    if (outer) {
+        // 遠距離の部分の力による速度の更新（respa_steps_ ステップ分の後半）
+        procData_.updateVelocitySlow();
+    }
     procData_.updateVelocityHalfAndCalcUk();
 
-    // 保有している全粒子の座標データをトラジェクトリー送信バッファに転記する
-    procData_.exportTrajectoryData();
+    timer_.start(PHASE_OUTPUT);
+    if (caseData_->trajectory_output_) {
+        // 前回の出力回に開始したトラジェクトリーの収集を完了させ、送信バッファを空ける。
+        flushTrajectoryData();
+        // 保有している全粒子の座標データをトラジェクトリー送信バッファに転記する
+        procData_.exportTrajectoryData();
+    }
 
+    // 前回の出力回に開始したエネルギーの集約を完了させてから、今回の分の集約を開始する。
+    // 集約の完了は次の出力回（または終了処理）まで待たない。
+    flushEnergyData();
     procData_.exportEnergyData();
+    communicator_.startEnergyReduction();
 
-    communicator_.calcEnergy();
-
-    if (!caseData_->isRootRank()) {
-        // 自身がルートでなかったら、そのデータをルートに送る
-        communicator_.sendTrajectroyDataToRoot();
-    } else {
-        // 自身がrootだったら、各プロセスから送られてくるデータを全て受け取る
-        communicator_.recvTrajectoryDataAtRoot();
-        // 全粒子分のデータをファイルに書く。
-        procData_.writeTrajectoryData();
-
-        procData_.writeEnergyData();
+    if (caseData_->trajectory_output_) {
+        // 全rankのデータのrootへの収集を開始する。エネルギーと同様に、完了を待つのは
+        // rootが実際にファイルに書く次の出力回（または終了処理）である。
+        communicator_.startTrajectoryGather();
     }
+    timer_.stop();
 
     // 時間発展の回が１ステップ進んだことを記録する
     caseData_->incrementStep();
 
+    // MSD/VACFを集計する回次であれば、進めた後の時刻の座標と速度をサンプルとして集計する
+    if (caseData_->isCorrelationRound()) {
+        timer_.start(PHASE_OUTPUT);
+        procData_.sampleCorrelations();
+        timer_.stop();
+    }
+
+    if (outer) {
+        // 遠距離の部分の力による、次の respa_steps_ ステップ分の前半の速度の更新。
+        // 出力とMSD/VACFの集計は、前半の分を加える前の速度で行う。
+        timer_.start(PHASE_INTEGRATE);
+        procData_.updateVelocitySlow();
+        timer_.stop();
+    }
+
     Logger::out << "MdDriver::doStep:end" << std::endl;
 }
@@ -4,38 +4,89 @@
 
 void MdDriver::doStepWithoutOutput() {
     Logger::out << "MdDriver::doStep  t = " << caseData_->t_ << std::endl;
+    // r-RESPAの遠距離の部分の力を計算する回か（ステップを進める前に判定しておく）
+    bool outer = caseData_->isRespaOuterRound();
+    // 分子の移転と周辺セルの再構築を行う回か
+    bool rebuild = caseData_->isRebuildRound();
 
-    //a(t)とv(t)からv(t+1/2Δt)を計算
-    procData_.updateVelocityHalf(); //done
-    // 位置を更新する
-    procData_.updatePosition(); //done
+    if (rebuild && caseData_->skinRequested()) {
+        // 前回の再構築の回から保持していた周辺セルの分子を捨てる
+        timer_.start(PHASE_HALO);
+        procData_.clearSurroundingCells();
+    }
 
-    // 周辺セルに移動した粒子を、プロセスの外に転出する粒子として送信バッファに転記する
-    procData_.exportExitingMoleculeFullData(); //done
-    // 転記が終わったので、全ての周辺セルを空にする
-    procData_.clearSurroundingCells();//done
-    // 周囲のプロセスとバッファ上のデータを送受信する
-    communicator_.exchangeMoleculeFullData();
-    // 受信バッファに受け取ったデータを表面セルに分配する
-    procData_.importEnteringMoleculeFullData(); //done
+    //a(t)とv(t)からv(t+1/2Δt)を計算し、続けて位置を更新する。
+    // 再構築の間の回は、セルからはみ出した粒子もそのセルに残し、表面セルの座標を送信バッファに詰める。
+    timer_.start(PHASE_INTEGRATE);
+    bool inside = procData_.updateVelocityHalfAndPosition(rebuild);
+    if (!rebuild && communicator_.anyOverRanks(!inside)) {
+        // スキンの幅の半分を超えてはみ出した分子があるので、全rankでこの回を再構築の回に切り替える
+        Logger::out << "skin exceeded: rebuild at step " << caseData_->step_count_ << std::endl;
+        procData_.abandonHaloRefresh();
+        caseData_->restartRebuildInterval();
+        rebuild = true;
+    }
 
+    if (rebuild) {
+        // 周辺セルに移動した粒子を、プロセスの外に転出する粒子として送信バッファに転記する
+        timer_.start(PHASE_MIGRATE);
+        procData_.exportExitingMoleculeFullData(); //done
+        // 転記が終わったので、全ての周辺セルを空にする
+        procData_.clearSurroundingCells();//done
+        // 周囲のプロセスとバッファ上のデータを送受信する
+        communicator_.exchangeMoleculeFullData();
+        // 受信バッファに受け取ったデータを表面セルに分配する
+        procData_.importEnteringMoleculeFullData(); //done
 
-    // HINT: some steps are skipped here. add them.
-    procData_.exportSurfacingMoleculePosData();
-    communicator_.exchangeMoleculePosData();
-    procData_.importSurroundingMoleculePosData();
 
-    // 分子間力を計算する
-    procData_.calcForce(); //done
+        // HINT: some steps are skipped here. add them.
+        timer_.start(PHASE_HALO);
+        procData_.exportSurfacingMoleculePosData();
+        communicator_.exchangeMoleculePosData();
+        procData_.importSurroundingMoleculePosData();
+    } else {
+        // 再構築の回と同じ並びで、周辺セルの分子の座標だけを更新する。
+        // 送信バッファには updateVelocityHalfAndPosition で詰めてある。
+        timer_.start(PHASE_HALO);
+        communicator_.exchangeMoleculePosData(true);
+        procData_.refreshSurroundingMoleculePosData();
+    }
+
+    // 分子間力を計算し、力の揃ったセルから順に v(t+Δt) を計算する
+    timer_.start(PHASE_FORCE);
+    calcForces(outer, true);
 
     // HINT: some steps are skipped here. add them.
-    procData_.clearSurroundingCells();//done
+    // スキンを使う場合は、周辺セルの分子を次の再構築の回まで保持する
+    if (!caseData_->skinRequested()) {
+        timer_.start(PHASE_HALO);
+        procData_.clearSurroundingCells();//done
+    }
 
-    //a(t+Δt)とv(t+1/2Δt)からv(t+Δt)を計算
-    procData_.updateVelocityHalf(); //done
+    if (outer) {
+        // 遠距離の部分の力による速度の更新（respa_steps_ ステップ分の後半）
+        timer_.start(PHASE_INTEGRATE);
+        procData_.updateVelocitySlow();
+    }
+    timer_.stop();
 
     // 時間発展の回が１ステップ進んだことを記録する
     caseData_->incrementStep(); //done
 
+    // MSD/VACFを集計する回次であれば、進めた後の時刻の座標と速度をサンプルとして集計する
+    if (caseData_->isCorrelationRound()) {
+        timer_.start(PHASE_OUTPUT);
+        procData_.sampleCorrelations();
+        timer_.stop();
+    }
+
+    if (outer) {
+        // 遠距離の部分の力による、次の respa_steps_ ステップ分の前半の速度の更新。
+        // 出力とMSD/VACFの集計は、前半の分を加える前の速度で行う。
+        timer_.start(PHASE_INTEGRATE);
+        procData_.updateVelocitySlow();
+        timer_.stop();
+    }
+
     Logger::out << "MdDriver::doStep:end" << std::endl;
 }
@@ -6,9 +6,12 @@
 
 #include <LJParams.h>
 #include <MdDriver.h>
+#include <ReplicaList.h>
 #include <Logger.h>
 
 #include <iostream>
+#include <sstream>
+#include <cstring>
 
 #include <mpi.h>
 
@@ -26,21 +29,48 @@ int main(int argc, char *argv[]) {
         MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
         MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
 
+        /*
+         * "mdlj -replicas 一覧ファイル" の場合はアンサンブル実行とし、ジョブのプロセスを
+         * レプリカごとのコミュニケータに分けて、各レプリカを独立に実行する（ReplicaList参照）。
+         * 以後、rank番号と総プロセス数は、レプリカの中でのもの。
+         */
+        MPI_Comm world = MPI_COMM_WORLD;
+        std::string case_file = argv[1];
+        std::string log_name = "mdlj";
+        if (argc >= 3 && strcmp(argv[1], "-replicas") == 0) {
+            ReplicaList replicas;
+            replicas.read(argv[2]);
+            if (replicas.totalProcs() != num_procs) {
+                std::stringstream msg;
+                msg << "num_procs = " << num_procs << " does not match the total of " << argv[2]
+                    << " = " << replicas.totalProcs();
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+            int replica = replicas.replicaForRank(my_rank);
+            MPI_Comm_split(MPI_COMM_WORLD, replica, my_rank, &world);
+            MPI_Comm_rank(world, &my_rank);
+            MPI_Comm_size(world, &num_procs);
+            case_file = replicas.caseFile(replica);
+            std::stringstream ss;
+            ss << "mdlj.replica" << replica;
+            log_name = ss.str();
+        }
+
         /* デバッグ用のログファイルを開く。rank別のファイルが作成される。*/
-        Logger::openLog("mdlj", my_rank);
+        Logger::openLog(log_name.c_str(), my_rank);
 
         /* 計算条件オブジェクトを作成する */
         /* 引数の数が間違っていたらエラー出力して終了させるべきところ。 */
         CaseData caseData;
         // 次の行では、引数は必ず指定されているものとしてコーディングしている
-        caseData.init(argv[1], my_rank, num_procs);
+        caseData.init(case_file.c_str(), my_rank, num_procs);
 
         // 計算条件ファイルの内容も加味してLJのパラメータや、一部のループ不変量を計算する。
         LJParams::initParams(&caseData);
 
         // ドライバーオブジェクトを初期化する
         MdDriver driver;
-        driver.init(&caseData);
+        driver.init(&caseData, world);
 
         // 時間発展ループ本体
         while (caseData.shouldProceed()) {
@@ -55,15 +85,21 @@ int main(int argc, char *argv[]) {
           }
         }
 
+        // フェーズ別の所要時間を集約して出力する
+        driver.reportPhaseTimes();
+
         // ドライバーに終了処理をさせる
         driver.finalize();
+        if (world != MPI_COMM_WORLD) {
+            MPI_Comm_free(&world);
+        }
 
         // MPIの停止処理
         MPI_Finalize();
 
         clock_t end = clock();     // 終了時間
-        if (my_rank == 0){
-          std::cout << "time = " << (double)(end - start) / CLOCKS_PER_SEC << "sec.\n";
+        if (caseData.isRootRank()){
+          std::cout << log_name << " time = " << (double)(end - start) / CLOCKS_PER_SEC << "sec.\n";
         }
         // ログをクローズする
         Logger::closeLog();
@@ -12,6 +12,8 @@
 #include <IoException.h>
 #include <DataException.h>
 
+#include <climits>
+
 class TestMdCommunicator : public MpiTestBase {
     CaseData caseData_;
     MdCommData commData_;
@@ -21,6 +23,10 @@ public:
     void setup();
     void testPeerRanks();
     void testExchangeMoleculeFull();
+    void testExchangeMoleculePos();
+    void testExchangeMoleculePosRma();
+    void testTrajectoryGather();
+    void checkExchangeMoleculePos(CaseData &caseData, MdCommData &commData, MdCommunicator &comm);
     void run();
 };
 
@@ -35,7 +41,8 @@ void TestMdCommunicator::testPeerRanks()
 {
     // test in a specific rank 5 = [0,1,2]
 
-    if (my_rank_ == 5) {
+    // rankはプロセス格子のコミュニケータでの番号
+    if (caseData_.my_rank_ == 5) {
         // lower in x = [-1,1,2] => wrapped to [2,1,2] = 9*2+3*1+2 = 23
         // check peer rank
         int_equals(commData_.bufferFor(GridIndex3d(0,1,1))->rank_, 23);
@@ -78,8 +85,9 @@ void TestMdCommunicator::testExchangeMoleculeFull()
         // sending cell count : 2
         // count per cell: 2
         // molecule kind : sender rank number * 2
-        // molecule serial : sender rank number*10000 + cell index in array*100 + number in array
-        buff->send_molecule_full_.clear();
+        // molecule serial : 2^40 + sender rank number*10000 + cell index in array*100 + number in array
+        // (serials are 64-bit)
+        buff->send_particles_.clear();
         buff->send_count_per_cell_.clear();
         int cell_count = 2;
         // loop for cells facing this peer
@@ -87,12 +95,14 @@ void TestMdCommunicator::testExchangeMoleculeFull()
             int molecule_count = 2;
             buff->send_count_per_cell_.push_back(molecule_count);
             for (int i = 0; i < molecule_count; i++) {
-                CommMoleculeFullData full;
-                full.kind_ = my_rank_ * 2;
-                full.serial_ = my_rank_*10000 + ci * 100 + i;
-                buff->send_molecule_full_.push_back(full);
+                Particle *p = commData_.allocateParticle();
+                p->kind_ = caseData_.my_rank_ * 2;
+                p->serial_ = (1LL << 40) + caseData_.my_rank_*10000 + ci * 100 + i;
+                p->pos_.set(1, 2, 3);
+                p->vel_dt_.set(0.1 * i, 0.2, 0.3);
+                buff->send_particles_.push_back(p);
             }
-            buff->recv_molecule_full_.clear();
+            buff->recv_particles_.clear();
             buff->recv_count_per_cell_.clear();
         }
     }
@@ -113,12 +123,138 @@ void TestMdCommunicator::testExchangeMoleculeFull()
             int molecule_count = 2; // expected
             int_equals(buff->recv_count_per_cell_[ci], molecule_count);
             for (int i = 0; i < molecule_count; i++) {
-                CommMoleculeFullData &full = buff->recv_molecule_full_[k++];
-                int_equals(full.kind_, sender_rank * 2);
-                int_equals(full.serial_, sender_rank*10000 + ci * 100 + i);
+                Particle *p = buff->recv_particles_[k++];
+                int_equals(p->kind_, sender_rank * 2);
+                test_true(p->serial_ == (1LL << 40) + sender_rank*10000 + ci * 100 + i);
+                // 受信した座標は、受信側の補正量で周期境界の補正がされている
+                xyz_equals(p->pos_, VectorXYZ(1, 2, 3) - buff->offset);
+                xyz_equals(p->vel_dt_, VectorXYZ(0.1 * i, 0.2, 0.3));
+                delete p;
+            }
+        }
+        buff->recv_particles_.clear();
+        // 送り出した粒子は解放済み
+        test_true(buff->send_particles_.empty());
+    }
+}
+
+void TestMdCommunicator::testExchangeMoleculePos()
+{
+    // 全rankが同じノードにいれば、共有メモリを介して授受される。2回続けて授受して、
+    // 区画の割り当て直しと、前回の読み出しの完了待ちも確認する。
+    checkExchangeMoleculePos(caseData_, commData_, comm_);
+}
+
+void TestMdCommunicator::testExchangeMoleculePosRma()
+{
+    // 一方向通信で授受する。最初の授受は受信用の領域（粒子数0）に収まらずメッセージで送られ、
+    // 次の授受は公開し直された領域に書き込まれる。
+    CaseData caseData;
+    MdCommData commData;
+    MdCommunicator comm;
+    caseData.init("testdata/mdcommunicator/case_rma.txt", my_rank_, num_procs_);
+    commData.init(&caseData);
+    comm.init(&caseData, &commData);
+    checkExchangeMoleculePos(caseData, commData, comm);
+    comm.finalize();
+}
+
+void TestMdCommunicator::checkExchangeMoleculePos(CaseData &caseData, MdCommData &commData, MdCommunicator &comm)
+{
+    for (int round = 0; round < 3; round++) {
+        // the last round refreshes the positions of the previous round without exchanging counts
+        bool refresh = (round == 2);
+        int extra = refresh ? 1 : round;
+        //
+        // set dummy molecule pos data for all directions
+        //
+        GridPeerIterator3d it;
+        while (it.next()) {
+            MdCommPeerBuffer *buff = commData.bufferFor(it);
+            // dummy data spec:
+            // sending cell count : 2
+            // count per cell: 1 + extra, 2 + extra
+            // kind : sender rank, q = (direction sent to, cell index + 10 * round, number in cell)
+            int dir = it.ix_ * 9 + it.iy_ * 3 + it.iz_;
+            buff->clearSendMoleculePosBuffer();
+            for (int ci = 0; ci < 2; ci++) {
+                int molecule_count = ci + 1 + extra;
+                buff->send_count_per_cell_.push_back(molecule_count);
+                for (int i = 0; i < molecule_count; i++) {
+                    CommMoleculePosData pos;
+                    pos.kind_ = (unsigned char)caseData.my_rank_;
+                    pos.qx_ = dir;
+                    pos.qy_ = ci + 10 * round;
+                    pos.qz_ = i;
+                    buff->send_molecule_pos_.push_back(pos);
+                }
+            }
+        }
+
+        // exchange data
+        comm.exchangeMoleculePosData(refresh);
+
+        // data from the peer in direction d was sent by it in direction 26 - d
+        it.reset();
+        while (it.next()) {
+            MdCommPeerBuffer *buff = commData.bufferFor(it);
+            int dir = it.ix_ * 9 + it.iy_ * 3 + it.iz_;
+            int_equals(buff->recv_count_per_cell_.size(), 2);
+            size_equals(buff->recv_molecule_pos_.size(), (size_t)(3 + 2 * extra));
+            int k = 0;
+            for (int ci = 0; ci < 2; ci++) {
+                if (!refresh) {
+                    int_equals(buff->recv_count_per_cell_[ci], ci + 1 + extra);
+                }
+                for (int i = 0; i < ci + 1 + extra; i++) {
+                    CommMoleculePosData &pos = buff->recv_molecule_pos_[k++];
+                    int_equals(pos.kind_, buff->rank_);
+                    int_equals(pos.qx_, 26 - dir);
+                    int_equals(pos.qy_, ci + 10 * round);
+                    int_equals(pos.qz_, i);
+                }
+            }
+            buff->recv_molecule_pos_.clear();
+            buff->recv_count_per_cell_.clear();
+        }
+    }
+}
+
+void TestMdCommunicator::testTrajectoryGather()
+{
+    int np = caseData_.num_procs_;
+    if (caseData_.isRootRank()) {
+        commData_.setAllMoleculeCount(2 * np);
+    }
+    // MPI_Igatherv による収集と、分子数がintを超える場合の一対一の収集とで、同じ結果になる
+    for (int pass = 0; pass < 2; pass++) {
+        comm_.initTrajectoryGather((pass == 0) ? 2 * np : (long long)INT_MAX + 1);
+        test_true(comm_.traj_point_to_point_ == (pass == 1));
+        // rankの逆順の通し番号を、1rankあたり2分子
+        Cell cell;
+        cell.setBox(BoxXYZ(0, 0, 0, 100, 1, 1));
+        for (int i = 0; i < 2; i++) {
+            Particle *p = new Particle;
+            p->kind_ = pass;
+            p->serial_ = 2 * (np - 1 - caseData_.my_rank_) + i;
+            p->pos_.set(p->serial_ + 0.5, 0, 0);
+            p->vel_dt_.set(0, 0, 0);
+            cell.addParticle(p);
+        }
+        commData_.addTrajectoryDataFrom(&cell);
+        comm_.startTrajectoryGather();
+        test_true(comm_.finishTrajectoryGather());
+        test_true(commData_.send_molecule_traj_.empty());
+        if (caseData_.isRootRank()) {
+            for (int s = 0; s < 2 * np; s++) {
+                const CommMoleculeTrajData &d = commData_.all_molecule_traj_[s];
+                int_equals(d.kind_, pass);
+                test_true(d.serial_ == s);
+                dbl_equals(d.rx_, s + 0.5);
             }
         }
     }
+    comm_.initTrajectoryGather(0);
 }
 
 //
@@ -128,6 +264,10 @@ void TestMdCommunicator::run()
     setup();
     testPeerRanks();
     testExchangeMoleculeFull();
+    testExchangeMoleculePos();
+    testExchangeMoleculePosRma();
+    testTrajectoryGather();
+    comm_.finalize();
 }
 
 /*
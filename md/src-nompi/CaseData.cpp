@@ -7,6 +7,8 @@
 
 #include <Logger.h>
 
+#include <cmath>
+
 void CaseData::init(const char *file_name, int my_rank, int num_procs) {
     assert(my_rank >= 0);
     assert(my_rank < num_procs);
@@ -38,19 +40,16 @@ void CaseData::init(const char *file_name, int my_rank, int num_procs) {
      */
     allProcessesRange_.setRange(0,0,0, npx_-1, npy_-1, npz_-1);
     /*
-     * 自身のプロセス座標を計算しておく。
+     * 自身のプロセス座標と、プロセスセルの物理座標の範囲を計算しておく。
      */
-    setProcessIteratorForRank(&localProcess_, my_rank);
-    /*
-     * 自身のプロセス座標に基づいて、自身のプロセスセルの物理座標の範囲を計算しておく。
-     */
-    setBoxForProcess(&localBox_, localProcess_);
+    setMyRank(my_rank);
 
     /*
      * 時間発展ループの回次と時刻を初期化しておく。
      */
     t_ = 0;
     step_count_ = 0;
+    rebuild_step_ = 0;
 }
 
 void CaseData::readCaseFile(const char *file_name) {
@@ -101,6 +100,10 @@ void CaseData::readCaseFile(const char *file_name) {
     rdr.readLabeledDoubleLine("duration", duration_);
     rdr.readLabeledIntLine("output_interval", output_interval_);
     rdr.readLabeledDoubleLine("cutoff_radius", cutoff_radius_);
+    /*
+     * ここから先は省略可能な項目
+     */
+    readOptionalParams(rdr, file_name);
     /*
      * ファイルをクローズする
      */
@@ -118,6 +121,45 @@ void CaseData::readCaseFile(const char *file_name) {
     clx_ = plx_ / ncx_;
     cly_ = ply_ / ncy_;
     clz_ = plz_ / ncz_;
+
+    /*
+     * 周辺セルの分子を再構築の間保持する場合、その間に近づいてくる分子も
+     * 周辺セルの範囲で拾えるように、セルはカットオフ半径よりスキンの幅だけ大きくなければならない。
+     */
+    if (skinRequested()) {
+        double reach = cutoff_radius_ + skin_width_;
+        if (clx_ < reach || cly_ < reach || clz_ < reach) {
+            std::stringstream msg;
+            msg << "cell size (" << clx_ << ", " << cly_ << ", " << clz_
+                << ") should be at least cutoff_radius + skin_width = " << reach << " in " << file_name;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+    }
+}
+
+void CaseData::checkMemoryLimit(double bytes) const {
+    if (memory_limit_mb_ <= 0) {
+        return;
+    }
+    double mb = bytes / (1024.0 * 1024.0);
+    if (mb > memory_limit_mb_) {
+        std::stringstream msg;
+        msg << "estimated memory " << mb << " MB exceeds memory_limit_mb = " << memory_limit_mb_;
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+}
+
+void CaseData::setMyRank(int rank) {
+    assert(rank >= 0 && rank < num_procs_);
+    my_rank_ = rank;
+    /*
+     * 自身のプロセス座標を計算しておく。
+     */
+    setProcessIteratorForRank(&localProcess_, my_rank_);
+    /*
+     * 自身のプロセス座標に基づいて、自身のプロセスセルの物理座標の範囲を計算しておく。
+     */
+    setBoxForProcess(&localBox_, localProcess_);
 }
 
 void CaseData::setProcessIteratorForRank(GridIndex3d *procIdx, int rank) const {
@@ -151,6 +193,60 @@ int CaseData::getRankForProcess(const GridIndex3d &procIdx) const {
     return rank;
 }
 
+bool CaseData::findNodeBlock(int node_size, GridIndex3d *block) const {
+    assert(block != NULL);
+    bool found = false;
+    int best_surface = 0;
+    // プロセス格子を割り切る形だけを考える。表面積が小さいほど、ノード外との通信が少ない。
+    for (int bx = 1; bx <= npx_; bx++) {
+        if (npx_ % bx != 0 || node_size % bx != 0) {
+            continue;
+        }
+        for (int by = 1; by <= npy_; by++) {
+            if (npy_ % by != 0 || (node_size / bx) % by != 0) {
+                continue;
+            }
+            int bz = node_size / (bx * by);
+            if (bz > npz_ || npz_ % bz != 0) {
+                continue;
+            }
+            int surface = bx * by + by * bz + bz * bx;
+            if (!found || surface < best_surface) {
+                found = true;
+                best_surface = surface;
+                block->ix_ = bx;
+                block->iy_ = by;
+                block->iz_ = bz;
+            }
+        }
+    }
+    return found;
+}
+
+bool CaseData::setProcessIteratorForNodeRank(GridIndex3d *procIdx, int node, int local, int node_size) const {
+    assert(procIdx != NULL);
+    GridIndex3d block;
+    if (node_size <= 0 || num_procs_ % node_size != 0 || !findNodeBlock(node_size, &block)) {
+        return false;
+    }
+    assert(node >= 0 && node < num_procs_ / node_size);
+    assert(local >= 0 && local < node_size);
+    // ブロックの並びの中での、node番目のブロックの位置
+    int nby = npy_ / block.iy_;
+    int nbz = npz_ / block.iz_;
+    int jx = node / (nby * nbz);
+    int jy = (node / nbz) % nby;
+    int jz = node % nbz;
+    // ブロック内での、local番目のプロセスの位置
+    int kx = local / (block.iy_ * block.iz_);
+    int ky = (local / block.iz_) % block.iy_;
+    int kz = local % block.iz_;
+    procIdx->ix_ = jx * block.ix_ + kx;
+    procIdx->iy_ = jy * block.iy_ + ky;
+    procIdx->iz_ = jz * block.iz_ + kz;
+    return true;
+}
+
 void CaseData::setBoxForProcess(BoxXYZ *box, const GridIndex3d &procIdx) const {
     assert(box != NULL);
     int ipx, ipy, ipz;
@@ -182,3 +278,311 @@ void CaseData::setBoxForCell(BoxXYZ *box, const GridIndex3d &cellIdx) const {
     zh = zl + clz_;
     box->set(xl,yl,zl,xh,yh,zh);
 }
+
+void CaseData::readOptionalParams(FileReader &rdr, const char *file_name) {
+    /*
+     * 省略された場合の値を設定しておく
+     */
+    trajectory_output_ = true;
+    trajectory_positions_ = true;
+    trajectory_velocities_ = true;
+    trajectory_float_ = false;
+    trajectory_serial_min_ = 0;
+    trajectory_serial_max_ = -1;
+    trajectory_species_.clear();
+    rdf_file_path_.clear();
+    rdf_bins_ = 200;
+    msd_file_path_.clear();
+    msd_levels_ = 8;
+    msd_points_ = 16;
+    msd_interval_ = 1;
+    node_placement_ = false;
+    shared_memory_halo_ = true;
+    rma_halo_ = false;
+    respa_inner_radius_ = 0;
+    respa_switch_width_ = 1;
+    respa_steps_ = 1;
+    skin_width_ = 0;
+    rebuild_interval_ = 1;
+    memory_limit_mb_ = 0;
+    initial_lattice_.clear();
+    lattice_constant_ = 0;
+    initial_species_.assign(1, "He");
+    initial_fractions_.assign(1, 1.0);
+    initial_temperature_ = 0;
+    initial_seed_ = 0;
+
+    /*
+     * 省略可能な項目は順不同で、行頭のキーワードで判別する。
+     * 知らないキーワードは、綴りの誤りを見逃さないようにエラーとする。
+     */
+    while (rdr.readLine()) {
+        std::string key;
+        if (!rdr.readWord(key)) {
+            continue; // 空行
+        }
+        if (key == "trajectory_output") {
+            std::string val;
+            rdr.readString(val, "trajectory_output");
+            if (val == "on") {
+                trajectory_output_ = true;
+            } else if (val == "off") {
+                trajectory_output_ = false;
+            } else {
+                std::stringstream msg;
+                msg << "trajectory_output should be on or off, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "trajectory_fields") {
+            std::string val;
+            rdr.readString(val, "trajectory_fields");
+            if (val == "pos" || val == "vel" || val == "both") {
+                trajectory_positions_ = (val != "vel");
+                trajectory_velocities_ = (val != "pos");
+            } else {
+                std::stringstream msg;
+                msg << "trajectory_fields should be pos, vel or both, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "trajectory_precision") {
+            std::string val;
+            rdr.readString(val, "trajectory_precision");
+            if (val == "float") {
+                trajectory_float_ = true;
+            } else if (val == "double") {
+                trajectory_float_ = false;
+            } else {
+                std::stringstream msg;
+                msg << "trajectory_precision should be float or double, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "trajectory_serials") {
+            rdr.readLongLong(trajectory_serial_min_, "trajectory_serials first");
+            rdr.readLongLong(trajectory_serial_max_, "trajectory_serials last");
+            if (trajectory_serial_min_ < 0 || trajectory_serial_max_ < trajectory_serial_min_) {
+                std::stringstream msg;
+                msg << "trajectory_serials " << trajectory_serial_min_ << " " << trajectory_serial_max_
+                    << " should be 0 <= first <= last in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "trajectory_species") {
+            // 分子の名前の検査は、LJParamsを参照する MdCommData::init で行う
+            std::string name;
+            while (rdr.readWord(name)) {
+                trajectory_species_.push_back(name);
+            }
+            if (trajectory_species_.empty()) {
+                std::stringstream msg;
+                msg << "trajectory_species needs at least one molecule name in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "rdf_file") {
+            rdr.readString(rdf_file_path_, "rdf_file");
+        } else if (key == "rdf_bins") {
+            rdr.readInt(rdf_bins_, "rdf_bins");
+            if (rdf_bins_ <= 0) {
+                std::stringstream msg;
+                msg << "rdf_bins = " << rdf_bins_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "msd_file") {
+            rdr.readString(msd_file_path_, "msd_file");
+        } else if (key == "msd_levels") {
+            rdr.readInt(msd_levels_, "msd_levels");
+            if (msd_levels_ <= 0 || msd_levels_ > 30) {
+                std::stringstream msg;
+                msg << "msd_levels = " << msd_levels_ << " should be in 1..30 in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "msd_points") {
+            rdr.readInt(msd_points_, "msd_points");
+            if (msd_points_ < 2 || msd_points_ % 2 != 0) {
+                std::stringstream msg;
+                msg << "msd_points = " << msd_points_ << " should be an even number >= 2 in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "msd_interval") {
+            rdr.readInt(msd_interval_, "msd_interval");
+            if (msd_interval_ <= 0) {
+                std::stringstream msg;
+                msg << "msd_interval = " << msd_interval_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "shared_memory_halo") {
+            std::string val;
+            rdr.readString(val, "shared_memory_halo");
+            if (val == "on") {
+                shared_memory_halo_ = true;
+            } else if (val == "off") {
+                shared_memory_halo_ = false;
+            } else {
+                std::stringstream msg;
+                msg << "shared_memory_halo should be on or off, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "rma_halo") {
+            std::string val;
+            rdr.readString(val, "rma_halo");
+            if (val == "on") {
+                rma_halo_ = true;
+            } else if (val == "off") {
+                rma_halo_ = false;
+            } else {
+                std::stringstream msg;
+                msg << "rma_halo should be on or off, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "respa_inner_radius") {
+            rdr.readDouble(respa_inner_radius_, "respa_inner_radius");
+            if (respa_inner_radius_ <= 0 || respa_inner_radius_ >= cutoff_radius_) {
+                std::stringstream msg;
+                msg << "respa_inner_radius = " << respa_inner_radius_
+                    << " should be positive and less than cutoff_radius in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "respa_switch_width") {
+            rdr.readDouble(respa_switch_width_, "respa_switch_width");
+            if (respa_switch_width_ <= 0) {
+                std::stringstream msg;
+                msg << "respa_switch_width = " << respa_switch_width_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "respa_steps") {
+            rdr.readInt(respa_steps_, "respa_steps");
+            if (respa_steps_ <= 0) {
+                std::stringstream msg;
+                msg << "respa_steps = " << respa_steps_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "skin_width") {
+            rdr.readDouble(skin_width_, "skin_width");
+            if (skin_width_ <= 0) {
+                std::stringstream msg;
+                msg << "skin_width = " << skin_width_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "rebuild_interval") {
+            rdr.readInt(rebuild_interval_, "rebuild_interval");
+            if (rebuild_interval_ <= 0) {
+                std::stringstream msg;
+                msg << "rebuild_interval = " << rebuild_interval_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "memory_limit_mb") {
+            rdr.readDouble(memory_limit_mb_, "memory_limit_mb");
+            if (memory_limit_mb_ <= 0) {
+                std::stringstream msg;
+                msg << "memory_limit_mb = " << memory_limit_mb_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "initial_lattice") {
+            rdr.readString(initial_lattice_, "initial_lattice");
+            rdr.readDouble(lattice_constant_, "initial_lattice constant");
+            if (initial_lattice_ != "sc" && initial_lattice_ != "bcc" && initial_lattice_ != "fcc") {
+                std::stringstream msg;
+                msg << "initial_lattice should be sc, bcc or fcc, but \"" << initial_lattice_ << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+            if (lattice_constant_ <= 0) {
+                std::stringstream msg;
+                msg << "lattice constant = " << lattice_constant_ << " should be positive in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "initial_species") {
+            // 分子の名前の検査は、LJParamsを参照する MdProcData で行う
+            initial_species_.clear();
+            initial_fractions_.clear();
+            std::string name;
+            while (rdr.readWord(name)) {
+                double fraction;
+                rdr.readDouble(fraction, "initial_species fraction");
+                if (fraction < 0) {
+                    std::stringstream msg;
+                    msg << "fraction of " << name << " = " << fraction << " should not be negative in " << file_name;
+                    throw DataException(__FILE__, __LINE__, msg.str());
+                }
+                initial_species_.push_back(name);
+                initial_fractions_.push_back(fraction);
+            }
+            double total = 0;
+            for (size_t i = 0; i < initial_fractions_.size(); i++) {
+                total += initial_fractions_[i];
+            }
+            if (total <= 0) {
+                std::stringstream msg;
+                msg << "initial_species needs a molecule name with a positive fraction in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else if (key == "initial_temperature") {
+            long long seed;
+            rdr.readDouble(initial_temperature_, "initial_temperature");
+            rdr.readLongLong(seed, "initial_temperature seed");
+            if (initial_temperature_ < 0 || seed < 0) {
+                std::stringstream msg;
+                msg << "initial_temperature " << initial_temperature_ << " " << seed
+                    << " should not be negative in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+            initial_seed_ = (unsigned long long)seed;
+        } else if (key == "rank_placement") {
+            std::string val;
+            rdr.readString(val, "rank_placement");
+            if (val == "cart") {
+                node_placement_ = false;
+            } else if (val == "node") {
+                node_placement_ = true;
+            } else {
+                std::stringstream msg;
+                msg << "rank_placement should be cart or node, but \"" << val << "\" was found in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        } else {
+            std::stringstream msg;
+            msg << "unknown keyword \"" << key << "\" in " << file_name;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+    }
+
+    if (!skinRequested() && rebuild_interval_ != 1) {
+        std::stringstream msg;
+        msg << "rebuild_interval requires skin_width in " << file_name;
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+    if (latticeRequested()) {
+        // 格子点を箱全体に周期的に並べるので、箱は単位格子の整数倍でなければならない
+        const double l[3] = { lx_, ly_, lz_ };
+        for (int a = 0; a < 3; a++) {
+            double n = floor(l[a] / lattice_constant_ + 0.5);
+            if (n < 1 || fabs(n * lattice_constant_ - l[a]) > 1.0e-6 * l[a]) {
+                std::stringstream msg;
+                msg << "box_size (" << lx_ << ", " << ly_ << ", " << lz_ << ") should be a multiple of the lattice constant "
+                    << lattice_constant_ << " in " << file_name;
+                throw DataException(__FILE__, __LINE__, msg.str());
+            }
+        }
+    }
+    if (!respaRequested() && respa_steps_ != 1) {
+        std::stringstream msg;
+        msg << "respa_steps requires respa_inner_radius in " << file_name;
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+    /*
+     * r-RESPAでは、全ての力が揃いエネルギーが定まるのは遠距離の部分を計算する回だけなので、
+     * 結果出力はその回に合わせる。遠距離の部分の力は respa_steps_ ステップごとの衝撃として
+     * 速度に加わるので、途中の回のMSD/VACFのサンプルの速度は、その分を含んだものになる。
+     */
+    if (respaRequested()) {
+        if (respa_switch_width_ >= respa_inner_radius_) {
+            std::stringstream msg;
+            msg << "respa_switch_width = " << respa_switch_width_
+                << " should be less than respa_inner_radius in " << file_name;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+        if (output_interval_ % respa_steps_ != 0) {
+            std::stringstream msg;
+            msg << "output_interval should be a multiple of respa_steps = "
+                << respa_steps_ << " in " << file_name;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+    }
+}
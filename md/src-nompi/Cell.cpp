@@ -16,10 +16,29 @@ void Cell::clearForces() {
     }
 }
 
+void Cell::clearSlowForces() {
+    for (Particle *pi = list_.head(); pi ; pi = pi->next_) {
+        pi->a_slow_dt2_half_.clear();
+    }
+}
+
 void Cell::clearUp() {
     up_ = 0;
 }
 
+void Cell::removeParticle(Particle *p) {
+    int k = p->kind_;
+    // 種類ごとの区間の両端であれば、区間を縮める
+    if (kindHead_[k] == p && kindTail_[k] == p) {
+        kindHead_[k] = kindTail_[k] = NULL;
+    } else if (kindHead_[k] == p) {
+        kindHead_[k] = p->next_;
+    } else if (kindTail_[k] == p) {
+        kindTail_[k] = p->prev_;
+    }
+    list_.remove(p);
+}
+
 VectorXYZ Cell::calcLJforce(VectorXYZ const *dist, double r_2, LJScaledMoleculePairParam const *pair){
   double r_8 = r_2 * r_2 * r_2 * r_2;
   VectorXYZ f = *dist * ((pair->a_*r_2)/(r_8*r_8) + pair->b_/r_8);
@@ -29,72 +48,38 @@ VectorXYZ Cell::calcLJforce(VectorXYZ const *dist, double r_2, LJScaledMoleculeP
   return f;
 }
 
-void Cell::calcForceWithinSelf() {
-    for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-        LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-        for (Particle *pj = pi->next_; pj!=NULL; pj = pj->next_) {
-            VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
-            double r2 = dispij.square();
-            if (r2 < LJParams::CUTOFF_SQ_) {
-                // The two molecules are near enough.
-                // Calculate force between pi and pj.
-                // HINT : positions are stored as pi->pos_ and pj->pos_
-                // molecule kinds are stored as pi->kind_ and pj->kind_
-                // the coefficients to use to calculate force
-                // is determined by the pair pi->kind_ and pj->kind_
-                LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj->kind_];
-                // use parami and paramj
-                LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj->kind_];
-                //powは使わない、14乗変数を作って再利用
-                //同じものは再利用、符号をマイナス、ポテンシャル計算を関数化
-
-                VectorXYZ force = calcLJforce(&dispij, r2, pair_ij);
-                pi->a_dt2_half_ += force*parami->dt2_by_2m_;
-                pj->a_dt2_half_ += force*(-1)*paramj->dt2_by_2m_;
-            }
+/*
+ * 区間の組ごとの力の計算。
+ * 粒子の種類ごとのパラメタ（pair, ci, cj）は呼び出し側で区間の組ごとに一度だけ取り出しておき、
+ * 最内ループでは種類による表引きをしない。
+ * Range で、力を加える組の距離の範囲と、力の重み、加える先の変数を切り替える（LJFullRange参照）。
+ */
+template <class Range>
+void Cell::calcPairBlock(Particle *pi, Particle *begin, Particle *end,
+        const LJScaledMoleculePairParam &pair, double ci, double cj) {
+    for (Particle *pj = begin; pj != end; pj = pj->next_) {
+        VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
+        double r2 = dispij.square();
+        if (Range::contains(r2)) {  // The two molecules are near enough.
+            VectorXYZ force = calcLJforce(&dispij, r2, &pair) * Range::weight(r2);
+            Range::acc(pi) += force*ci;
+            Range::acc(pj) += force*(-1)*cj;
         }
     }
 }
 
-void Cell::calcForceWithLocalCell(Cell *otherCell) {
-  for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-      LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-      for (Particle *pj_local = otherCell->getParticleListHead(); pj_local != NULL; pj_local = pj_local->next_) {
-          VectorXYZ dispij = pj_local->pos_ - pi->pos_; // displacement
-          double r2 = dispij.square();
-          if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
-              LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj_local->kind_];
-              // use parami and paramj
-              LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj_local->kind_];
-
-              VectorXYZ force = calcLJforce(&dispij, r2, pair_ij);
-              pi->a_dt2_half_ += force*parami->dt2_by_2m_;
-              pj_local->a_dt2_half_ += force*(-1)*paramj->dt2_by_2m_;
-            }
-          }
-        }
-}
-
-void Cell::calcForceWithSurroundingCell(Cell *otherCell) {
-  for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-      LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-      for (Particle *pj_surround = otherCell->getParticleListHead(); pj_surround != NULL; pj_surround = pj_surround->next_) {
-          VectorXYZ dispij = pj_surround->pos_ - pi->pos_; // displacement
-          double r2 = dispij.square();
-          if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
-              LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj_surround->kind_];
-              // use parami and paramj
-              LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj_surround->kind_];
-
-
-              pi->a_dt2_half_ += calcLJforce(&dispij, r2, pair_ij) * parami->dt2_by_2m_;
-            }
-          }
+template <class Range>
+void Cell::calcPairBlockOneSide(Particle *pi, Particle *begin, Particle *end,
+        const LJScaledMoleculePairParam &pair, double ci) {
+    for (Particle *pj = begin; pj != end; pj = pj->next_) {
+        VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
+        double r2 = dispij.square();
+        if (Range::contains(r2)) {  // The two molecules are near enough.
+            Range::acc(pi) += calcLJforce(&dispij, r2, &pair) * Range::weight(r2) * ci;
         }
+    }
 }
 
-
-
 void Cell::updatePosition() {
     for (Particle *pi = list_.head(); pi ; pi = pi->next_) {
         pi->pos_ += pi->vel_dt_;
@@ -123,6 +108,26 @@ void Cell::updateVelocityHalf() {
     }
 }
 
+bool Cell::updateVelocityHalfAndPosition(double margin) {
+    VectorXYZ lo(cellBox_.p1_.x_ - margin, cellBox_.p1_.y_ - margin, cellBox_.p1_.z_ - margin);
+    VectorXYZ hi(cellBox_.p2_.x_ + margin, cellBox_.p2_.y_ + margin, cellBox_.p2_.z_ + margin);
+    bool inside = true;
+    for (Particle *pi = list_.head(); pi ; pi = pi->next_) {
+        pi->vel_dt_ += pi->a_dt2_half_;
+        pi->pos_ += pi->vel_dt_;
+        inside = inside && pi->pos_.x_ >= lo.x_ && pi->pos_.x_ < hi.x_
+                        && pi->pos_.y_ >= lo.y_ && pi->pos_.y_ < hi.y_
+                        && pi->pos_.z_ >= lo.z_ && pi->pos_.z_ < hi.z_;
+    }
+    return inside;
+}
+
+void Cell::updateVelocitySlow(double steps) {
+    for (Particle *pi = list_.head(); pi ; pi = pi->next_) {
+        pi->vel_dt_ += pi->a_slow_dt2_half_ * steps;
+    }
+}
+
 void Cell::migrateToNeighbor() {
     Particle *pi, *nexti;
     pi = list_.head();
@@ -141,7 +146,7 @@ void Cell::migrateToNeighbor() {
             // record the next item in the list, before we remove pi.
             nexti = pi->next_;
             // remove pi from our list
-            list_.remove(pi);
+            removeParticle(pi);
             // hand it to the destination cell.
             destCell->addParticle(pi);
             // now move on to the particle that followed pi.
@@ -151,98 +156,228 @@ void Cell::migrateToNeighbor() {
 }
 
 //Force and Potential are calculated in the method below.
+// Upとrdfは力の重みによらず、カットオフ距離までの全ての組について集計する。
+
+template <class Range>
+void Cell::calcPairBlockAndUp(Particle *pi, Particle *begin, Particle *end,
+        const LJScaledMoleculePairParam &pair, double ci, double cj,
+        double &up, RdfAccumulator *rdf) {
+    for (Particle *pj = begin; pj != end; pj = pj->next_) {
+        VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
+        double r2 = dispij.square();
+        if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
+            //LJポテンシャル計算
+            VectorXYZ force = calcLJforce(&dispij, r2, &pair) * Range::weight(r2);
+            Range::acc(pi) += force*ci;
+            Range::acc(pj) += force*(-1)*cj;
+
+            //up_計算
+            double r6 = r2*r2*r2;
+            up += -pair.a_ / (r6*r6*12) - pair.b_ / (r6*6);
 
-void Cell::calcForceWithinSelfAndUp() {
-    for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-        LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-        for (Particle *pj = pi->next_; pj; pj = pj->next_) {
-            VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
-            double r2 = dispij.square();
-            if (r2 < LJParams::CUTOFF_SQ_) {
-                // The two molecules are near enough.
-                // Calculate force between pi and pj.
-                // HINT : positions are stored as pi->pos_ and pj->pos_
-                // molecule kinds are stored as pi->kind_ and pj->kind_
-                // the coefficients to use to calculate force
-                // is determined by the pair pi->kind_ and pj->kind_
-                LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj->kind_];
-                // use parami and paramj
-                LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj->kind_];
-
-
-                VectorXYZ force = calcLJforce(&dispij, r2, pair_ij);
-                pi->a_dt2_half_ += force*parami->dt2_by_2m_;
-                pj->a_dt2_half_ += force*(-1)*paramj->dt2_by_2m_;
-
-                double r6 = r2*r2*r2;
-                up_ += -pair_ij->a_ / (r6*r6*12) - pair_ij->b_ / (r6*6);
+            if (rdf) {
+                rdf->addPair(pi->kind_, pj->kind_, r2, 2);
             }
         }
     }
 }
 
-void Cell::calcForceWithLocalCellAndUp(Cell *otherCell) {
-  for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-      LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-      for (Particle *pj_local = otherCell->getParticleListHead(); pj_local != NULL; pj_local = pj_local->next_) {
-          VectorXYZ dispij = pj_local->pos_ - pi->pos_; // displacement
-          double r2 = dispij.square();
-          if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
-              LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj_local->kind_];
-              // use parami and paramj
-              LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj_local->kind_];
+template <class Range>
+void Cell::calcPairBlockOneSideAndUp(Particle *pi, Particle *begin, Particle *end,
+        const LJScaledMoleculePairParam &pair, double ci,
+        double &up, RdfAccumulator *rdf) {
+    for (Particle *pj = begin; pj != end; pj = pj->next_) {
+        VectorXYZ dispij = pj->pos_ - pi->pos_; // displacement
+        double r2 = dispij.square();
+        if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
+            //LJポテンシャル計算
+            Range::acc(pi) += calcLJforce(&dispij, r2, &pair) * Range::weight(r2) * ci;
+            //up計算
+            double r6 = r2*r2*r2;
+            up += (-pair.a_ / (r6*r6*12) - pair.b_ / (r6*6))/2.0;
 
-              //LJポテンシャル計算
-
-              VectorXYZ force = calcLJforce(&dispij, r2, pair_ij);
-              pi->a_dt2_half_ += force*parami->dt2_by_2m_;
-              pj_local->a_dt2_half_ += force*(-1)*paramj->dt2_by_2m_;
-
-              //up_計算
-              double r6 = r2*r2*r2;
-              up_ += -pair_ij->a_ / (r6*r6*12) - pair_ij->b_ / (r6*6);
+            // 相手のプロセスでも同じ組を一回数えるので、重みは1
+            if (rdf) {
+                rdf->addPair(pi->kind_, pj->kind_, r2, 1);
             }
-          }
         }
+    }
 }
 
-void Cell::calcForceWithSurroundingCellAndUp(Cell *otherCell) {
-  for (Particle *pi = list_.head(); pi != NULL; pi = pi->next_) {
-      LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
-      for (Particle *pj_surround = otherCell->getParticleListHead(); pj_surround != NULL; pj_surround = pj_surround->next_) {
-          VectorXYZ dispij = pj_surround->pos_ - pi->pos_; // displacement
-          double r2 = dispij.square();
-          if (r2 < LJParams::CUTOFF_SQ_) {  // The two molecules are near enough.
-              LJScaledMoleculeParam *paramj = &LJParams::MOLECULE_PARAMS_[pj_surround->kind_];
-              // use parami and paramj
-              LJScaledMoleculePairParam *pair_ij = &LJParams::PAIR_PARAMS_[pi->kind_][pj_surround->kind_];
+/*
+ * 力の計算の本体。区間を順にたどり、区間の組ごとにパラメタを取り出してcalcPairBlock...を呼ぶ。
+ * Kinds::SINGLE の場合はセル全体が一つの区間なので、区間の終端はリストの終端(NULL)となり、
+ * パラメタはKindsの持つ定数となる。UPがtrueであれば、Upとrdfの集計も行う。
+ * Rangeは力を計算する距離の範囲（LJFullRange, LJInnerRange, LJOuterRange）。
+ */
+template <bool UP, class Range, class Kinds>
+void Cell::calcForceWithinSelfFor(const Kinds &kinds, RdfAccumulator *rdf) {
+    // 自セルの区間を順にたどる。区間の中の組と、後続の区間との組を数える。
+    // 粒子の組を訪れる順序は、リストを先頭から二重ループでたどる場合と同じである。
+    for (Particle *si = list_.head(); si != NULL; si = Kinds::SINGLE ? NULL : kindRangeEnd(si)) {
+        Particle *ei = Kinds::SINGLE ? NULL : kindRangeEnd(si);
+        int ki = si->kind_;
+        double ci = kinds.dt2By2m(ki);
+        for (Particle *pi = si; pi != ei; pi = pi->next_) {
+            if (UP) {
+                calcPairBlockAndUp<Range>(pi, pi->next_, ei, kinds.pair(ki, ki), ci, ci, up_, rdf);
+            } else {
+                calcPairBlock<Range>(pi, pi->next_, ei, kinds.pair(ki, ki), ci, ci);
+            }
+            for (Particle *sj = ei; sj != NULL; sj = kindRangeEnd(sj)) {
+                int kj = sj->kind_;
+                if (UP) {
+                    calcPairBlockAndUp<Range>(pi, sj, kindRangeEnd(sj), kinds.pair(ki, kj),
+                            ci, kinds.dt2By2m(kj), up_, rdf);
+                } else {
+                    calcPairBlock<Range>(pi, sj, kindRangeEnd(sj), kinds.pair(ki, kj),
+                            ci, kinds.dt2By2m(kj));
+                }
+            }
+        }
+    }
+}
 
-              //LJポテンシャル計算
+template <bool UP, class Range, class Kinds>
+void Cell::calcForceWithLocalCellFor(Cell *otherCell, const Kinds &kinds, RdfAccumulator *rdf) {
+    for (Particle *si = list_.head(); si != NULL; si = Kinds::SINGLE ? NULL : kindRangeEnd(si)) {
+        Particle *ei = Kinds::SINGLE ? NULL : kindRangeEnd(si);
+        int ki = si->kind_;
+        double ci = kinds.dt2By2m(ki);
+        for (Particle *pi = si; pi != ei; pi = pi->next_) {
+            for (Particle *sj = otherCell->getParticleListHead(); sj != NULL;
+                    sj = Kinds::SINGLE ? NULL : otherCell->kindRangeEnd(sj)) {
+                Particle *ej = Kinds::SINGLE ? NULL : otherCell->kindRangeEnd(sj);
+                int kj = sj->kind_;
+                if (UP) {
+                    calcPairBlockAndUp<Range>(pi, sj, ej, kinds.pair(ki, kj), ci, kinds.dt2By2m(kj), up_, rdf);
+                } else {
+                    calcPairBlock<Range>(pi, sj, ej, kinds.pair(ki, kj), ci, kinds.dt2By2m(kj));
+                }
+            }
+        }
+    }
+}
 
-              pi->a_dt2_half_ += calcLJforce(&dispij, r2, pair_ij) * parami->dt2_by_2m_;
-              //up計算
-              double r6 = r2*r2*r2;
-              up_ += (-pair_ij->a_ / (r6*r6*12) - pair_ij->b_ / (r6*6))/2.0;
+template <bool UP, class Range, class Kinds>
+void Cell::calcForceWithSurroundingCellFor(Cell *otherCell, const Kinds &kinds, RdfAccumulator *rdf) {
+    for (Particle *si = list_.head(); si != NULL; si = Kinds::SINGLE ? NULL : kindRangeEnd(si)) {
+        Particle *ei = Kinds::SINGLE ? NULL : kindRangeEnd(si);
+        int ki = si->kind_;
+        double ci = kinds.dt2By2m(ki);
+        for (Particle *pi = si; pi != ei; pi = pi->next_) {
+            for (Particle *sj = otherCell->getParticleListHead(); sj != NULL;
+                    sj = Kinds::SINGLE ? NULL : otherCell->kindRangeEnd(sj)) {
+                Particle *ej = Kinds::SINGLE ? NULL : otherCell->kindRangeEnd(sj);
+                if (UP) {
+                    calcPairBlockOneSideAndUp<Range>(pi, sj, ej, kinds.pair(ki, sj->kind_), ci, up_, rdf);
+                } else {
+                    calcPairBlockOneSide<Range>(pi, sj, ej, kinds.pair(ki, sj->kind_), ci);
+                }
             }
-          }
         }
+    }
 }
 
-void Cell::updateVelocityHalfAndCalcUk() {
-  uk_ = 0; // 運動エネルギーの初期化
-  Particle *pi;
-    for (pi = list_.head(); pi ; pi = pi->next_) {
+template <class Kinds>
+void Cell::updateVelocityHalfAndCalcUkFor(const Kinds &kinds) {
+    uk_ = 0; // 運動エネルギーの初期化
+    for (Particle *pi = list_.head(); pi ; pi = pi->next_) {
         pi->vel_dt_ += pi->a_dt2_half_;
-
-        LJScaledMoleculeParam *parami = &LJParams::MOLECULE_PARAMS_[pi->kind_];
         //運動エネルギーの計算
-        uk_ += pi->vel_dt_.square() * parami->m_by_2dt2_;
-        // HINT: The following line will produce a log file entry, for
-        // debugging purposes. This will produce a log, each time
-        // every molecule moves, and this will slow down the program significantly.
-        // Once you have confirmed that the code works, try inhibiting
-        // the log output by surrounding the following lines with an #ifdef ... #endif pair.
-        //Logger::out << "velocity*dt of molecule " << pi->serial_
-        //           << " is" << pi->vel_dt_<< std::endl;
+        uk_ += pi->vel_dt_.square() * kinds.mBy2dt2(pi->kind_);
+    }
+}
+
+/*
+ * 系が単一種類であれば（LJParams::SINGLE_KIND_参照）、種類を固定した処理を呼ぶ。
+ */
+template <bool UP, class Range>
+void Cell::calcForceWithinSelfIn(RdfAccumulator *rdf) {
+    if (LJParams::SINGLE_KIND_ >= 0) {
+        calcForceWithinSelfFor<UP, Range>(LJSingleKind(LJParams::SINGLE_KIND_), rdf);
+    } else {
+        calcForceWithinSelfFor<UP, Range>(LJMixedKinds(), rdf);
+    }
+}
+
+template <bool UP, class Range>
+void Cell::calcForceWithLocalCellIn(Cell *otherCell, RdfAccumulator *rdf) {
+    if (LJParams::SINGLE_KIND_ >= 0) {
+        calcForceWithLocalCellFor<UP, Range>(otherCell, LJSingleKind(LJParams::SINGLE_KIND_), rdf);
+    } else {
+        calcForceWithLocalCellFor<UP, Range>(otherCell, LJMixedKinds(), rdf);
+    }
+}
+
+template <bool UP, class Range>
+void Cell::calcForceWithSurroundingCellIn(Cell *otherCell, RdfAccumulator *rdf) {
+    if (LJParams::SINGLE_KIND_ >= 0) {
+        calcForceWithSurroundingCellFor<UP, Range>(otherCell, LJSingleKind(LJParams::SINGLE_KIND_), rdf);
+    } else {
+        calcForceWithSurroundingCellFor<UP, Range>(otherCell, LJMixedKinds(), rdf);
+    }
+}
+
+/*
+ * 距離の範囲の指定に対応するポリシークラスで、処理の本体を呼ぶ。
+ */
+void Cell::calcForceWithinSelf(LJForceRange range) {
+    switch (range) {
+    case LJ_FORCE_FULL:  calcForceWithinSelfIn<false, LJFullRange>(NULL); break;
+    case LJ_FORCE_INNER: calcForceWithinSelfIn<false, LJInnerRange>(NULL); break;
+    case LJ_FORCE_OUTER: calcForceWithinSelfIn<false, LJOuterRange>(NULL); break;
+    }
+}
+
+void Cell::calcForceWithLocalCell(Cell *otherCell, LJForceRange range) {
+    switch (range) {
+    case LJ_FORCE_FULL:  calcForceWithLocalCellIn<false, LJFullRange>(otherCell, NULL); break;
+    case LJ_FORCE_INNER: calcForceWithLocalCellIn<false, LJInnerRange>(otherCell, NULL); break;
+    case LJ_FORCE_OUTER: calcForceWithLocalCellIn<false, LJOuterRange>(otherCell, NULL); break;
+    }
+}
+
+void Cell::calcForceWithSurroundingCell(Cell *otherCell, LJForceRange range) {
+    switch (range) {
+    case LJ_FORCE_FULL:  calcForceWithSurroundingCellIn<false, LJFullRange>(otherCell, NULL); break;
+    case LJ_FORCE_INNER: calcForceWithSurroundingCellIn<false, LJInnerRange>(otherCell, NULL); break;
+    case LJ_FORCE_OUTER: calcForceWithSurroundingCellIn<false, LJOuterRange>(otherCell, NULL); break;
+    }
+}
+
+// Upはカットオフ距離までの全ての組について集計するので、近距離の部分だけの計算はしない
+void Cell::calcForceWithinSelfAndUp(RdfAccumulator *rdf, LJForceRange range) {
+    assert(range != LJ_FORCE_INNER);
+    if (range == LJ_FORCE_FULL) {
+        calcForceWithinSelfIn<true, LJFullRange>(rdf);
+    } else {
+        calcForceWithinSelfIn<true, LJOuterRange>(rdf);
+    }
+}
+
+void Cell::calcForceWithLocalCellAndUp(Cell *otherCell, RdfAccumulator *rdf, LJForceRange range) {
+    assert(range != LJ_FORCE_INNER);
+    if (range == LJ_FORCE_FULL) {
+        calcForceWithLocalCellIn<true, LJFullRange>(otherCell, rdf);
+    } else {
+        calcForceWithLocalCellIn<true, LJOuterRange>(otherCell, rdf);
+    }
+}
+
+void Cell::calcForceWithSurroundingCellAndUp(Cell *otherCell, RdfAccumulator *rdf, LJForceRange range) {
+    assert(range != LJ_FORCE_INNER);
+    if (range == LJ_FORCE_FULL) {
+        calcForceWithSurroundingCellIn<true, LJFullRange>(otherCell, rdf);
+    } else {
+        calcForceWithSurroundingCellIn<true, LJOuterRange>(otherCell, rdf);
+    }
+}
+
+void Cell::updateVelocityHalfAndCalcUk() {
+    if (LJParams::SINGLE_KIND_ >= 0) {
+        updateVelocityHalfAndCalcUkFor(LJSingleKind(LJParams::SINGLE_KIND_));
+    } else {
+        updateVelocityHalfAndCalcUkFor(LJMixedKinds());
     }
 }
@@ -126,6 +126,16 @@ void FileReader::readInt(int &val, const char *label) {
     }
 }
 
+void FileReader::readLongLong(long long &val, const char *label) {
+    cur_line_ >> val;
+    if (cur_line_.fail()) {
+        std::stringstream msg;
+        msg << "integer value for " << label << " was expected at ";
+        addFileNameAndLineNoTo(msg);
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+}
+
 void FileReader::readString(std::string &val, const char *label) {
     // 文字列（単語）を取り出す。
     cur_line_ >> val;
@@ -137,6 +147,12 @@ void FileReader::readString(std::string &val, const char *label) {
     }
 }
 
+bool FileReader::readWord(std::string &val) {
+    // readStringと異なり、単語がないこと（空行など）をエラーとしない。
+    cur_line_ >> val;
+    return !cur_line_.fail();
+}
+
 void FileReader::readExpectedInt(int expected_val, const char *label) {
     int val;
     // 整数値を取得する
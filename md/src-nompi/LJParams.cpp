@@ -72,6 +72,13 @@ LJScaledMoleculePairParam LJParams::PAIR_PARAMS_[LJ_MOLECULE_TYPES][LJ_MOLECULE_
 
 double LJParams::CUTOFF_SQ_; /* square of cutoff distance */
 
+double LJParams::RESPA_INNER_SQ_;
+double LJParams::RESPA_SWITCH_START_;
+double LJParams::RESPA_SWITCH_SQ_;
+double LJParams::RESPA_SWITCH_INV_WIDTH_;
+
+int LJParams::SINGLE_KIND_ = -1;
+
 void LJParams::initParams(CaseData *caseData) {
     double dt = caseData->delta_t_; // [fs]
     int i, j;
@@ -118,6 +125,15 @@ void LJParams::initParams(CaseData *caseData) {
     }
     // don't forget to set CUTOFF_SQ_
     CUTOFF_SQ_ = caseData->cutoff_radius_ * caseData->cutoff_radius_;
+    // r-RESPAを使わない場合、近距離の部分はカットオフ距離までの力そのものになる
+    double inner = caseData->respaRequested() ? caseData->respa_inner_radius_ : caseData->cutoff_radius_;
+    double width = caseData->respaRequested() ? caseData->respa_switch_width_ : 0;
+    RESPA_INNER_SQ_ = inner * inner;
+    RESPA_SWITCH_START_ = inner - width;
+    RESPA_SWITCH_SQ_ = RESPA_SWITCH_START_ * RESPA_SWITCH_START_;
+    RESPA_SWITCH_INV_WIDTH_ = (width > 0) ? 1 / width : 0;
+    // 初期状態を読むまでは混合系として扱う
+    SINGLE_KIND_ = -1;
 }
 
 int LJParams::nameToMoleculeKind(const char *name) {
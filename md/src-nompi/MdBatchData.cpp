@@ -0,0 +1,319 @@
+/*
+ * MdBatchData.cpp
+ *
+ */
+
+#include <MdBatchData.h>
+#include <FileReader.h>
+
+#include <sstream>
+#include <cassert>
+
+MdBatchData::MdBatchData()
+    : caseData_(NULL), commData_(NULL), replicas_(0), molecule_count_(0), trajectory_molecule_count_(0) {
+}
+
+MdBatchData::~MdBatchData() {
+    closeOutputFiles();
+}
+
+void MdBatchData::init(CaseData *caseData, MdCommData *commData, const std::vector<std::string> &state_files) {
+    caseData_ = caseData;
+    commData_ = commData;
+    replicas_ = (int)state_files.size();
+    assert(replicas_ > 0);
+
+    double rc2 = 2 * caseData_->cutoff_radius_;
+    if (caseData_->lx_ < rc2 || caseData_->ly_ < rc2 || caseData_->lz_ < rc2) {
+        std::stringstream msg;
+        msg << "box size (" << caseData_->lx_ << ", " << caseData_->ly_ << ", " << caseData_->lz_
+            << ") should be at least 2 * cutoff_radius = " << rc2 << " for the batch mode";
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+
+    // レプリカごとにファイルの順で読み込んでから、分子ごとに全レプリカの分が並ぶように詰め替える
+    std::vector<std::vector<double> > xv(replicas_);
+    for (int r = 0; r < replicas_; r++) {
+        std::vector<int> kinds;
+        readInitialStateFile(state_files[r], kinds, xv[r]);
+        if (r == 0) {
+            kinds_ = kinds;
+        } else if (kinds != kinds_) {
+            std::stringstream msg;
+            msg << state_files[r] << " does not have the same molecules as " << state_files[0];
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+    }
+    molecule_count_ = (int)kinds_.size();
+    size_t n = (size_t)molecule_count_ * replicas_;
+    x_.resize(n);
+    y_.resize(n);
+    z_.resize(n);
+    vx_.resize(n);
+    vy_.resize(n);
+    vz_.resize(n);
+    ax_.assign(n, 0);
+    ay_.assign(n, 0);
+    az_.assign(n, 0);
+    for (int i = 0; i < molecule_count_; i++) {
+        for (int r = 0; r < replicas_; r++) {
+            const double *src = &xv[r][i * 6];
+            size_t idx = (size_t)i * replicas_ + r;
+            x_[idx] = src[0];
+            y_[idx] = src[1];
+            z_[idx] = src[2];
+            vx_[idx] = src[3];
+            vy_[idx] = src[4];
+            vz_[idx] = src[5];
+        }
+    }
+    uk_.assign(replicas_, 0);
+    up_.assign(replicas_, 0);
+
+    trajectory_molecule_count_ = 0;
+    for (int i = 0; i < molecule_count_; i++) {
+        if (commData_->isTrajectoryMolecule(kinds_[i], i)) {
+            trajectory_molecule_count_++;
+        }
+    }
+}
+
+void MdBatchData::readInitialStateFile(const std::string &path, std::vector<int> &kinds, std::vector<double> &xv) {
+    FileReader rdr;
+    rdr.open(path);
+    // 箱は原点から (lx, ly, lz) まで。localBox_ はプロセス分割 1 1 1 の場合にしか箱全体にならない。
+    const BoxXYZ box(0, 0, 0, caseData_->lx_, caseData_->ly_, caseData_->lz_);
+    while (rdr.readLine()) {
+        std::string name;
+        rdr.readString(name, "Molecule type");
+        int kind = LJParams::nameToMoleculeKind(name.c_str());
+        VectorXYZ pos, vel;
+        rdr.readDouble(pos.x_, "x");
+        rdr.readDouble(pos.y_, "y");
+        rdr.readDouble(pos.z_, "z");
+        rdr.readDouble(vel.x_, "u");
+        rdr.readDouble(vel.y_, "v");
+        rdr.readDouble(vel.z_, "w");
+        // MdProcData と違って箱の外の分子は読み飛ばさない。レプリカ間で分子数がずれるため。
+        if (!box.contains(pos)) {
+            std::stringstream msg;
+            msg << "molecule " << kinds.size() << " is out of the box in " << path;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+        kinds.push_back(kind);
+        xv.push_back(pos.x_);
+        xv.push_back(pos.y_);
+        xv.push_back(pos.z_);
+        xv.push_back(vel.x_ * caseData_->delta_t_);
+        xv.push_back(vel.y_ * caseData_->delta_t_);
+        xv.push_back(vel.z_ * caseData_->delta_t_);
+    }
+    rdr.close();
+}
+
+double MdBatchData::estimateMemoryBytes() const {
+    // 座標、速度、加速度の9成分
+    return 9.0 * sizeof(double) * molecule_count_ * replicas_;
+}
+
+/*
+ * 最小像の変位。座標は箱の中にあるので、変位は (-l, l) の範囲にある。
+ * 条件式では定数を選ぶだけにしておくと、分岐でなく選択命令になり、最内ループのベクトル化を妨げない。
+ */
+static inline double minimumImage(double d, double l, double half) {
+    double shift = (d > half) ? l : 0.0;
+    shift = (d < -half) ? -l : shift;
+    return d - shift;
+}
+
+template <bool UP>
+void MdBatchData::calcPairForce(int i, int j) {
+    const int n = replicas_;
+    const LJScaledMoleculePairParam &pair = LJParams::PAIR_PARAMS_[kinds_[i]][kinds_[j]];
+    const double a = pair.a_;
+    const double b = pair.b_;
+    const double ci = LJParams::MOLECULE_PARAMS_[kinds_[i]].dt2_by_2m_;
+    const double cj = LJParams::MOLECULE_PARAMS_[kinds_[j]].dt2_by_2m_;
+    const double cutoff_sq = LJParams::CUTOFF_SQ_;
+    const double lx = caseData_->lx_, hx = lx * 0.5;
+    const double ly = caseData_->ly_, hy = ly * 0.5;
+    const double lz = caseData_->lz_, hz = lz * 0.5;
+    const double *xi = &x_[(size_t)i * n], *xj = &x_[(size_t)j * n];
+    const double *yi = &y_[(size_t)i * n], *yj = &y_[(size_t)j * n];
+    const double *zi = &z_[(size_t)i * n], *zj = &z_[(size_t)j * n];
+    double *axi = &ax_[(size_t)i * n], *axj = &ax_[(size_t)j * n];
+    double *ayi = &ay_[(size_t)i * n], *ayj = &ay_[(size_t)j * n];
+    double *azi = &az_[(size_t)i * n], *azj = &az_[(size_t)j * n];
+    double *up = &up_[0];
+    // 各配列の区間は重ならない（i != j）ので、レプリカ間に依存はない。
+    // 配列の数が多く、コンパイラは重なりの実行時判定を諦めるので、simd で明示する。
+#pragma omp simd
+    for (int r = 0; r < n; r++) {
+        double dx = minimumImage(xj[r] - xi[r], lx, hx);
+        double dy = minimumImage(yj[r] - yi[r], ly, hy);
+        double dz = minimumImage(zj[r] - zi[r], lz, hz);
+        double r2 = dx * dx + dy * dy + dz * dz;
+        // Cell::calcLJforce と同じ式。カットオフ外の組は係数に0を掛ける。
+        // 除算を条件式の中に置くと分岐が残ってベクトル化されないので、除算は全ての組で行う。
+        double in = (r2 < cutoff_sq) ? 1.0 : 0.0;
+        double r8 = r2 * r2 * r2 * r2;
+        double f = ((a * r2) / (r8 * r8) + b / r8) * in;
+        axi[r] += dx * f * ci;
+        ayi[r] += dy * f * ci;
+        azi[r] += dz * f * ci;
+        axj[r] -= dx * f * cj;
+        ayj[r] -= dy * f * cj;
+        azj[r] -= dz * f * cj;
+        if (UP) {
+            double r6 = r2 * r2 * r2;
+            up[r] += (-a / (r6 * r6 * 12) - b / (r6 * 6)) * in;
+        }
+    }
+}
+
+void MdBatchData::calcForce(bool up) {
+    ax_.assign(ax_.size(), 0);
+    ay_.assign(ay_.size(), 0);
+    az_.assign(az_.size(), 0);
+    if (up) {
+        up_.assign(replicas_, 0);
+    }
+    for (int i = 0; i < molecule_count_; i++) {
+        for (int j = i + 1; j < molecule_count_; j++) {
+            if (up) {
+                calcPairForce<true>(i, j);
+            } else {
+                calcPairForce<false>(i, j);
+            }
+        }
+    }
+}
+
+void MdBatchData::updateVelocityHalf() {
+    long n = (long)vx_.size();
+    double *vx = &vx_[0], *vy = &vy_[0], *vz = &vz_[0];
+    const double *ax = &ax_[0], *ay = &ay_[0], *az = &az_[0];
+#pragma omp simd
+    for (long i = 0; i < n; i++) {
+        vx[i] += ax[i];
+        vy[i] += ay[i];
+        vz[i] += az[i];
+    }
+}
+
+/*
+ * 周期境界での折り返し。一回の移動は箱の大きさより十分小さいので、折り返しは一回でよい。
+ */
+static inline double wrapPosition(double x, double l) {
+    double shift = (x < 0) ? -l : 0.0;
+    shift = (x >= l) ? l : shift;
+    return x - shift;
+}
+
+void MdBatchData::updateVelocityHalfAndPosition() {
+    const double lx = caseData_->lx_;
+    const double ly = caseData_->ly_;
+    const double lz = caseData_->lz_;
+    long n = (long)vx_.size();
+    double *x = &x_[0], *y = &y_[0], *z = &z_[0];
+    double *vx = &vx_[0], *vy = &vy_[0], *vz = &vz_[0];
+    const double *ax = &ax_[0], *ay = &ay_[0], *az = &az_[0];
+#pragma omp simd
+    for (long i = 0; i < n; i++) {
+        vx[i] += ax[i];
+        vy[i] += ay[i];
+        vz[i] += az[i];
+        x[i] = wrapPosition(x[i] + vx[i], lx);
+        y[i] = wrapPosition(y[i] + vy[i], ly);
+        z[i] = wrapPosition(z[i] + vz[i], lz);
+    }
+}
+
+void MdBatchData::updateVelocityHalfAndCalcUk() {
+    const int n = replicas_;
+    uk_.assign(replicas_, 0);
+    double *uk = &uk_[0];
+    for (int i = 0; i < molecule_count_; i++) {
+        double m_by_2dt2 = LJParams::MOLECULE_PARAMS_[kinds_[i]].m_by_2dt2_;
+        double *vx = &vx_[(size_t)i * n], *vy = &vy_[(size_t)i * n], *vz = &vz_[(size_t)i * n];
+        const double *ax = &ax_[(size_t)i * n], *ay = &ay_[(size_t)i * n], *az = &az_[(size_t)i * n];
+#pragma omp simd
+        for (int r = 0; r < n; r++) {
+            vx[r] += ax[r];
+            vy[r] += ay[r];
+            vz[r] += az[r];
+            uk[r] += (vx[r] * vx[r] + vy[r] * vy[r] + vz[r] * vz[r]) * m_by_2dt2;
+        }
+    }
+}
+
+std::string MdBatchData::outputPathFor(const std::string &path, int replica) {
+    std::stringstream ss;
+    ss << "." << replica;
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == 0) {
+        return path + ss.str();
+    }
+    return path.substr(0, dot) + ss.str() + path.substr(dot);
+}
+
+void MdBatchData::openOutputFiles() {
+    for (int r = 0; r < replicas_; r++) {
+        if (caseData_->trajectory_output_) {
+            std::string traj_file_name = outputPathFor(caseData_->trajectory_file_path_, r);
+            std::ofstream *tfile = new std::ofstream(traj_file_name.c_str(), std::ios::out);
+            tfiles_.push_back(tfile);
+            if (!tfile->is_open()) {
+                throw IoException(__FILE__, __LINE__, traj_file_name.c_str());
+            }
+        }
+        std::string energy_file_name = outputPathFor(caseData_->energy_file_path_, r);
+        std::ofstream *efile = new std::ofstream(energy_file_name.c_str(), std::ios::out);
+        efiles_.push_back(efile);
+        if (!efile->is_open()) {
+            throw IoException(__FILE__, __LINE__, energy_file_name.c_str());
+        }
+    }
+}
+
+void MdBatchData::closeOutputFiles() {
+    for (size_t r = 0; r < tfiles_.size(); r++) {
+        delete tfiles_[r];
+    }
+    for (size_t r = 0; r < efiles_.size(); r++) {
+        delete efiles_[r];
+    }
+    tfiles_.clear();
+    efiles_.clear();
+}
+
+void MdBatchData::writeTrajectory() {
+    double inv_delta_t = 1.0 / caseData_->delta_t_;
+    for (int r = 0; r < replicas_; r++) {
+        std::ofstream &tfile = *tfiles_[r];
+        tfile << trajectory_molecule_count_ << std::endl;
+        tfile << "# Output of mdlj\n";
+        for (int i = 0; i < molecule_count_; i++) {
+            if (!commData_->isTrajectoryMolecule(kinds_[i], i)) {
+                continue;
+            }
+            size_t idx = (size_t)i * replicas_ + r;
+            tfile << LJParams::SOURCE_PARAMS_[kinds_[i]].label_;
+            if (caseData_->trajectory_positions_) {
+                tfile << " " << x_[idx] << " " << y_[idx] << " " << z_[idx];
+            }
+            if (caseData_->trajectory_velocities_) {
+                tfile << " " << vx_[idx] * inv_delta_t << " " << vy_[idx] * inv_delta_t
+                      << " " << vz_[idx] * inv_delta_t;
+            }
+            tfile << std::endl;
+        }
+    }
+}
+
+void MdBatchData::writeEnergy() {
+    for (int r = 0; r < replicas_; r++) {
+        *efiles_[r] << caseData_->t_ << " " << uk_[r] << " " << up_[r] << " " << uk_[r] + up_[r] << std::endl;
+    }
+}
@@ -7,6 +7,9 @@
 #include <MdCommData.h>
 #include <IoException.h>
 
+#include <algorithm>
+#include <cstring>
+
 std::ostream &operator<<(std::ostream &os, const CommMoleculeTrajData &data) {
     os << "[ kind : " << data.kind_;
     os << ", serial : " << data.serial_;
@@ -15,28 +18,19 @@ std::ostream &operator<<(std::ostream &os, const CommMoleculeTrajData &data) {
     return os;
 }
 
-std::ostream &operator<<(std::ostream &os, const CommMoleculeFullData &data) {
-    os << "[ kind : " << data.kind_;
-    os << ", serial : " << data.serial_;
-    os << ", r = (" << data.rx_ << "," << data.ry_ << "," << data.rz_ << ")";
-    os << ", vdt = (" << data.vdtx_ << "," << data.vdty_ << "," << data.vdtz_ << ") ]";
-    return os;
-}
-
 std::ostream &operator<<(std::ostream &os, const CommMoleculePosData &data) {
-    os << "[ kind : " << data.kind_;
-    os << ", r = (" << data.rx_ << "," << data.ry_ << "," << data.rz_ << ") ]";
+    os << "[ kind : " << (int)data.kind_;
+    os << ", q = (" << data.qx_ << "," << data.qy_ << "," << data.qz_ << ") ]";
     return os;
 }
 
-void MdCommPeerBuffer::setRankAndTags(int rank, int tag_for_send, int tag_for_recv) {
+void MdCommPeerBuffer::setRank(int rank) {
     rank_ = rank;
-    tag_for_send_ = tag_for_send;
-    tag_for_recv_ = tag_for_recv;
 }
 
 void MdCommPeerBuffer::clearSendMoleculeFullBuffer() {
-    send_molecule_full_.clear();
+    send_particles_.clear();
+    send_correlator_state_.clear();
     send_count_per_cell_.clear();
     send_count_ = 0;
 }
@@ -49,28 +43,17 @@ void MdCommPeerBuffer::clearSendMoleculePosBuffer() {
 
 void MdCommPeerBuffer::addMoleculeFullDataFrom(Cell *cell) {
     int count = 0;
-    // cellに含まれる全粒子の情報をsend_molecule_full_ベクターに追加していく
+    // cellに含まれる全粒子をsend_particles_ベクターに追加していく。
+    // 座標の周期境界の補正は、受信側で行う。
     for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
-        // ベクターの要素の型であるCommMoleculeFullData構造体の変数dataに一旦値を格納してから
-        // push_backでベクターに追加する。
-        CommMoleculeFullData data;
-        data.kind_ = p->kind_;
-        data.serial_ = p->serial_;
-        // HINT: To implement periodic boundary condition behavior,
-        // consider adjusting the position sent out here.
-        // Make the position values suitable for the recipient.
-        data.rx_ = p->pos_.x_ + offset.x_;
-        data.ry_ = p->pos_.y_ + offset.y_;
-        data.rz_ = p->pos_.z_ + offset.z_;
         //Logger::out << "Sending molecule " << p->serial_
         //            << " at " << p->pos_ << std::endl;
-        data.vdtx_ = p->vel_dt_.x_;
-        data.vdty_ = p->vel_dt_.y_;
-        data.vdtz_ = p->vel_dt_.z_;
-        send_molecule_full_.push_back(data);
+        send_particles_.push_back(p);
         // 送り出す粒子の数を数える
         ++count;
     }
+    // 粒子は送信が完了するまで send_particles_ が保持する
+    cell->detachAllParticles();
     // このセルに由来する粒子の数を、送出粒子数のベクターに書き込む
     send_count_per_cell_.push_back(count);
     // 送信する総粒子数のカウンタにも加える
@@ -80,21 +63,23 @@ void MdCommPeerBuffer::addMoleculeFullDataFrom(Cell *cell) {
     }
 }
 
-void MdCommPeerBuffer::addMoleculePosDataFrom(Cell *cell) {
+void MdCommPeerBuffer::addMoleculePosDataFrom(Cell *cell, double margin) {
     int count = 0;
+    // 座標はセルの原点からの相対位置として送るので、周期境界の補正量(offset)は要らない
+    const BoxXYZ &box = cell->cellBox();
+    VectorXYZ lo(box.p1_.x_ - margin, box.p1_.y_ - margin, box.p1_.z_ - margin);
+    double inv_lx = 1.0 / (box.p2_.x_ - box.p1_.x_ + 2 * margin);
+    double inv_ly = 1.0 / (box.p2_.y_ - box.p1_.y_ + 2 * margin);
+    double inv_lz = 1.0 / (box.p2_.z_ - box.p1_.z_ + 2 * margin);
     // cellに含まれる全粒子の情報をsend_molecule_pos_ベクターに追加していく
     for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
         // ベクターの要素の型であるCommMoleculePosData構造体の変数dataに一旦値を格納してから
         // push_backでベクターに追加する。
         CommMoleculePosData data;
-        data.kind_ = p->kind_;
-        // HINT: To implement periodic boundary condition behavior,
-        // consider adjusting the position sent out here.
-        // Make the position values suitable for the recipient.
-        //Logger::out <<"pos before modified"<< p->pos_ << std::endl;
-        data.rx_ = p->pos_.x_ + offset.x_;
-        data.ry_ = p->pos_.y_ + offset.y_;
-        data.rz_ = p->pos_.z_ + offset.z_;
+        data.kind_ = (unsigned char)p->kind_;
+        data.qx_ = CommMoleculePosData::quantize(p->pos_.x_, lo.x_, inv_lx);
+        data.qy_ = CommMoleculePosData::quantize(p->pos_.y_, lo.y_, inv_ly);
+        data.qz_ = CommMoleculePosData::quantize(p->pos_.z_, lo.z_, inv_lz);
         //Logger::out << "Sending molecule " << p->serial_
         //            << " at " << p->pos_ << std::endl;
         send_molecule_pos_.push_back(data);
@@ -114,7 +99,7 @@ void MdCommPeerBuffer::setMoleculeFullDataSendCount() {
 #ifdef DEBUG_MPI
   //  Logger::out << "send_count " << send_atom_full_.size() << std::endl;
 #endif
-    send_count_ = send_molecule_full_.size();
+    send_count_ = send_particles_.size();
 }
 
 void MdCommPeerBuffer::setMoleculePosDataSendCount() {
@@ -136,7 +121,6 @@ void MdCommPeerBuffer::setMoleculeFullDataRecvBuffer() {
 #ifdef DEBUG_MPI
     //Logger::out << "receiving molecule full count sum : " << count << std::endl;
 #endif
-    recv_molecule_full_.resize(count);
     recv_count_ = count;
 }
 
@@ -162,12 +146,21 @@ void MdCommPeerBuffer::setOffsetForSending(double x, double y, double z) {
 
 void MdCommData::init(CaseData *caseData) {
     caseData_ = caseData;
-    total_uk_ = 0;
-    total_up_ = 0;
-    send_uk_ = 0;
-    send_up_ = 0;
-    recv_uk_ = 0;
-    recv_up_ = 0;
+    particle_pool_ = NULL;
+    for (int i = 0; i < ENERGY_TERMS; i++) {
+        send_energy_[i] = 0;
+        recv_energy_[i] = 0;
+    }
+    energy_time_ = 0;
+    traj_send_count_ = 0;
+    initTrajectoryFormat();
+    if (caseData->rdfRequested()) {
+        rdf_.init(caseData->rdf_bins_, caseData->cutoff_radius_);
+    }
+    if (caseData->msdRequested()) {
+        correlator_.init(caseData->msd_levels_, caseData->msd_points_,
+                caseData->msd_interval_ * caseData->delta_t_);
+    }
 }
 
 MdCommPeerBuffer *MdCommData::bufferFor(const GridIndex3d &idx) {
@@ -177,22 +170,122 @@ MdCommPeerBuffer *MdCommData::bufferFor(const GridIndex3d &idx) {
     return &peerBuffers_[idx.ix_][idx.iy_][idx.iz_];
 }
 
+Particle *MdCommData::allocateParticle() {
+    Particle *p;
+    // 空きparticleリストに在庫があるか？
+    if (particle_pool_ == NULL || particle_pool_->isEmpty()) {
+        // 在庫はないので新規に割り当てる。
+        p = new Particle;
+    } else {
+        // 在庫があるので、空き particle を一つ取り出す。
+        p = particle_pool_->removeTail();
+    }
+    p->corr_slot_ = -1;
+    return p;
+}
+
+void MdCommData::allocateRecvParticles(MdCommPeerBuffer *peer) {
+    assert(peer->recv_particles_.empty());
+    peer->recv_particles_.resize(peer->recv_count_);
+    for (size_t i = 0; i < peer->recv_count_; i++) {
+        peer->recv_particles_[i] = allocateParticle();
+    }
+}
+
+void MdCommData::releaseSentParticles(MdCommPeerBuffer *peer) {
+    std::vector<Particle *>::iterator it;
+    for (it = peer->send_particles_.begin(); it != peer->send_particles_.end(); ++it) {
+        if (particle_pool_ != NULL) {
+            particle_pool_->add(*it);
+        } else {
+            delete *it;
+        }
+    }
+    peer->clearSendMoleculeFullBuffer();
+}
+
+void MdCommData::initTrajectoryFormat() {
+    traj_values_ = (caseData_->trajectory_positions_ ? 3 : 0) + (caseData_->trajectory_velocities_ ? 3 : 0);
+    assert(traj_values_ > 0);
+    size_t value_size = caseData_->trajectory_float_ ? sizeof(float) : sizeof(double);
+    // 次のレコードの通し番号が8バイト境界に来るように切り上げる
+    traj_record_size_ = (TRAJ_VALUES_OFFSET + traj_values_ * value_size + 7) / 8 * 8;
+
+    traj_species_filter_ = !caseData_->trajectory_species_.empty();
+    for (int k = 0; k < LJ_MOLECULE_TYPES; k++) {
+        traj_kinds_[k] = !traj_species_filter_;
+    }
+    for (size_t i = 0; i < caseData_->trajectory_species_.size(); i++) {
+        // 知らない名前であれば DataException が挙がる
+        traj_kinds_[LJParams::nameToMoleculeKind(caseData_->trajectory_species_[i].c_str())] = true;
+    }
+}
+
 void MdCommData::addTrajectoryDataFrom(Cell *cell) {
     Particle *p;
     double inv_delta_t = 1.0 / caseData_->delta_t_;
-    // cellに含まれる全粒子をトラジェクトリー用の送信バッファに書き込む
+    // cellに含まれる粒子のうち、出力するものをトラジェクトリー用の送信バッファに書き込む。
+    // 出力しない分子や項目は、rootに送る前にここで落とす。
     for (p = cell->getParticleListHead(); p != NULL; p = p->next_) {
-        // 一旦変数dataに格納してからベクターにpush_backで追記する。
-        CommMoleculeTrajData data;
-        data.kind_ = p->kind_;
-        data.serial_ = p->serial_;
-        data.rx_ = p->pos_.x_;
-        data.ry_ = p->pos_.y_;
-        data.rz_ = p->pos_.z_;
-        data.vx_ = p->vel_dt_.x_ * inv_delta_t;
-        data.vy_ = p->vel_dt_.y_ * inv_delta_t;
-        data.vz_ = p->vel_dt_.z_ * inv_delta_t;
-        send_molecule_traj_.push_back(data);
+        if (!isTrajectoryMolecule(p->kind_, p->serial_)) {
+            continue;
+        }
+        double values[6];
+        int n = 0;
+        if (caseData_->trajectory_positions_) {
+            values[n++] = p->pos_.x_;
+            values[n++] = p->pos_.y_;
+            values[n++] = p->pos_.z_;
+        }
+        if (caseData_->trajectory_velocities_) {
+            values[n++] = p->vel_dt_.x_ * inv_delta_t;
+            values[n++] = p->vel_dt_.y_ * inv_delta_t;
+            values[n++] = p->vel_dt_.z_ * inv_delta_t;
+        }
+        assert(n == traj_values_);
+        size_t top = send_molecule_traj_.size();
+        send_molecule_traj_.resize(top + traj_record_size_);
+        char *rec = &send_molecule_traj_[top];
+        std::memcpy(rec + TRAJ_SERIAL_OFFSET, &p->serial_, sizeof(long long));
+        std::memcpy(rec + TRAJ_KIND_OFFSET, &p->kind_, sizeof(int));
+        if (caseData_->trajectory_float_) {
+            for (int i = 0; i < n; i++) {
+                float f = (float)values[i];
+                std::memcpy(rec + TRAJ_VALUES_OFFSET + i * sizeof(float), &f, sizeof(float));
+            }
+        } else {
+            std::memcpy(rec + TRAJ_VALUES_OFFSET, values, n * sizeof(double));
+        }
+    }
+}
+
+void MdCommData::unpackTrajectoryRecord(const char *rec, CommMoleculeTrajData *data) const {
+    std::memcpy(&data->serial_, rec + TRAJ_SERIAL_OFFSET, sizeof(long long));
+    std::memcpy(&data->kind_, rec + TRAJ_KIND_OFFSET, sizeof(int));
+    double values[6];
+    if (caseData_->trajectory_float_) {
+        for (int i = 0; i < traj_values_; i++) {
+            float f;
+            std::memcpy(&f, rec + TRAJ_VALUES_OFFSET + i * sizeof(float), sizeof(float));
+            values[i] = f;
+        }
+    } else {
+        std::memcpy(values, rec + TRAJ_VALUES_OFFSET, traj_values_ * sizeof(double));
+    }
+    int n = 0;
+    if (caseData_->trajectory_positions_) {
+        data->rx_ = values[n++];
+        data->ry_ = values[n++];
+        data->rz_ = values[n++];
+    } else {
+        data->rx_ = data->ry_ = data->rz_ = 0;
+    }
+    if (caseData_->trajectory_velocities_) {
+        data->vx_ = values[n++];
+        data->vy_ = values[n++];
+        data->vz_ = values[n++];
+    } else {
+        data->vx_ = data->vy_ = data->vz_ = 0;
     }
 }
 
@@ -201,16 +294,11 @@ void MdCommData::appendSendTrajectoryDataToRecvTrajectoryData() {
     // root rank向けの送信バッファの内容を、自身の受信バッファに転記する。
     assert(caseData_->isRootRank());
     //Logger::out << "MdCommData::appendSendTrajectoryDataToRecvTrajectoryData" << std::endl;
-    size_t i, n;
-    n = send_molecule_traj_.size();
-    ///Logger::out << "appending " << n << " molecules" << std::endl;
-    for (i = 0; i < n; i++) {
-        recv_molecule_traj_.push_back(send_molecule_traj_[i]);
-    }
+    recv_molecule_traj_.insert(recv_molecule_traj_.end(), send_molecule_traj_.begin(), send_molecule_traj_.end());
 }
 
 void MdCommData::setRecvTrajectoryBufferSize(size_t count) {
-    recv_molecule_traj_.resize(count);
+    recv_molecule_traj_.resize(count * traj_record_size_);
 }
 
 void MdCommData::clearSendTrajectory() {
@@ -221,43 +309,63 @@ void MdCommData::clearRecvTrajectory() {
     recv_molecule_traj_.clear();
 }
 
-void MdCommData::setAllMoleculeCount(int all_molecule_count) {
+void MdCommData::setAllMoleculeCount(long long all_molecule_count) {
     all_molecule_traj_.resize(all_molecule_count);
 }
 
 
+// 通し番号順に整列するための比較関数
+static bool lessSerial(const CommMoleculeTrajData &a, const CommMoleculeTrajData &b) {
+    return a.serial_ < b.serial_;
+}
+
 void MdCommData::orderRecvTrajectoryToAllTrajectory() {
     assert(caseData_->isRootRank());
     // トラジェクトリー用に1プロセスずつ粒子のデータを送ってもらうが、粒子のシリアル番号
     // としては、でたらめな順番でデータが到着する。それらのデータを、シリアル番号順の
     // 配列に移し替える。受信した粒子のデータにはそれぞれシリアル番号が書いてあるので
     // 結果を受け取る配列の、シリアル番号の位置に、個々の粒子のデータを転記すればよい。
-    // 普通に整数変数でループを回してもよいが、ここではSTLのイテレータを使ってループを書いている
+    // 通し番号の範囲で絞り込んだ場合は、範囲の先頭からの位置になる。
     //Logger::out << "MdCommData::orderRecvTrajectoryToAllTrajectory" << std::endl;
-    std::vector<CommMoleculeTrajData>::iterator it;
-    for (it = recv_molecule_traj_.begin(); it != recv_molecule_traj_.end(); ++it) {
-        size_t serial = it->serial_;
-        assert(serial < all_molecule_traj_.size());
-        //Logger::out << "molecule[" << serial << "] = " << *it << std::endl;
-        all_molecule_traj_[serial] = *it;
+    size_t n = recv_molecule_traj_.size() / traj_record_size_;
+    if (traj_species_filter_) {
+        // 種類で絞り込んだ場合は、通し番号から位置が定まらないので、受信順に展開してから整列する
+        assert(n == all_molecule_traj_.size());
+        for (size_t i = 0; i < n; i++) {
+            unpackTrajectoryRecord(&recv_molecule_traj_[i * traj_record_size_], &all_molecule_traj_[i]);
+        }
+        std::sort(all_molecule_traj_.begin(), all_molecule_traj_.end(), lessSerial);
+        return;
+    }
+    CommMoleculeTrajData data;
+    for (size_t i = 0; i < n; i++) {
+        unpackTrajectoryRecord(&recv_molecule_traj_[i * traj_record_size_], &data);
+        size_t index = data.serial_ - caseData_->trajectory_serial_min_;
+        assert(index < all_molecule_traj_.size());
+        //Logger::out << "molecule[" << data.serial_ << "] = " << data << std::endl;
+        all_molecule_traj_[index] = data;
     }
 }
 
 void MdCommData::openOutputFiles() {
     const char *traj_file_name = caseData_->trajectory_file_path_.c_str();
     const char *energy_file_name = caseData_->energy_file_path_.c_str();
-    tfile_.open(traj_file_name, std::ios::out);
-    efile_.open(energy_file_name, std::ios::out);
-    if (!tfile_.is_open()) {
-        throw IoException(__FILE__, __LINE__, traj_file_name);
+    if (caseData_->trajectory_output_) {
+        tfile_.open(traj_file_name, std::ios::out);
+        if (!tfile_.is_open()) {
+            throw IoException(__FILE__, __LINE__, traj_file_name);
+        }
     }
+    efile_.open(energy_file_name, std::ios::out);
     if (!efile_.is_open()) {
         throw IoException(__FILE__, __LINE__, energy_file_name);
     }
 }
 
 void MdCommData::closeOutputFiles() {
-    tfile_.close();
+    if (tfile_.is_open()) {
+        tfile_.close();
+    }
     efile_.close();
 }
 
@@ -265,16 +373,46 @@ void MdCommData::writeTrajectory() {
     tfile_ << all_molecule_traj_.size() << std::endl;
     tfile_ << "# Output of mdlj\n";
     std::vector<CommMoleculeTrajData>::iterator it;
-    // 全粒子の位置・速度をシリアル番号順に、ファイルに出力する
+    // 出力する分子の位置・速度のうち指定された項目を、シリアル番号順に、ファイルに出力する
     for (it = all_molecule_traj_.begin(); it != all_molecule_traj_.end(); ++it) {
         tfile_ << LJParams::SOURCE_PARAMS_[it->kind_].label_;
-        tfile_ << " " << it->rx_ << " " << it->ry_ << " " << it->rz_;
-        tfile_ << " " << it->vx_ << " " << it->vy_ << " " << it->vz_ << std::endl;
+        if (caseData_->trajectory_positions_) {
+            tfile_ << " " << it->rx_ << " " << it->ry_ << " " << it->rz_;
+        }
+        if (caseData_->trajectory_velocities_) {
+            tfile_ << " " << it->vx_ << " " << it->vy_ << " " << it->vz_;
+        }
+        tfile_ << std::endl;
     }
 }
 
 void MdCommData::writeTotalEnergy() {
-    efile_ << caseData_->t_ << " " << total_uk_ << " " << total_up_ << " " << total_uk_ + total_up_ << std::endl;
-    total_uk_ = 0;
-    total_up_ = 0;
+    double uk = recv_energy_[ENERGY_UK];
+    double up = recv_energy_[ENERGY_UP];
+    efile_ << energy_time_ << " " << uk << " " << up << " " << uk + up << std::endl;
+}
+
+void MdCommData::writeRdf() {
+    assert(caseData_->isRootRank());
+    const char *rdf_file_name = caseData_->rdf_file_path_.c_str();
+    std::fstream rfile;
+    rfile.open(rdf_file_name, std::ios::out);
+    if (!rfile.is_open()) {
+        throw IoException(__FILE__, __LINE__, rdf_file_name);
+    }
+    double volume = caseData_->lx_ * caseData_->ly_ * caseData_->lz_;
+    rdf_.write(rfile, volume);
+    rfile.close();
+}
+
+void MdCommData::writeCorrelations() {
+    assert(caseData_->isRootRank());
+    const char *msd_file_name = caseData_->msd_file_path_.c_str();
+    std::fstream mfile;
+    mfile.open(msd_file_name, std::ios::out);
+    if (!mfile.is_open()) {
+        throw IoException(__FILE__, __LINE__, msd_file_name);
+    }
+    correlator_.write(mfile);
+    mfile.close();
 }
@@ -0,0 +1,85 @@
+#include <MdDriver_batch.h>
+#include <LJParams.h>
+#include <Logger.h>
+
+#include <sstream>
+
+void MdDriver_batch::init(CaseData *caseData, const std::vector<std::string> &state_files)
+{
+    // caseDataは初期化済みのものが渡ってくる
+    caseData_ = caseData;
+    if (caseData_->respaRequested() || caseData_->rdfRequested() || caseData_->msdRequested()
+            || caseData_->latticeRequested()) {
+        std::stringstream msg;
+        msg << "respa_inner_radius, rdf_file, msd_file and initial_lattice are not supported by the batch mode";
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+    if (caseData_->num_procs_ != 1 || caseData_->npx_ * caseData_->npy_ * caseData_->npz_ != 1) {
+        // 各レプリカは一つのプロセスで箱全体を扱う
+        std::stringstream msg;
+        msg << "the batch mode needs process_division 1 1 1, but " << caseData_->npx_ << " "
+            << caseData_->npy_ << " " << caseData_->npz_ << " was given";
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+    // トラジェクトリーに出力する分子の判定に使う
+    commData_.init(caseData_);
+    // 全レプリカの初期状態ファイルを読み込む
+    batchData_.init(caseData_, &commData_, state_files);
+    Logger::out << "MdDriver_batch::init: " << batchData_.replicaCount() << " replicas of "
+                << batchData_.getMoleculeCount() << " molecules" << std::endl;
+
+    caseData_->checkMemoryLimit(batchData_.estimateMemoryBytes());
+
+    // データ出力用ファイルをレプリカごとに開く。
+    batchData_.openOutputFiles();
+}
+
+void MdDriver_batch::doInitialStep()
+{
+    Logger::out << "MdDriver_batch::doStep  t = " << caseData_->t_ << std::endl;
+
+    // 初期状態での力を求め、速度を半分更新する
+    batchData_.calcForce();
+    batchData_.updateVelocityHalf();
+
+    // 時間発展の回が１ステップ進んだことを記録する
+    caseData_->incrementStep();
+}
+
+void MdDriver_batch::doStepWithOutput()
+{
+    Logger::out << "MdDriver_batch::doStep  t = " << caseData_->t_ << std::endl;
+
+    //a(t)とv(t)からv(t+1/2Δt)を計算し、続けて位置を更新する
+    batchData_.updateVelocityHalfAndPosition();
+
+    // 分子間力とポテンシャルエネルギーを計算する
+    batchData_.calcForce(true);
+
+    //a(t+Δt)とv(t+1/2Δt)からv(t+Δt)を計算し、運動エネルギーを集計する
+    batchData_.updateVelocityHalfAndCalcUk();
+
+    if (caseData_->trajectory_output_) {
+        batchData_.writeTrajectory();
+    }
+    batchData_.writeEnergy();
+
+    // 時間発展の回が１ステップ進んだことを記録する
+    caseData_->incrementStep();
+}
+
+void MdDriver_batch::doStepWithoutOutput()
+{
+    batchData_.updateVelocityHalfAndPosition();
+    batchData_.calcForce();
+    batchData_.updateVelocityHalf();
+
+    // 時間発展の回が１ステップ進んだことを記録する
+    caseData_->incrementStep();
+}
+
+void MdDriver_batch::finalize()
+{
+    // 出力用ファイルを一通りクローズする
+    batchData_.closeOutputFiles();
+}
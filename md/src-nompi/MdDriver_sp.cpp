@@ -1,5 +1,6 @@
 #include <MdDriver_sp.h>
 #include <string.h>
+#include <sstream>
 
 MdDriver_sp::~MdDriver_sp()
 {
@@ -15,57 +16,96 @@ void MdDriver_sp::init(CaseData *caseData)
 {
     // caseDataは初期化済みのものが渡ってくる
     caseData_ = caseData;
+    // SP版は毎ステップ全ての力で時間発展し、周辺セルも毎ステップ作り直す。
+    // 同じ計算条件ファイルでMPI版と異なる積分にならないように、それ以外の指定は受け付けない。
+    if (caseData_->respaRequested() || caseData_->skinRequested()) {
+        std::stringstream msg;
+        msg << "respa_inner_radius and skin_width are not supported by mdlj_sp";
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
     // commData（通信バッファ）を初期化する
     commData_.init(caseData);
     // communicator（通信機能）を初期化する
     communicator_.init(caseData_, &commData_);
     // 本プロセスの保持する物理計算のデータを初期化する（データファイル読み込みはここで起きる）
     procData_.init(caseData_, &commData_);
+    if (caseData_->latticeRequested()) {
+        // 生成した初期状態から重心速度を差し引く
+        double sums[MdProcData::GENERATED_SUMS];
+        procData_.sumGeneratedState(sums);
+        procData_.finishGeneratedState(sums);
+    }
 
     // SP版では常にroot rank.
     assert(caseData_->isRootRank());
+    caseData_->checkMemoryLimit(procData_.estimateMemoryBytes(true));
 
     // rootである場合はさらに、トラジェクトリーデータ受信用に
-    // 全粒子数分の配列を割当てる
-    commData_.setAllMoleculeCount(procData_.getMoleculeCount());
+    // 出力する全分子の数の分の配列を割当てる
+    commData_.setAllMoleculeCount(procData_.getTrajectoryMoleculeCount());
     // データ出力用ファイルを開く。
     commData_.openOutputFiles();
+
+    // 最初のステップの速度の更新に使う、初期状態での力を求めておく。
+    // 初期状態ファイルを読んだだけでは、粒子の加速度は定まっていない。
+    procData_.fillPeriodicGhostCells();
+    procData_.calcForce();
+    procData_.clearSurroundingCells();
 }
 
 void MdDriver_sp::doStep()
 {
     Logger::out << "MdDriver_sp::doStep  t = " << caseData_->t_ << std::endl;
 
-    //a(t)とv(t)からv(t+1/2Δt)を計算
-    procData_.updateVelocityHalf();
-    // 位置を更新する
-    procData_.updatePosition();
+    //a(t)とv(t)からv(t+1/2Δt)を計算し、続けて位置を更新する
+    procData_.updateVelocityHalfAndPosition();
 
+    // 周辺セルに移動した粒子を、周期境界の反対側の表面セルに直接移す
+    procData_.wrapExitingMolecules();
+    // 周辺セルに、反対側の表面セルの粒子の像を置く
+    procData_.fillPeriodicGhostCells();
 
+    if (commData_.rdf_.isActive() && caseData_->isOutputRound()) {
+        // 動径分布関数を集計する回は、MPI版の結果出力回と同じく、力の計算の中で組の距離を数える
+        procData_.calcForceAndUp();
+        procData_.updateVelocityHalf();
+    } else {
+        // 分子間力を計算し、力の揃ったセルから順に v(t+Δt) を計算する
+        procData_.calcForce(LJ_FORCE_FULL, true);
+    }
 
-    // HINT: some steps are skipped here. add them.
+    // 周辺セルの像は力の計算にだけ使うので、空にしておく
+    procData_.clearSurroundingCells();
 
-    // 分子間力を計算する
-    procData_.calcForce();
+    if (caseData_->trajectory_output_) {
+        // 保有している全粒子の座標データをトラジェクトリー送信バッファに転記する
+        procData_.exportTrajectoryData();
 
-    //a(t)とv(t)からv(t+1/2Δt)を計算
-    procData_.updateVelocityHalf();
-
-    // 保有している全粒子の座標データをトラジェクトリー送信バッファに転記する
-    procData_.exportTrajectoryData();
-    
-    communicator_.recvTrajectoryDataAtRoot();
-    // 全粒子分のデータをファイルに書く。
-    procData_.writeTrajectoryData();
+        communicator_.recvTrajectoryDataAtRoot();
+        // 全粒子分のデータをファイルに書く。
+        procData_.writeTrajectoryData();
+    }
 
     // 時間発展の回が１ステップ進んだことを記録する
     caseData_->incrementStep();
 
+    // MSD/VACFを集計する回次であれば、進めた後の時刻の座標と速度をサンプルとして集計する
+    if (caseData_->isCorrelationRound()) {
+        procData_.sampleCorrelations();
+    }
+
     Logger::out << "MdDriver_sp::doStep:end" << std::endl;
 }
 
 void MdDriver_sp::finalize()
 {
+    // SP版では集約するまでもなく、全分子の集計値を持っている
+    if (commData_.rdf_.isActive()) {
+        commData_.writeRdf();
+    }
+    if (commData_.correlator_.isActive()) {
+        commData_.writeCorrelations();
+    }
     // 出力用ファイルを一通りクローズする
     commData_.closeOutputFiles();
 }
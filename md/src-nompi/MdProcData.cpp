@@ -10,6 +10,7 @@
 #include <Logger.h>
 #include <iostream>
 #include <cassert>
+#include <cmath>
 
 MdProcData::MdProcData() {
     cells_ = NULL;
@@ -26,14 +27,20 @@ MdProcData::~MdProcData() {
 void MdProcData::init(CaseData *caseData, MdCommData *commData) {
     caseData_ = caseData;
     commData_ = commData;
+    // 移転で受け入れる粒子も、未使用のParticleのストックから割り当てる
+    commData_->particle_pool_ = &freeParticleList_;
     // セルを割り当てる
     allocateCells();
     // ループに使うレンジオブジェクトを一通り作成する
     initRanges();
     // 各セルを初期化する
     initCells();
-    // 初期状態ファイルを読み込む
-    readInitialStateFile();
+    // 初期状態ファイルを読み込む。格子が指定されていれば、ファイルは読まずに自プロセスの分を生成する。
+    if (caseData_->latticeRequested()) {
+        generateInitialState();
+    } else {
+        readInitialStateFile();
+    }
 }
 
 void MdProcData::allocateCells() {
@@ -198,6 +205,27 @@ void MdProcData::initRanges() {
             }
         }
     }
+
+    /*
+     * (4) 方位別の表面セル、周辺セルの添字の並びを作る
+     */
+    allSurroundingCells_.clear();
+    GridPeerIterator3d pit;
+    while (pit.next()) {
+        std::vector<int> &surface = surfaceCells_[pit.ix_][pit.iy_][pit.iz_];
+        std::vector<int> &surrounding = surroundingCells_[pit.ix_][pit.iy_][pit.iz_];
+        surface.clear();
+        surrounding.clear();
+        GridIterator3d sit(surfaceRangeFor(pit));
+        while (sit.next()) {
+            surface.push_back(cellIndexFor(sit));
+        }
+        GridIterator3d cit(surroundingRangeFor(pit));
+        while (cit.next()) {
+            surrounding.push_back(cellIndexFor(cit));
+            allSurroundingCells_.push_back(cellIndexFor(cit));
+        }
+    }
 }
 
 void MdProcData::initCells() {
@@ -221,6 +249,46 @@ void MdProcData::initCells() {
             cell->setNeighborCell(1 + ofs.ix_, 1 + ofs.iy_, 1 + ofs.iz_, neighborCell);
         }
     }
+    initCellPairs();
+}
+
+void MdProcData::initCellPairs() {
+    cellPairs_.clear();
+    const GridRange3d &r = localCellsRange_;
+    GridIterator3d it(localCellsRange_);
+    while (it.next()) {
+        Cell *cell = cellFor(it);
+        cellPairs_.push_back(CellPair(cell, cell, CELL_PAIR_SELF));
+        GridDirIterator3d ofs;
+        while (ofs.next()) {
+            GridIndex3d otherIdx = it + ofs;
+            if (isLocalCell(otherIdx)) {
+                // ローカルセル同士の組は、辞書順で後のセルの側で一度だけ処理する
+                if (ofs.lessThan(0, 0, 0)) {
+                    cellPairs_.push_back(CellPair(cell, cellFor(otherIdx), CELL_PAIR_LOCAL));
+                }
+            } else {
+                cellPairs_.push_back(CellPair(cell, cellFor(otherIdx), CELL_PAIR_SURROUNDING));
+            }
+        }
+        // このセルまでで力が揃うセルの各軸の添字は、it-1 と、上限に達している軸では it 自身
+        int xs[2], ys[2], zs[2];
+        int nx = 0, ny = 0, nz = 0;
+        if (it.ix_ > r.xmin_) xs[nx++] = it.ix_ - 1;
+        if (it.ix_ == r.xmax_) xs[nx++] = it.ix_;
+        if (it.iy_ > r.ymin_) ys[ny++] = it.iy_ - 1;
+        if (it.iy_ == r.ymax_) ys[ny++] = it.iy_;
+        if (it.iz_ > r.zmin_) zs[nz++] = it.iz_ - 1;
+        if (it.iz_ == r.zmax_) zs[nz++] = it.iz_;
+        for (int i = 0; i < nx; i++) {
+            for (int j = 0; j < ny; j++) {
+                for (int k = 0; k < nz; k++) {
+                    Cell *done = cellFor(GridIndex3d(xs[i], ys[j], zs[k]));
+                    cellPairs_.push_back(CellPair(done, done, CELL_PAIR_KICK));
+                }
+            }
+        }
+    }
 }
 
 void MdProcData::setCellIndexForPos(GridIndex3d *cellIdx, const VectorXYZ &pos) const {
@@ -232,12 +300,35 @@ void MdProcData::setCellIndexForPos(GridIndex3d *cellIdx, const VectorXYZ &pos)
     cellIdx->iz_ = 1 + floor(offset.z_ / caseData_->clz_);
 }
 
+double MdProcData::estimateMemoryBytes(bool all_trajectory) const {
+    // 周辺セルの分子の数は、全セルとローカルセルの数の比から見積もる
+    double local = (double)local_molecule_count_;
+    double local_cells = (double)caseData_->ncx_ * caseData_->ncy_ * caseData_->ncz_;
+    double ghosts = local * ((double)acx_ * acy_ * acz_ - local_cells) / local_cells;
+    double bytes = (local + ghosts) * sizeof(Particle);
+    // 周辺セルの座標の送受信バッファ、トラジェクトリーの送信バッファ
+    bytes += 2 * ghosts * sizeof(CommMoleculePosData);
+    bytes += local * commData_->traj_record_size_;
+    if (commData_->correlator_.isActive()) {
+        bytes += local * commData_->correlator_.stateSize() * sizeof(double);
+    }
+    if (all_trajectory) {
+        // 出力する全分子の配列と、rank順に受信するバッファ
+        bytes += (double)trajectory_molecule_count_ * (sizeof(CommMoleculeTrajData) + commData_->traj_record_size_);
+    }
+    return bytes;
+}
+
 void MdProcData::readInitialStateFile() {
     FileReader rdr;
     // ファイルをオープンする
     rdr.open(caseData_->initial_state_file_path_);
     // 分子の通し番号
-    int serial = 0;
+    long long serial = 0;
+    local_molecule_count_ = 0;
+    trajectory_molecule_count_ = 0;
+    // ファイルに現れた分子の種類（全rankが全分子を読むので、系全体の判定になる）
+    bool kind_seen[LJ_MOLECULE_TYPES] = {false};
     // 行がなくなると readLineは false を返す。
     while (rdr.readLine()) {
         std::string name;
@@ -246,6 +337,7 @@ void MdProcData::readInitialStateFile() {
         // 分子の名前をサポートしている分子の種類の名前の一覧から検索し、整数の分子種別番号を返す。
         // 見つからなければ DataException が挙がる。
         int kind = LJParams::nameToMoleculeKind(name.c_str());
+        kind_seen[kind] = true;
         VectorXYZ pos, vel;
         // 座標と速度を読み込む
         rdr.readDouble(pos.x_, "x");
@@ -258,40 +350,207 @@ void MdProcData::readInitialStateFile() {
         // 座標の範囲が自身のプロセス分割セルに属する場合にだけ、取り込む。
         if (caseData_->localBox_.contains(pos)) {
             // この分子は当プロセスの担当範囲に含まれる。
-            GridIndex3d cid;
-            // 座標に基づいて、データを保持すべきカットオフセルのセル座標を求める
-            setCellIndexForPos(&cid, pos);
-            // セル座標から、 cell オブジェクトを取得する
-            Cell *cell = cellFor(cid);
-            // 分子を保持する Particleオブジェクトのメモリを割り当てる
-            Particle *p = allocateParticle();
-            // 分子の情報を書き込む
-            p->kind_ = kind;                        // 種別
-            p->serial_ = serial;                    // 通し番号
-            p->pos_ = pos;                          // 初期座標
-            p->vel_dt_ = vel * caseData_->delta_t_; // 初速度
-            // cellの持つ粒子リストに追加する
-            cell->addParticle(p);
+            placeInitialParticle(kind, serial, pos, vel);
+        }
+        if (commData_->isTrajectoryMolecule(kind, serial)) {
+            trajectory_molecule_count_++;
         }
         // 粒子の通し番号をインクリメント
         serial++;
     }
     total_molecule_count_ = serial;
+    setSingleKind(kind_seen);
     // ファイルをクローズする
     rdr.close();
 }
 
-Particle *MdProcData::allocateParticle() {
-    Particle *p;
-    // 空きparticleリストに在庫があるか？
-    if (freeParticleList_.isEmpty()) {
-        // 在庫はないので新規に割り当てる。
-        p = new Particle;
-    } else {
-        // 在庫があるので、空き particle を一つ取り出す。
-        p = freeParticleList_.removeTail();
+void MdProcData::placeInitialParticle(int kind, long long serial, const VectorXYZ &pos, const VectorXYZ &vel) {
+    GridIndex3d cid;
+    // 座標に基づいて、データを保持すべきカットオフセルのセル座標を求める
+    setCellIndexForPos(&cid, pos);
+    // セル座標から、 cell オブジェクトを取得する
+    Cell *cell = cellFor(cid);
+    // 分子を保持する Particleオブジェクトのメモリを割り当てる
+    Particle *p = allocateParticle();
+    // 分子の情報を書き込む
+    p->kind_ = kind;                        // 種別
+    p->serial_ = serial;                    // 通し番号
+    p->pos_ = pos;                          // 初期座標
+    p->vel_dt_ = vel * caseData_->delta_t_; // 初速度
+    if (commData_->correlator_.isActive()) {
+        // MSD/VACFの集計用の状態を割り当てる
+        p->corr_slot_ = commData_->correlator_.allocateSlot();
     }
-    return p;
+    // cellの持つ粒子リストに追加する
+    cell->addParticle(p);
+    local_molecule_count_++;
+}
+
+void MdProcData::setSingleKind(const bool *kind_seen) {
+    // 単一種類の系であれば、力の計算と積分に種類を固定した処理を使う
+    int kinds = 0;
+    LJParams::SINGLE_KIND_ = -1;
+    for (int k = 0; k < LJ_MOLECULE_TYPES; k++) {
+        if (kind_seen[k]) {
+            kinds++;
+            LJParams::SINGLE_KIND_ = k;
+        }
+    }
+    if (kinds != 1) {
+        LJParams::SINGLE_KIND_ = -1;
+    }
+}
+
+/*
+ * 乱数の種、通し番号、用途の番号 k から決まる [0, 1) の一様乱数。
+ * 状態を持たない（splitmix64 のハッシュ関数による）ので、どのrankで、どの順に求めても同じ値になる。
+ */
+static unsigned long long mixBits(unsigned long long z) {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double uniformFor(unsigned long long seed, long long serial, int k) {
+    unsigned long long z = mixBits(mixBits(seed) + (unsigned long long)serial * 8 + k);
+    return (z >> 11) * (1.0 / 9007199254740992.0); // 上位53ビット / 2^53
+}
+
+// 標準正規分布の乱数（Box-Muller法）。用途の番号 k, k+1 の一様乱数を使う。
+static double gaussianFor(unsigned long long seed, long long serial, int k) {
+    double u1 = uniformFor(seed, serial, k);
+    double u2 = uniformFor(seed, serial, k + 1);
+    return std::sqrt(-2.0 * std::log(1.0 - u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+void MdProcData::generateInitialState() {
+    // 単位格子内の格子点（格子定数で規格化した座標）
+    static const double SC_BASIS[1][3] = { { 0, 0, 0 } };
+    static const double BCC_BASIS[2][3] = { { 0, 0, 0 }, { 0.5, 0.5, 0.5 } };
+    static const double FCC_BASIS[4][3] = { { 0, 0, 0 }, { 0.5, 0.5, 0 }, { 0.5, 0, 0.5 }, { 0, 0.5, 0.5 } };
+    const double (*basis)[3] = SC_BASIS;
+    int nb = 1;
+    if (caseData_->initial_lattice_ == "bcc") {
+        basis = BCC_BASIS;
+        nb = 2;
+    } else if (caseData_->initial_lattice_ == "fcc") {
+        basis = FCC_BASIS;
+        nb = 4;
+    }
+    double a = caseData_->lattice_constant_;
+    // 箱は単位格子の整数倍（CaseData で確認済み）
+    long long nx = (long long)floor(caseData_->lx_ / a + 0.5);
+    long long ny = (long long)floor(caseData_->ly_ / a + 0.5);
+    long long nz = (long long)floor(caseData_->lz_ / a + 0.5);
+    // 格子点が箱やセルの境界にちょうど乗らないように、a/4 だけずらしておく
+    double shift = 0.25 * a;
+
+    // 種類ごとの割合の累積
+    size_t nk = caseData_->initial_species_.size();
+    std::vector<int> kinds(nk);
+    std::vector<double> cumulative(nk);
+    double total = 0;
+    for (size_t i = 0; i < nk; i++) {
+        total += caseData_->initial_fractions_[i];
+    }
+    double sum = 0;
+    bool kind_seen[LJ_MOLECULE_TYPES] = {false};
+    for (size_t i = 0; i < nk; i++) {
+        kinds[i] = LJParams::nameToMoleculeKind(caseData_->initial_species_[i].c_str());
+        sum += caseData_->initial_fractions_[i];
+        cumulative[i] = sum / total;
+        if (caseData_->initial_fractions_[i] > 0) {
+            kind_seen[kinds[i]] = true;
+        }
+    }
+    // 種類ごとの速度の標準偏差 [m/s] を [Angstrom/fs] に直したもの
+    double sigma_v[LJ_MOLECULE_TYPES];
+    for (int k = 0; k < LJ_MOLECULE_TYPES; k++) {
+        double mass = LJParams::SOURCE_PARAMS_[k].mass_ * M_AMU;
+        sigma_v[k] = std::sqrt(K_BOLTZMANN * caseData_->initial_temperature_ / mass) * 1.0e-5;
+    }
+    unsigned long long seed = caseData_->initial_seed_;
+
+    // 担当範囲に格子点が入りうる単位格子の範囲だけをたどる
+    const BoxXYZ &box = caseData_->localBox_;
+    long long lo[3], hi[3];
+    const long long n[3] = { nx, ny, nz };
+    const double p1[3] = { box.p1_.x_, box.p1_.y_, box.p1_.z_ };
+    const double p2[3] = { box.p2_.x_, box.p2_.y_, box.p2_.z_ };
+    for (int d = 0; d < 3; d++) {
+        lo[d] = std::max(0LL, (long long)floor(p1[d] / a) - 1);
+        hi[d] = std::min(n[d] - 1, (long long)floor(p2[d] / a));
+    }
+    local_molecule_count_ = 0;
+    trajectory_molecule_count_ = 0;
+    for (long long ix = lo[0]; ix <= hi[0]; ix++) {
+        for (long long iy = lo[1]; iy <= hi[1]; iy++) {
+            for (long long iz = lo[2]; iz <= hi[2]; iz++) {
+                for (int b = 0; b < nb; b++) {
+                    VectorXYZ pos((ix + basis[b][0]) * a + shift,
+                                  (iy + basis[b][1]) * a + shift,
+                                  (iz + basis[b][2]) * a + shift);
+                    if (!box.contains(pos)) {
+                        continue;
+                    }
+                    long long serial = ((ix * ny + iy) * nz + iz) * nb + b;
+                    // 用途の番号 0 は種類、1..6 は速度の3成分
+                    double u = uniformFor(seed, serial, 0);
+                    size_t i = 0;
+                    while (i + 1 < nk && (u >= cumulative[i] || caseData_->initial_fractions_[i] == 0)) {
+                        i++;
+                    }
+                    int kind = kinds[i];
+                    VectorXYZ vel(gaussianFor(seed, serial, 1) * sigma_v[kind],
+                                  gaussianFor(seed, serial, 3) * sigma_v[kind],
+                                  gaussianFor(seed, serial, 5) * sigma_v[kind]);
+                    placeInitialParticle(kind, serial, pos, vel);
+                    if (commData_->isTrajectoryMolecule(kind, serial)) {
+                        trajectory_molecule_count_++;
+                    }
+                }
+            }
+        }
+    }
+    total_molecule_count_ = nx * ny * nz * nb;
+    setSingleKind(kind_seen);
+}
+
+void MdProcData::sumGeneratedState(double *sums) const {
+    for (int i = 0; i < GENERATED_SUMS; i++) {
+        sums[i] = 0;
+    }
+    GridIterator3d cellIt(localCellsRange_);
+    while (cellIt.next()) {
+        Cell *cell = &cells_[cellIndexFor(cellIt)];
+        for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+            double mass = LJParams::SOURCE_PARAMS_[p->kind_].mass_;
+            sums[0] += mass * p->vel_dt_.x_;
+            sums[1] += mass * p->vel_dt_.y_;
+            sums[2] += mass * p->vel_dt_.z_;
+            sums[3] += mass;
+        }
+    }
+    sums[4] = (double)trajectory_molecule_count_;
+}
+
+void MdProcData::finishGeneratedState(const double *sums) {
+    // 系全体の重心速度*Δtを、全ての分子の速度から差し引く
+    VectorXYZ vcm(sums[0] / sums[3], sums[1] / sums[3], sums[2] / sums[3]);
+    GridIterator3d cellIt(localCellsRange_);
+    while (cellIt.next()) {
+        Cell *cell = cellFor(cellIt);
+        for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+            p->vel_dt_ -= vcm;
+        }
+    }
+    trajectory_molecule_count_ = (long long)(sums[4] + 0.5);
+}
+
+Particle *MdProcData::allocateParticle() {
+    // ストックは通信データと共有しているので、割り当ての手順もそちらにまとめてある
+    return commData_->allocateParticle();
 }
 
 void MdProcData::stockAllParticlesInList(ParticleList *pList) {
@@ -301,17 +560,11 @@ void MdProcData::stockAllParticlesInList(ParticleList *pList) {
 }
 
 void MdProcData::clearSurroundingCells() {
-    // 26方位の配列座標[0,0,0]..[2,2,2]を発生するイテレータ
-    GridPeerIterator3d pit;
-    while (pit.next()) {
-        // その方位の周辺セルを定義したレンジでイテレータを初期化する
-        GridIterator3d cit(surroundingRangeFor(pit));
-        // その方位の周辺セルに属するセルに関してループ
-        while (cit.next()) {
-            Cell *cell = cellFor(cit);
-            // cellが保持している全particleを空きリストに移す
-            cell->moveAllParticlesTo(&freeParticleList_);
-        }
+    // 全方位の周辺セルに関してループ
+    for (size_t i = 0; i < allSurroundingCells_.size(); i++) {
+        Cell *cell = &cells_[allSurroundingCells_[i]];
+        // cellが保持している全particleを空きリストに移す
+        cell->moveAllParticlesTo(&freeParticleList_);
     }
 }
 
@@ -324,13 +577,20 @@ void MdProcData::exportExitingMoleculeFullData() {
         // この方位の peer buffer を取得
         MdCommPeerBuffer *peer = commData_->bufferFor(peerIt);
         assert(peer->send_count_per_cell_.empty());
-        assert(peer->send_molecule_full_.empty());
+        assert(peer->send_particles_.empty());
         // その方位の周辺セルに関してループ
-        GridIterator3d cellIt(surroundingRangeFor(peerIt));
-        while (cellIt.next()) {
-            Cell *cell = cellFor(cellIt);
-            //Logger::out << "Checking cell " << cellIt << " box : " << cell->cellBox() << std::endl;
-            // cellの保持分子をfull data送信バッファに登録
+        const std::vector<int> &cells = surroundingCellsFor(peerIt);
+        for (size_t i = 0; i < cells.size(); i++) {
+            Cell *cell = &cells_[cells[i]];
+            if (commData_->correlator_.isActive()) {
+                // 分子ごとのMSD/VACFの状態を送信する粒子と同じ順に送信バッファに詰め、スロットを返却する
+                for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+                    commData_->correlator_.packState(p->corr_slot_, peer->offset,
+                            peer->send_correlator_state_);
+                    p->corr_slot_ = -1;
+                }
+            }
+            // cellの保持分子をセルから外して送信粒子に登録
             peer->addMoleculeFullDataFrom(cell);
         }
     }
@@ -347,95 +607,216 @@ void MdProcData::importEnteringMoleculeFullData() {
         int count_index = 0;
         int data_index = 0;
         // この方位の表面セルに関してループ
-        GridIterator3d cellIt(surfaceRangeFor(peerIt));
-        while (cellIt.next()) {
+        const std::vector<int> &cells = surfaceCellsFor(peerIt);
+        for (size_t i = 0; i < cells.size(); i++) {
             // 表面セルを一つ取得
-            Cell *cell = cellFor(cellIt);
+            Cell *cell = &cells_[cells[i]];
             // このセルに格納すべき受信粒子の個数を取得
             int count_for_cell = peer->recv_count_per_cell_[count_index];
             ++count_index;
             // 粒子の個数のループの終端を算出しておく
             int data_index_end = data_index + count_for_cell;
             for (; data_index < data_index_end; ++data_index) {
-                // 受信した粒子データから一つ取得
-                CommMoleculeFullData *full = &(peer->recv_molecule_full_[data_index]);
-                // particle のメモリを割り当て、そこに情報を転記
-                Particle *p = allocateParticle();
-                p->kind_ = full->kind_;
-                p->serial_ = full->serial_;
-                p->pos_.set(full->rx_, full->ry_, full->rz_);
-                p->vel_dt_.set(full->vdtx_, full->vdty_, full->vdtz_);
+                // 受信した粒子を一つ取得（周期境界の補正は通信クラスで済んでいる）
+                Particle *p = peer->recv_particles_[data_index];
+                if (commData_->correlator_.isActive()) {
+                    int state_size = commData_->correlator_.stateSize();
+                    p->corr_slot_ = commData_->correlator_.unpackState(
+                            &peer->recv_correlator_state_[data_index * state_size]);
+                }
                 // cellにparticleを追加する
                 cell->addParticle(p);
             }
         }
-        peer->recv_molecule_full_.clear();
+        peer->recv_particles_.clear();
+        peer->recv_correlator_state_.clear();
         peer->recv_count_per_cell_.clear();
     }
 }
 
-void MdProcData::calcForce() {
+VectorXYZ MdProcData::periodicImageFor(const GridIndex3d &cellIdx, GridIndex3d *srcIdx) const {
+    assert(caseData_->num_procs_ == 1);
+    int n[3] = { caseData_->ncx_, caseData_->ncy_, caseData_->ncz_ };
+    double l[3] = { caseData_->lx_, caseData_->ly_, caseData_->lz_ };
+    int idx[3] = { cellIdx.ix_, cellIdx.iy_, cellIdx.iz_ };
+    double shift[3];
+    for (int d = 0; d < 3; d++) {
+        // 下側の周辺セル(0)は上側の表面セル(n)の像で、座標は l だけ小さい。上側はその逆。
+        shift[d] = 0;
+        if (idx[d] == 0) {
+            idx[d] = n[d];
+            shift[d] = -l[d];
+        } else if (idx[d] == n[d] + 1) {
+            idx[d] = 1;
+            shift[d] = l[d];
+        }
+    }
+    srcIdx->ix_ = idx[0];
+    srcIdx->iy_ = idx[1];
+    srcIdx->iz_ = idx[2];
+    return VectorXYZ(shift[0], shift[1], shift[2]);
+}
+
+/*
+ * 周期境界の補正量を加えた座標を、移動先のセルの半開区間 [lo, hi) に収める。
+ * 境界のわずかに外（例えば -1e-17）から折り返した座標は、丸めでちょうど hi になることがある。
+ * その場合は区間内の最大の値とし、下にはみ出した場合は lo とする（いずれも丸め誤差の大きさの移動）。
+ */
+static inline double foldIntoRange(double x, double lo, double hi) {
+    if (x >= hi) {
+        return std::nextafter(hi, lo);
+    }
+    if (x < lo) {
+        return lo;
+    }
+    return x;
+}
+
+void MdProcData::wrapExitingMolecules() {
+    MultiTauCorrelator *correlator = &commData_->correlator_;
+    GridPeerIterator3d peerIt;
+    while (peerIt.next()) {
+        GridIterator3d cellIt(surroundingRangeFor(peerIt));
+        while (cellIt.next()) {
+            Cell *cell = cellFor(cellIt);
+            if (cell->empty()) {
+                continue;
+            }
+            // 周辺セルの像の元になる表面セルに、補正量を差し引いて移す
+            GridIndex3d destIdx;
+            VectorXYZ offset = periodicImageFor(cellIt, &destIdx) * -1.0;
+            Cell *dest = cellFor(destIdx);
+            const BoxXYZ &box = dest->cellBox();
+            wrap_particles_.clear();
+            for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+                wrap_particles_.push_back(p);
+            }
+            cell->detachAllParticles();
+            for (size_t i = 0; i < wrap_particles_.size(); i++) {
+                Particle *p = wrap_particles_[i];
+                p->pos_ += offset;
+                p->pos_.set(foldIntoRange(p->pos_.x_, box.p1_.x_, box.p2_.x_),
+                            foldIntoRange(p->pos_.y_, box.p1_.y_, box.p2_.y_),
+                            foldIntoRange(p->pos_.z_, box.p1_.z_, box.p2_.z_));
+                if (correlator->isActive()) {
+                    correlator->wrapPosition(p->corr_slot_, offset);
+                }
+                dest->addParticle(p);
+            }
+        }
+    }
+}
+
+void MdProcData::fillPeriodicGhostCells() {
+    GridPeerIterator3d peerIt;
+    while (peerIt.next()) {
+        GridIterator3d cellIt(surroundingRangeFor(peerIt));
+        while (cellIt.next()) {
+            Cell *cell = cellFor(cellIt);
+            assert(cell->empty());
+            // 反対側の表面セルの粒子の座標に補正量を加えて、像を置く
+            GridIndex3d srcIdx;
+            VectorXYZ shift = periodicImageFor(cellIt, &srcIdx);
+            Cell *src = cellFor(srcIdx);
+            const BoxXYZ &box = cell->cellBox();
+            for (Particle *q = src->getParticleListHead(); q != NULL; q = q->next_) {
+                Particle *p = allocateParticle();
+                p->kind_ = q->kind_;
+                p->pos_ = q->pos_ + shift;
+                // 表面セルの上端のわずかに下の座標は、補正量を加えると丸めで周辺セルの上端に乗ることがある
+                p->pos_.set(foldIntoRange(p->pos_.x_, box.p1_.x_, box.p2_.x_),
+                            foldIntoRange(p->pos_.y_, box.p1_.y_, box.p2_.y_),
+                            foldIntoRange(p->pos_.z_, box.p1_.z_, box.p2_.z_));
+                cell->addParticle(p);
+            }
+        }
+    }
+}
+
+void MdProcData::clearForcesFor(Cell *cell, LJForceRange range) {
+    // r-RESPAの遠距離の部分は別の変数に加えるので、そちらだけを0にする
+    if (range == LJ_FORCE_OUTER) {
+        cell->clearSlowForces();
+    } else {
+        cell->clearForces();
+    }
+}
+
+void MdProcData::calcForce(LJForceRange range, bool kick) {
     // 全ローカルセルについてループ
     //Logger::out << " calc Force:start" << std::endl;
     GridIterator3d cellIt(localCellsRange_);
     while (cellIt.next()) {
         // 力計算では、各粒子に働く力の変数に、次々に加えていくので、最初に0にする。
-        cellFor(cellIt)->clearForces();
+        clearForcesFor(cellFor(cellIt), range);
     }
-    cellIt.reset();
-    while (cellIt.next()) {
-        Cell *cell = cellFor(cellIt);
-        // cellの中の粒子同士の分子間力を計算する
-        cell->calcForceWithinSelf();
-        // HINT : there are more to calculate.
-        GridDirIterator3d ofs; //offset
-        while (ofs.next()) {
-            GridIndex3d otherIdx = cellIt + ofs;
-            Cell *otherCell = cellFor(otherIdx);
-            if (isLocalCell(otherIdx)) {
-                if (ofs.lessThan(0, 0, 0)) {
-                    cell->calcForceWithLocalCell(otherCell);
-                }
-            } else {
-                cell->calcForceWithSurroundingCell(otherCell);
+    // 組の並びは initCellPairs で作ってあるので、添字の計算や判定なしに順に処理する
+    for (size_t i = 0; i < cellPairs_.size(); i++) {
+        const CellPair &cp = cellPairs_[i];
+        switch (cp.kind_) {
+        case CELL_PAIR_SELF:
+            // cellの中の粒子同士の分子間力を計算する
+            cp.cell_->calcForceWithinSelf(range);
+            break;
+        case CELL_PAIR_LOCAL:
+            cp.cell_->calcForceWithLocalCell(cp.other_, range);
+            break;
+        case CELL_PAIR_SURROUNDING:
+            cp.cell_->calcForceWithSurroundingCell(cp.other_, range);
+            break;
+        case CELL_PAIR_KICK:
+            if (kick) {
+                cp.cell_->updateVelocityHalf();
             }
+            break;
         }
     }
 }
 
 
-void MdProcData::calcForceAndUp() {
+void MdProcData::calcForceAndUp(LJForceRange range) {
+    // 動径分布関数を集計する場合は、力計算の中で組の距離を数えてもらう
+    RdfAccumulator *rdf = commData_->rdf_.isActive() ? &commData_->rdf_ : NULL;
+
     // 全ローカルセルについてループ
     GridIterator3d cellIt(localCellsRange_);
     while (cellIt.next()) {
         // 力計算では、各粒子に働く力の変数に、次々に加えていくので、最初に0にする。
-        cellFor(cellIt)->clearForces();
+        clearForcesFor(cellFor(cellIt), range);
         cellFor(cellIt)->clearUp();
+        if (rdf) {
+            // 規格化に使う分子種別の分子数を数える
+            for (Particle *p = cellFor(cellIt)->getParticleListHead(); p != NULL; p = p->next_) {
+                rdf->addMolecule(p->kind_);
+            }
+        }
     }
-    cellIt.reset();
 
-    while (cellIt.next()) {
-        Cell *cell = cellFor(cellIt);
-        // cellの中の粒子同士の分子間力を計算する
-        cell->calcForceWithinSelfAndUp();
-
-        GridDirIterator3d ofs; //offset
-        while (ofs.next()) {
-            GridIndex3d otherIdx = cellIt + ofs;
-            Cell *otherCell = cellFor(otherIdx);
-            if (isLocalCell(otherIdx)) {
-                if (ofs.lessThan(0, 0, 0)) {
-                    cell->calcForceWithLocalCellAndUp(otherCell);
-                }
-            } else {
-                cell->calcForceWithSurroundingCellAndUp(otherCell);
-            }
+    for (size_t i = 0; i < cellPairs_.size(); i++) {
+        const CellPair &cp = cellPairs_[i];
+        switch (cp.kind_) {
+        case CELL_PAIR_SELF:
+            // cellの中の粒子同士の分子間力を計算する
+            cp.cell_->calcForceWithinSelfAndUp(rdf, range);
+            break;
+        case CELL_PAIR_LOCAL:
+            cp.cell_->calcForceWithLocalCellAndUp(cp.other_, rdf, range);
+            break;
+        case CELL_PAIR_SURROUNDING:
+            cp.cell_->calcForceWithSurroundingCellAndUp(cp.other_, rdf, range);
+            break;
+        case CELL_PAIR_KICK:
+            break;
         }
     }
+    if (rdf && caseData_->isRootRank()) {
+        // サンプル数は全rankの和として集約されるので、rootだけで数える
+        rdf->endSample();
+    }
 }
 
 
-void MdProcData::updatePosition() {
+void MdProcData::updatePosition(bool rebin) {
     //Logger::out << "updatePosition" << std::endl;
     // 全ローカルセルについてループ
     GridIterator3d cellIt(localCellsRange_);
@@ -444,16 +825,171 @@ void MdProcData::updatePosition() {
         Cell *cell = cellFor(cellIt);
         cell->updatePosition();
     }
-    // 同じ範囲に対してループ
-    cellIt.reset();
+    if (!rebin) {
+        return;
+    }
     // セルから逸脱しているものを適切な隣接セルに移動させる
+    rebinParticles();
+    //Logger::out << "updatePosition:end" << std::endl;
+}
+
+
+void MdProcData::rebinParticles() {
+    // 移動先のセルの一次元添字は、移動元の添字に、隣接セルへの相対位置 (0,1,2) - 1 の
+    // 各軸の寄与を足したものになる（cellForの添字の計算と同じ並び）。
+    const int stride_x = acy_ * acz_;
+    const int stride_y = acz_;
+
+    // 1. 全ローカルセルの粒子を、セルの順、リストの順に収集する
+    rebin_particles_.clear();
+    rebin_src_.clear();
+    GridIterator3d cellIt(localCellsRange_);
     while (cellIt.next()) {
         Cell *cell = cellFor(cellIt);
-        cell->migrateToNeighbor();
+        int src = cell - cells_;
+        for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+            rebin_particles_.push_back(p);
+            rebin_src_.push_back(src);
+        }
     }
-    //Logger::out << "updatePosition:end" << std::endl;
+    int n = rebin_particles_.size();
+
+    // 2. 移動先のセルを求める。粒子ごとに独立なので、スレッドで分担できる。
+    // 所属の判定はセルの箱との比較（Cell::addParticleのassertと同じ判定）で行い、
+    // 座標の割り算による丸め誤差で、セルの境界上の粒子の所属が食い違わないようにする。
+    rebin_dest_.resize(n);
+#pragma omp parallel for if (n > 10000)
+    for (int i = 0; i < n; i++) {
+        const BoxXYZ &box = cells_[rebin_src_[i]].cellBox();
+        const VectorXYZ &pos = rebin_particles_[i]->pos_;
+        int rx = BoxXYZ::relativeIndex(pos.x_, box.p1_.x_, box.p2_.x_);
+        int ry = BoxXYZ::relativeIndex(pos.y_, box.p1_.y_, box.p2_.y_);
+        int rz = BoxXYZ::relativeIndex(pos.z_, box.p1_.z_, box.p2_.z_);
+        rebin_dest_[i] = rebin_src_[i] + (rx - 1) * stride_x + (ry - 1) * stride_y + (rz - 1);
+    }
+    relinkRebinnedParticles();
+}
+
+void MdProcData::relinkRebinnedParticles() {
+    int n = rebin_particles_.size();
+    assert(rebin_src_.size() == (size_t)n && rebin_dest_.size() == (size_t)n);
+
+    // 3. 移動先のセルごとの粒子数のヒストグラムを作り、累積和から各セルの開始位置を求める
+    int num_cells = acx_ * acy_ * acz_;
+    rebin_start_.assign(num_cells + 1, 0);
+    for (int i = 0; i < n; i++) {
+        rebin_start_[rebin_dest_[i] + 1]++;
+    }
+    for (int c = 0; c < num_cells; c++) {
+        rebin_start_[c + 1] += rebin_start_[c];
+    }
+
+    // 4. 移動先のセル順に並べる。セルの中では、留まった粒子を元の順に並べた後に、
+    // 移ってきた粒子を移動元のセルの順に並べる（セルごとに移動させる場合と同じ順になる）。
+    rebin_sorted_.resize(n);
+    rebin_fill_.assign(rebin_start_.begin(), rebin_start_.end() - 1);
+    for (int i = 0; i < n; i++) {
+        if (rebin_dest_[i] == rebin_src_[i]) {
+            rebin_sorted_[rebin_fill_[rebin_dest_[i]]++] = rebin_particles_[i];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (rebin_dest_[i] != rebin_src_[i]) {
+            rebin_sorted_[rebin_fill_[rebin_dest_[i]]++] = rebin_particles_[i];
+        }
+    }
+
+    // 5. ローカルセルの粒子リストを空にしてから、各セルの粒子リストを組み直す。
+    // 周辺セルには、移ってきた粒子が追加される。セルごとに独立なので、スレッドで分担できる。
+    GridIterator3d cellIt(localCellsRange_);
+    while (cellIt.next()) {
+        cellFor(cellIt)->detachAllParticles();
+    }
+#pragma omp parallel for if (n > 10000)
+    for (int c = 0; c < num_cells; c++) {
+        Cell *cell = &cells_[c];
+        for (int k = rebin_start_[c]; k < rebin_start_[c + 1]; k++) {
+            cell->addParticle(rebin_sorted_[k]);
+        }
+    }
+}
+
+
+bool MdProcData::updateVelocityHalfAndPosition(bool rebuild) {
+    GridIterator3d cellIt(localCellsRange_);
+    if (!rebuild) {
+        // 再構築の間の回は粒子をセルに残すので、表面セルの座標はこの走査の中で送信バッファに詰める。
+        // 方位ごとの並びは、exportSurfacingMoleculePosData と同じく表面セルの辞書順になる。
+        // スキンの幅の半分を超えてはみ出した分子がみつかったら、以降のセルは位置の更新だけを行う。
+        double margin = caseData_->skin_width_ * 0.5;
+        const GridRange3d &r = localCellsRange_;
+        bool inside = true;
+        while (cellIt.next()) {
+            Cell *cell = cellFor(cellIt);
+            inside = cell->updateVelocityHalfAndPosition(margin) && inside;
+            if (!inside) {
+                continue;
+            }
+            // 各軸で、中央(1)と、表面にあればその側(0か2)の方位の送信先に詰める
+            int ds[3][3], nd[3];
+            const int idx[3] = { cellIt.ix_, cellIt.iy_, cellIt.iz_ };
+            const int lo[3] = { r.xmin_, r.ymin_, r.zmin_ };
+            const int hi[3] = { r.xmax_, r.ymax_, r.zmax_ };
+            for (int a = 0; a < 3; a++) {
+                nd[a] = 0;
+                ds[a][nd[a]++] = 1;
+                if (idx[a] == lo[a]) ds[a][nd[a]++] = 0;
+                if (idx[a] == hi[a]) ds[a][nd[a]++] = 2;
+            }
+            for (int i = 0; i < nd[0]; i++) {
+                for (int j = 0; j < nd[1]; j++) {
+                    for (int k = 0; k < nd[2]; k++) {
+                        if (i == 0 && j == 0 && k == 0) {
+                            continue; // 中央の方位はない
+                        }
+                        MdCommPeerBuffer *peer = commData_->bufferFor(GridIndex3d(ds[0][i], ds[1][j], ds[2][k]));
+                        addSurfacingMoleculePosData(peer, cell, margin);
+                    }
+                }
+            }
+        }
+        return inside;
+    }
+
+    // 速度と位置の更新と、移動先のセルの判定を、全ローカルセルの粒子について一度に行う。
+    // 判定は rebinParticles と同じく、セルの箱との比較による。
+    const int stride_x = acy_ * acz_;
+    const int stride_y = acz_;
+    rebin_particles_.clear();
+    rebin_src_.clear();
+    rebin_dest_.clear();
+    while (cellIt.next()) {
+        Cell *cell = cellFor(cellIt);
+        int src = cell - cells_;
+        const BoxXYZ &box = cell->cellBox();
+        for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+            p->vel_dt_ += p->a_dt2_half_;
+            p->pos_ += p->vel_dt_;
+            int rx = BoxXYZ::relativeIndex(p->pos_.x_, box.p1_.x_, box.p2_.x_);
+            int ry = BoxXYZ::relativeIndex(p->pos_.y_, box.p1_.y_, box.p2_.y_);
+            int rz = BoxXYZ::relativeIndex(p->pos_.z_, box.p1_.z_, box.p2_.z_);
+            rebin_particles_.push_back(p);
+            rebin_src_.push_back(src);
+            rebin_dest_.push_back(src + (rx - 1) * stride_x + (ry - 1) * stride_y + (rz - 1));
+        }
+    }
+    relinkRebinnedParticles();
+    return true;
 }
 
+void MdProcData::abandonHaloRefresh() {
+    GridPeerIterator3d peerIt;
+    while (peerIt.next()) {
+        commData_->bufferFor(peerIt)->clearSendMoleculePosBuffer();
+    }
+    clearSurroundingCells();
+    rebinParticles();
+}
 
 //added
 void MdProcData::updateVelocityHalf() {
@@ -468,6 +1004,15 @@ void MdProcData::updateVelocityHalf() {
     //Logger::out << "updateVelocityHalf:end" << std::endl;
 }
 
+void MdProcData::updateVelocitySlow() {
+    // 遠距離の部分の力は respa_steps_ ステップに一回だけ計算するので、その分の時間の半分だけ更新する
+    double steps = caseData_->respa_steps_;
+    GridIterator3d cellIt(localCellsRange_);
+    while (cellIt.next()) {
+        cellFor(cellIt)->updateVelocitySlow(steps);
+    }
+}
+
 void MdProcData::updateVelocityHalfAndCalcUk() {
     //Logger::out << "updateVelocityHalf" << std::endl;
     // 全ローカルセルについてループ
@@ -481,6 +1026,19 @@ void MdProcData::updateVelocityHalfAndCalcUk() {
 }
 
 
+void MdProcData::sampleCorrelations() {
+    MultiTauCorrelator *correlator = &commData_->correlator_;
+    assert(correlator->isActive());
+    double inv_delta_t = 1.0 / caseData_->delta_t_;
+    GridIterator3d cellIt(localCellsRange_);
+    while (cellIt.next()) {
+        Cell *cell = cellFor(cellIt);
+        for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+            correlator->sample(p->corr_slot_, p->pos_, p->vel_dt_ * inv_delta_t);
+        }
+    }
+}
+
 void MdProcData::exportTrajectoryData() {
     //Logger::out << "exportTrajectoryData" << std::endl;
     // 全ローカルセルについてループ
@@ -502,14 +1060,17 @@ void MdProcData::writeTrajectoryData() {
 
 void MdProcData::exportEnergyData() {
     GridIterator3d cellIt(localCellsRange_);
-    commData_->send_uk_ = 0;
-    commData_->send_up_ = 0;
+    double uk = 0;
+    double up = 0;
     while (cellIt.next()) {
         Cell *cell = cellFor(cellIt);
-        commData_->send_uk_ += cell->get_uk();
-        commData_->send_up_ += cell->get_up();
+        uk += cell->get_uk();
+        up += cell->get_up();
     }
-    //Logger::out << "MdProcData::exportEnergyData: " << commData_->send_uk_ << "," << commData_->send_up_ << std::endl;
+    commData_->send_energy_[ENERGY_UK] = uk;
+    commData_->send_energy_[ENERGY_UP] = up;
+    commData_->energy_time_ = caseData_->t_;
+    //Logger::out << "MdProcData::exportEnergyData: " << uk << "," << up << std::endl;
 }
 
 void MdProcData::writeEnergyData() {
@@ -518,8 +1079,9 @@ void MdProcData::writeEnergyData() {
     commData_->writeTotalEnergy();
 }
 
-void MdProcData::exportSurfacingMoleculePosData() {
+void MdProcData::exportSurfacingMoleculePosData(bool refresh) {
     //Logger::out << "MdProcData::exportSurfacingMoleculePosData" << std::endl;
+    double margin = refresh ? caseData_->skin_width_ * 0.5 : 0;
     // 26方位の配列座標[0,0,0]..[2,2,2]を発生するイテレータ
     GridPeerIterator3d peerIt;
     while (peerIt.next()) {
@@ -528,18 +1090,30 @@ void MdProcData::exportSurfacingMoleculePosData() {
         MdCommPeerBuffer *peer = commData_->bufferFor(peerIt);
         assert(peer->send_count_per_cell_.empty());
         assert(peer->send_molecule_pos_.empty());
-        // その方位の周辺セルに関してループ
-        GridIterator3d cellIt(surfaceRangeFor(peerIt));
-        while (cellIt.next()) {
-            Cell *cell = cellFor(cellIt);
-            //Logger::out << "Checking cell " << cellIt << " box : " << cell->cellBox() << std::endl;
+        // その方位の表面セルに関してループ
+        const std::vector<int> &cells = surfaceCellsFor(peerIt);
+        for (size_t i = 0; i < cells.size(); i++) {
+            Cell *cell = &cells_[cells[i]];
             // cellの保持分子をpos data送信バッファに登録
-            peer->addMoleculePosDataFrom(cell);
+            addSurfacingMoleculePosData(peer, cell, margin);
         }
     }
     //Logger::out << "MdProcData::exportSurfacingMoleculePosData end" << std::endl;
 }
 
+void MdProcData::addSurfacingMoleculePosData(MdCommPeerBuffer *peer, Cell *cell, double margin) {
+#ifndef NDEBUG
+    // 再構築の間に、スキンの幅の半分を超えて動いた分子があってはならない
+    const BoxXYZ &box = cell->cellBox();
+    for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+        assert(p->pos_.x_ >= box.p1_.x_ - margin && p->pos_.x_ < box.p2_.x_ + margin);
+        assert(p->pos_.y_ >= box.p1_.y_ - margin && p->pos_.y_ < box.p2_.y_ + margin);
+        assert(p->pos_.z_ >= box.p1_.z_ - margin && p->pos_.z_ < box.p2_.z_ + margin);
+    }
+#endif
+    peer->addMoleculePosDataFrom(cell, margin);
+}
+
 
 void MdProcData::importSurroundingMoleculePosData() {
     //Logger::out << "MdProcData::importSurroundingMoleculePosData" << std::endl;
@@ -550,11 +1124,16 @@ void MdProcData::importSurroundingMoleculePosData() {
         MdCommPeerBuffer *peer = commData_->bufferFor(peerIt);
         int count_index = 0;
         int data_index = 0;
-        // この方位の表面セルに関してループ
-        GridIterator3d cellIt(surroundingRangeFor(peerIt));
-        while (cellIt.next()) {
-            // 表面セルを一つ取得
-            Cell *cell = cellFor(cellIt);
+        // この方位の周辺セルに関してループ
+        const std::vector<int> &cells = surroundingCellsFor(peerIt);
+        for (size_t i = 0; i < cells.size(); i++) {
+            // 周辺セルを一つ取得
+            Cell *cell = &cells_[cells[i]];
+            // 受信した座標は、このセルの原点からの相対位置
+            const BoxXYZ &box = cell->cellBox();
+            double lx = box.p2_.x_ - box.p1_.x_;
+            double ly = box.p2_.y_ - box.p1_.y_;
+            double lz = box.p2_.z_ - box.p1_.z_;
             // このセルに格納すべき受信粒子の個数を取得
             int count_for_cell = peer->recv_count_per_cell_[count_index];
             ++count_index;
@@ -566,7 +1145,9 @@ void MdProcData::importSurroundingMoleculePosData() {
                 // particle のメモリを割り当て、そこに情報を転記
                 Particle *p = allocateParticle();
                 p->kind_ = pos->kind_;
-                p->pos_.set(pos->rx_, pos->ry_, pos->rz_);
+                p->pos_.set(CommMoleculePosData::dequantize(pos->qx_, box.p1_.x_, lx),
+                            CommMoleculePosData::dequantize(pos->qy_, box.p1_.y_, ly),
+                            CommMoleculePosData::dequantize(pos->qz_, box.p1_.z_, lz));
                 // cellにparticleを追加する
                 cell->addParticle(p);
             }
@@ -576,3 +1157,35 @@ void MdProcData::importSurroundingMoleculePosData() {
     }
     //Logger::out << "MdProcData::importSurroundingMoleculePosData end" << std::endl;
 }
+
+void MdProcData::refreshSurroundingMoleculePosData() {
+    // exportSurfacingMoleculePosData(true) と同じ範囲で逆変換する
+    double margin = caseData_->skin_width_ * 0.5;
+    GridPeerIterator3d peerIt;
+    while (peerIt.next()) {
+        MdCommPeerBuffer *peer = commData_->bufferFor(peerIt);
+        size_t data_index = 0;
+        const std::vector<int> &cells = surroundingCellsFor(peerIt);
+        for (size_t i = 0; i < cells.size(); i++) {
+            Cell *cell = &cells_[cells[i]];
+            const BoxXYZ &box = cell->cellBox();
+            VectorXYZ lo(box.p1_.x_ - margin, box.p1_.y_ - margin, box.p1_.z_ - margin);
+            double lx = box.p2_.x_ - box.p1_.x_ + 2 * margin;
+            double ly = box.p2_.y_ - box.p1_.y_ + 2 * margin;
+            double lz = box.p2_.z_ - box.p1_.z_ + 2 * margin;
+            for (Particle *p = cell->getParticleListHead(); p != NULL; p = p->next_) {
+                assert(data_index < peer->recv_molecule_pos_.size());
+                const CommMoleculePosData *pos = &(peer->recv_molecule_pos_[data_index]);
+                ++data_index;
+                assert(pos->kind_ == p->kind_);
+                p->pos_.set(CommMoleculePosData::dequantize(pos->qx_, lo.x_, lx),
+                            CommMoleculePosData::dequantize(pos->qy_, lo.y_, ly),
+                            CommMoleculePosData::dequantize(pos->qz_, lo.z_, lz));
+            }
+        }
+        // 再構築の回から、相手の表面セルの分子の数は変わらない
+        assert(data_index == peer->recv_molecule_pos_.size());
+        peer->recv_molecule_pos_.clear();
+        peer->recv_count_per_cell_.clear();
+    }
+}
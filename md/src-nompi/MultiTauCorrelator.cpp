@@ -0,0 +1,170 @@
+/*
+ * MultiTauCorrelator.cpp
+ *
+ */
+
+#include <MultiTauCorrelator.h>
+
+#include <cstring>
+
+/*
+ * スロット内の各段のデータの並び
+ *   [0] 最新のサンプルを格納したシフトレジスタの位置
+ *   [1] シフトレジスタに格納済みのサンプル数（最大 points_）
+ *   [2] 次の段に送る平均値を求めるために積算したサンプル数
+ *   [3..8] 同上の積算値 (x, y, z, vx, vy, vz)
+ *   [9..]  シフトレジスタ。一点あたり (x, y, z, vx, vy, vz)
+ * スロットの先頭の3個は、周期境界で折り返された座標に加えると折り返す前の座標になる補正量。
+ */
+static const int LEVEL_HEAD = 0;
+static const int LEVEL_FILLED = 1;
+static const int LEVEL_ACCUM_COUNT = 2;
+static const int LEVEL_ACCUM = 3;
+static const int LEVEL_REGISTER = 9;
+
+void MultiTauCorrelator::init(int levels, int points, double sample_dt) {
+    assert(levels > 0);
+    assert(points >= 2 && points % 2 == 0);
+    levels_ = levels;
+    points_ = points;
+    sample_dt_ = sample_dt;
+    state_size_ = levelBase(levels_);
+    pool_.clear();
+    free_slots_.clear();
+    data_.assign(3 * levels_ * points_, 0);
+}
+
+int MultiTauCorrelator::allocateSlot() {
+    int slot;
+    if (free_slots_.empty()) {
+        slot = (int)(pool_.size() / state_size_);
+        pool_.resize(pool_.size() + state_size_);
+    } else {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    double *state = stateFor(slot);
+    std::memset(state, 0, sizeof(double) * state_size_);
+    for (int l = 0; l < levels_; l++) {
+        // 最初のサンプルがシフトレジスタの位置0に入るようにしておく
+        state[levelBase(l) + LEVEL_HEAD] = points_ - 1;
+    }
+    return slot;
+}
+
+void MultiTauCorrelator::freeSlot(int slot) {
+    assert(slot >= 0);
+    free_slots_.push_back(slot);
+}
+
+void MultiTauCorrelator::packState(int slot, const VectorXYZ &offset, std::vector<double> &buf) {
+    double *state = stateFor(slot);
+    size_t top = buf.size();
+    buf.insert(buf.end(), state, state + state_size_);
+    buf[top + 0] -= offset.x_;
+    buf[top + 1] -= offset.y_;
+    buf[top + 2] -= offset.z_;
+    freeSlot(slot);
+}
+
+int MultiTauCorrelator::unpackState(const double *src) {
+    int slot = allocateSlot();
+    std::memcpy(stateFor(slot), src, sizeof(double) * state_size_);
+    return slot;
+}
+
+void MultiTauCorrelator::wrapPosition(int slot, const VectorXYZ &offset) {
+    double *state = stateFor(slot);
+    state[0] -= offset.x_;
+    state[1] -= offset.y_;
+    state[2] -= offset.z_;
+}
+
+void MultiTauCorrelator::sample(int slot, const VectorXYZ &pos, const VectorXYZ &vel) {
+    double *state = stateFor(slot);
+    double xv[6];
+    xv[0] = pos.x_ + state[0];
+    xv[1] = pos.y_ + state[1];
+    xv[2] = pos.z_ + state[2];
+    xv[3] = vel.x_;
+    xv[4] = vel.y_;
+    xv[5] = vel.z_;
+    push(state, 0, xv);
+}
+
+void MultiTauCorrelator::push(double *state, int level, const double *xv) {
+    double *lv = state + levelBase(level);
+    double *reg = lv + LEVEL_REGISTER;
+    int head = ((int)lv[LEVEL_HEAD] + 1) % points_;
+    int filled = (int)lv[LEVEL_FILLED];
+    if (filled < points_) {
+        filled++;
+    }
+    lv[LEVEL_HEAD] = head;
+    lv[LEVEL_FILLED] = filled;
+    double *e = reg + head * 6;
+    for (int k = 0; k < 6; k++) {
+        e[k] = xv[k];
+    }
+
+    // 新しいサンプルと、シフトレジスタ内の過去のサンプルとの相関を集計する
+    double *msd_sum = &data_[level * points_];
+    double *vacf_sum = &data_[levels_ * points_ + level * points_];
+    double *counts = &data_[2 * levels_ * points_ + level * points_];
+    int jmin = (level == 0) ? 0 : points_ / 2;
+    for (int j = jmin; j < filled; j++) {
+        const double *o = reg + ((head - j + points_) % points_) * 6;
+        double dx = xv[0] - o[0];
+        double dy = xv[1] - o[1];
+        double dz = xv[2] - o[2];
+        msd_sum[j] += dx * dx + dy * dy + dz * dz;
+        vacf_sum[j] += xv[3] * o[3] + xv[4] * o[4] + xv[5] * o[5];
+        counts[j] += 1;
+    }
+
+    // 2サンプルごとに平均を次の段に送る
+    if (level + 1 < levels_) {
+        double *acc = lv + LEVEL_ACCUM;
+        for (int k = 0; k < 6; k++) {
+            acc[k] += xv[k];
+        }
+        lv[LEVEL_ACCUM_COUNT] += 1;
+        if (lv[LEVEL_ACCUM_COUNT] == 2) {
+            double avg[6];
+            for (int k = 0; k < 6; k++) {
+                avg[k] = acc[k] * 0.5;
+                acc[k] = 0;
+            }
+            lv[LEVEL_ACCUM_COUNT] = 0;
+            push(state, level + 1, avg);
+        }
+    }
+}
+
+void MultiTauCorrelator::clear() {
+    data_.assign(data_.size(), 0);
+}
+
+double MultiTauCorrelator::msd(int level, int j) const {
+    double n = count(level, j);
+    return (n > 0) ? data_[level * points_ + j] / n : 0;
+}
+
+double MultiTauCorrelator::vacf(int level, int j) const {
+    double n = count(level, j);
+    return (n > 0) ? data_[levels_ * points_ + level * points_ + j] / n : 0;
+}
+
+void MultiTauCorrelator::write(std::ostream &os) const {
+    os << "# lag_time[fs] msd[Angstrom^2] vacf[Angstrom^2*fs^-2] samples" << std::endl;
+    for (int l = 0; l < levels_; l++) {
+        int jmin = (l == 0) ? 0 : points_ / 2;
+        for (int j = jmin; j < points_; j++) {
+            if (count(l, j) == 0) {
+                continue;
+            }
+            os << lagTime(l, j) << " " << msd(l, j) << " " << vacf(l, j)
+               << " " << count(l, j) << std::endl;
+        }
+    }
+}
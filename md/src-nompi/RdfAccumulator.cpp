@@ -0,0 +1,69 @@
+/*
+ * RdfAccumulator.cpp
+ *
+ */
+
+#include <RdfAccumulator.h>
+
+#include <cmath>
+
+void RdfAccumulator::init(int nbins, double cutoff_radius) {
+    assert(nbins > 0);
+    assert(cutoff_radius > 0);
+    nbins_ = nbins;
+    r2_max_ = cutoff_radius * cutoff_radius;
+    bins_per_r2_ = nbins_ / r2_max_;
+    data_.assign(PAIR_TYPES * nbins_ + LJ_MOLECULE_TYPES + 1, 0);
+}
+
+void RdfAccumulator::clear() {
+    data_.assign(data_.size(), 0);
+}
+
+double RdfAccumulator::rLower(int bin) const {
+    return std::sqrt(bin / bins_per_r2_);
+}
+
+double RdfAccumulator::rUpper(int bin) const {
+    return std::sqrt((bin + 1) / bins_per_r2_);
+}
+
+void RdfAccumulator::write(std::ostream &os, double volume) const {
+    long long samples = sampleCount();
+    // 出力する組み合わせと、その組み合わせの一様分布での組の数密度 [Angstrom^-3] を求めておく
+    std::vector<int> ki_list, kj_list;
+    std::vector<double> density;
+    for (int ki = 0; ki < LJ_MOLECULE_TYPES; ki++) {
+        for (int kj = ki; kj < LJ_MOLECULE_TYPES; kj++) {
+            if (moleculeCount(ki) == 0 || moleculeCount(kj) == 0) {
+                continue;
+            }
+            double ni = (double)moleculeCount(ki) / samples;
+            double nj = (double)moleculeCount(kj) / samples;
+            double pairs = (ki == kj) ? ni * (ni - 1) / 2 : ni * nj;
+            ki_list.push_back(ki);
+            kj_list.push_back(kj);
+            density.push_back(pairs / volume);
+        }
+    }
+
+    os << "# radial distribution function, samples = " << samples << std::endl;
+    os << "# r_lower r_upper";
+    for (size_t i = 0; i < ki_list.size(); i++) {
+        os << " " << LJParams::SOURCE_PARAMS_[ki_list[i]].label_
+           << "-" << LJParams::SOURCE_PARAMS_[kj_list[i]].label_;
+    }
+    os << std::endl;
+    for (int bin = 0; bin < nbins_; bin++) {
+        double rl = rLower(bin);
+        double ru = rUpper(bin);
+        double shell = 4.0 / 3.0 * M_PI * (ru * ru * ru - rl * rl * rl);
+        os << rl << " " << ru;
+        for (size_t i = 0; i < ki_list.size(); i++) {
+            double expected = density[i] * shell * samples;
+            double g = (expected > 0) ? pairCount(ki_list[i], kj_list[i], bin) / expected : 0;
+            os << " " << g;
+        }
+        os << std::endl;
+    }
+}
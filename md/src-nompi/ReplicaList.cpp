@@ -0,0 +1,53 @@
+/*
+ * ReplicaList.cpp
+ *
+ */
+
+#include <ReplicaList.h>
+#include <FileReader.h>
+
+void ReplicaList::read(const char *file_name) {
+    procs_.clear();
+    first_rank_.clear();
+    case_files_.clear();
+    total_procs_ = 0;
+
+    FileReader rdr;
+    rdr.open(file_name);
+    while (rdr.readLine()) {
+        std::string word;
+        if (!rdr.readWord(word) || word[0] == '#') {
+            continue; // 空行、注釈
+        }
+        std::stringstream ss(word);
+        int procs;
+        ss >> procs;
+        if (ss.fail() || !ss.eof() || procs <= 0) {
+            std::stringstream msg;
+            msg << "number of processes should be positive, but \"" << word << "\" was found in " << file_name;
+            throw DataException(__FILE__, __LINE__, msg.str());
+        }
+        std::string case_file;
+        rdr.readString(case_file, "case file");
+        procs_.push_back(procs);
+        first_rank_.push_back(total_procs_);
+        case_files_.push_back(case_file);
+        total_procs_ += procs;
+    }
+    rdr.close();
+
+    if (procs_.empty()) {
+        std::stringstream msg;
+        msg << "no replica was found in " << file_name;
+        throw DataException(__FILE__, __LINE__, msg.str());
+    }
+}
+
+int ReplicaList::replicaForRank(int rank) const {
+    assert(rank >= 0 && rank < total_procs_);
+    int replica = size() - 1;
+    while (first_rank_[replica] > rank) {
+        replica--;
+    }
+    return replica;
+}
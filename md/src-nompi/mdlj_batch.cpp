@@ -0,0 +1,78 @@
+/*
+ * mdlj_batch.cpp
+ *
+ * バッチ版のメインルーチン
+ *
+ * MPIなしで動作させる。同じ計算条件の小さな系のレプリカを、一つのプロセスでまとめて時間発展させる。
+ * パラメタのフィッティングのための、多数の短いサンプリング計算に使う。
+ *
+ * 使い方: mdlj_batch 計算条件ファイル [初期状態ファイル...]
+ * 初期状態ファイルを省略した場合は、計算条件ファイルの initial_state_file の一つだけとなる。
+ * レプリカ r の出力ファイルは、計算条件ファイルの trajectory_file, energy_file の
+ * 拡張子の前に ".r" を付けたもの（MdBatchData::outputPathFor参照）。
+ */
+
+#include <LJParams.h>
+#include <MdDriver_batch.h>
+#include <Logger.h>
+
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+
+    try {
+
+        int my_rank = 0;
+        int num_procs = 1;
+        // MPIライブラリは呼ばない
+
+        /* デバッグ用のログファイルを開く。rank別のファイルが作成される。*/
+        Logger::openLog("mdlj_batch", my_rank);
+
+        /* 計算条件オブジェクトを作成する */
+        /* 引数の数が間違っていたらエラー出力して終了させるべきところ。 */
+        CaseData caseData;
+        // 次の行では、引数は必ず指定されているものとしてコーディングしている
+        caseData.init(argv[1], my_rank, num_procs);
+
+        // 計算条件ファイルの内容も加味してLJのパラメータや、一部のループ不変量を計算する。
+        LJParams::initParams(&caseData);
+
+        std::vector<std::string> state_files;
+        for (int i = 2; i < argc; i++) {
+            state_files.push_back(argv[i]);
+        }
+        if (state_files.empty()) {
+            state_files.push_back(caseData.initial_state_file_path_);
+        }
+
+        // ドライバーオブジェクトを初期化する。
+        MdDriver_batch driver;
+        driver.init(&caseData, state_files);
+
+        // 時間発展ループ本体。回次の進め方はマルチプロセス版（mdlj.cpp）と同じ。
+        while (caseData.shouldProceed()) {
+            if (caseData.step_count_ == 0) {
+                driver.doInitialStep();
+            }
+
+            if (caseData.step_count_ % caseData.output_interval_ == 0) { //結果出力回
+                driver.doStepWithOutput();
+            } else { //結果出力回でない
+                driver.doStepWithoutOutput();
+            }
+        }
+
+        // ドライバーに終了処理をさせる
+        driver.finalize();
+
+        // ログをクローズする
+        Logger::closeLog();
+    } catch (IoException &exp) {
+        std::cerr << exp << std::endl;
+    } catch (DataException &exp) {
+        std::cerr << exp << std::endl;
+    }
+
+    return 0;
+}
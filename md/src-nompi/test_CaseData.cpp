@@ -9,6 +9,8 @@
 #include <TestBase.h>
 #include <CaseData.h>
 
+#include <vector>
+
 /*
  * Tester class for CaseData
  */
@@ -23,6 +25,8 @@ public:
     void setup();
     void testBox();
     void testRank();
+    void testOptions();
+    void testNodePlacement();
     void run();
 };
 
@@ -58,11 +62,132 @@ void TestCaseData::testRank()
     }
 }
 
+void TestCaseData::testOptions()
+{
+    // 省略可能な項目が省略された場合の値
+    test_true(caseData_.trajectory_output_);
+    test_false(caseData_.rdfRequested());
+    test_false(caseData_.msdRequested());
+
+    CaseData options;
+    options.init("testdata/casedata/case_options.txt", 0, 27);
+    test_false(options.trajectory_output_);
+    test_true(options.rdfRequested());
+    test_true(options.rdf_file_path_ == "rdf.txt");
+    int_equals(options.rdf_bins_, 50);
+    test_true(options.msdRequested());
+    test_true(options.msd_file_path_ == "msd.txt");
+    int_equals(options.msd_levels_, 6);
+    int_equals(options.msd_points_, 10);
+    int_equals(options.msd_interval_, 4);
+    dbl_equals(options.cutoff_radius_, 3);
+    test_false(caseData_.node_placement_);
+    test_true(options.node_placement_);
+    test_true(caseData_.shared_memory_halo_);
+    test_false(options.shared_memory_halo_);
+    test_false(caseData_.rma_halo_);
+    test_true(options.rma_halo_);
+    test_false(caseData_.respaRequested());
+    int_equals(caseData_.respa_steps_, 1);
+    test_true(options.respaRequested());
+    dbl_equals(options.respa_inner_radius_, 2);
+    dbl_equals(options.respa_switch_width_, 0.5);
+    int_equals(options.respa_steps_, 5);
+    test_false(caseData_.skinRequested());
+    test_true(caseData_.isRebuildRound());
+    test_true(options.skinRequested());
+    dbl_equals(options.skin_width_, 1.5);
+    int_equals(options.rebuild_interval_, 4);
+    test_true(options.isRebuildRound());
+    options.incrementStep();
+    test_false(options.isRebuildRound());
+    // スキンを超えた分子による再構築の後は、その回から数え直す
+    options.incrementStep();
+    options.restartRebuildInterval();
+    test_true(options.isRebuildRound());
+    options.incrementStep();
+    options.incrementStep();
+    options.incrementStep();
+    test_false(options.isRebuildRound());
+    options.incrementStep();
+    test_true(options.isRebuildRound());
+    test_true(caseData_.trajectory_positions_ && caseData_.trajectory_velocities_);
+    test_false(caseData_.trajectory_float_);
+    test_true(caseData_.trajectory_serial_min_ == 0 && caseData_.trajectory_serial_max_ == -1);
+    test_true(caseData_.trajectory_species_.empty());
+    test_false(options.trajectory_positions_);
+    test_true(options.trajectory_velocities_);
+    test_true(options.trajectory_float_);
+    test_true(options.trajectory_serial_min_ == 10 && options.trajectory_serial_max_ == 3000000000LL);
+    size_equals(options.trajectory_species_.size(), (size_t)2);
+    test_true(options.trajectory_species_[1] == "Ar");
+    test_false(caseData_.latticeRequested());
+    test_true(options.latticeRequested());
+    test_true(options.initial_lattice_ == "bcc");
+    dbl_equals(options.lattice_constant_, 5);
+    size_equals(options.initial_species_.size(), (size_t)2);
+    test_true(options.initial_species_[0] == "He");
+    dbl_equals(options.initial_fractions_[1], 3);
+    dbl_equals(options.initial_temperature_, 300);
+    test_true(options.initial_seed_ == 42);
+    dbl_equals(caseData_.memory_limit_mb_, 0);
+    dbl_equals(options.memory_limit_mb_, 64);
+    // 上限の指定がなければ検査しない
+    caseData_.checkMemoryLimit(1.0e18);
+    options.checkMemoryLimit(64.0 * 1024 * 1024);
+    bool thrown = false;
+    try {
+        options.checkMemoryLimit(65.0 * 1024 * 1024);
+    } catch (DataException &exp) {
+        thrown = true;
+    }
+    test_true(thrown);
+}
+
+void TestCaseData::testNodePlacement()
+{
+    CaseData grid;
+    grid.init("testdata/casedata/case.txt", 0, 27);
+    // 3x3x3 を 9 プロセスのノードで分けるなら、表面積の最も小さい 1x3x3 の板
+    GridIndex3d block;
+    test_true(grid.findNodeBlock(9, &block));
+    i3d_equals(block, GridIndex3d(1, 3, 3));
+    test_true(grid.findNodeBlock(27, &block));
+    i3d_equals(block, GridIndex3d(3, 3, 3));
+    // 4 プロセスのノードでは割り切れない
+    test_false(grid.findNodeBlock(4, &block));
+
+    // ノード1のローカル4番目は、x=1 の板の (y,z) = (1,1)
+    GridIndex3d idx;
+    test_true(grid.setProcessIteratorForNodeRank(&idx, 1, 4, 9));
+    i3d_equals(idx, GridIndex3d(1, 1, 1));
+    test_false(grid.setProcessIteratorForNodeRank(&idx, 0, 0, 4));
+
+    // 全ノードの全プロセスで、プロセス座標が重複なく格子を覆う
+    std::vector<int> used(27, 0);
+    for (int node = 0; node < 3; node++) {
+        for (int local = 0; local < 9; local++) {
+            test_true(grid.setProcessIteratorForNodeRank(&idx, node, local, 9));
+            used[grid.getRankForProcess(idx)]++;
+        }
+    }
+    for (int r = 0; r < 27; r++) {
+        int_equals(used[r], 1);
+    }
+
+    // rankを付け直すと、プロセス座標と担当範囲も変わる
+    grid.setMyRank(5);
+    i3d_equals(grid.localProcess_, GridIndex3d(0,1,2));
+    xyz_equals(grid.localBox_.p1_, VectorXYZ(0, 200, 600));
+}
+
 void TestCaseData::run()
 {
     setup();
     testBox();
     testRank();
+    testOptions();
+    testNodePlacement();
 }
 
 int main(int argc, char *argv[])
@@ -23,6 +23,8 @@ public:
 
     void setup();
     void testMigrate();
+    void testKindRanges();
+    void testRespaSplit();
     void run();
 };
 
@@ -63,10 +65,105 @@ void TestCell::testMigrate()
     int_equals(neighbors_[1][0][1].list_.count(), 1);
 }
 
+void TestCell::testKindRanges()
+{
+    // 種類を混ぜて追加しても、同じ種類の粒子はリスト上で連続する
+    int kinds[6] = {2, 0, 2, 1, 0, 2};
+    for (int i = 0; i < 6; i++) {
+        Particle *p = new Particle();
+        p->kind_ = kinds[i];
+        p->serial_ = i;
+        p->pos_.set(115, 130, 145);
+        cell_.addParticle(p);
+    }
+    int expected[6] = {0, 2, 5, 1, 4, 3}; // 区間は最初に現れた種類の順
+    Particle *p = cell_.getParticleListHead();
+    for (int i = 0; i < 6; i++) {
+        int_equals(p->serial_, expected[i]);
+        p = p->next_;
+    }
+    // 区間の先頭をたどると、種類 2, 0, 1 の順に訪れる
+    Particle *s = cell_.getParticleListHead();
+    int_equals(s->kind_, 2);
+    s = cell_.kindRangeEnd(s);
+    int_equals(s->kind_, 0);
+    s = cell_.kindRangeEnd(s);
+    int_equals(s->kind_, 1);
+    test_null(cell_.kindRangeEnd(s));
+
+    // 区間の先頭の粒子が転出しても、区間は保たれる
+    Particle *head = cell_.getParticleListHead();
+    head->pos_ += VectorXYZ(0, -15, 0);
+    cell_.migrateToNeighbor();
+    int_equals(cell_.list_.count(), 5);
+    ptr_equals(cell_.kindHead_[2], cell_.getParticleListHead());
+    int_equals(cell_.kindHead_[2]->serial_, 2);
+    Particle *q = new Particle();
+    q->kind_ = 2;
+    q->serial_ = 6;
+    q->pos_.set(115, 130, 145);
+    cell_.addParticle(q);
+    ptr_equals(cell_.kindTail_[2], q);
+    int_equals(q->next_->kind_, 0);
+}
+
+void TestCell::testRespaSplit()
+{
+    // カットオフ 6、近距離の部分は 3 から 4 で切り替える
+    LJParams::CUTOFF_SQ_ = 36;
+    LJParams::RESPA_INNER_SQ_ = 16;
+    LJParams::RESPA_SWITCH_START_ = 3;
+    LJParams::RESPA_SWITCH_SQ_ = 9;
+    LJParams::RESPA_SWITCH_INV_WIDTH_ = 1;
+    LJParams::PAIR_PARAMS_[0][0].a_ = -48;
+    LJParams::PAIR_PARAMS_[0][0].b_ = 24;
+    LJParams::MOLECULE_PARAMS_[0].dt2_by_2m_ = 0.5;
+
+    Cell cell;
+    cell.setBox(box_);
+    Particle *p = new Particle();
+    Particle *q = new Particle();
+    p->kind_ = q->kind_ = 0;
+    p->pos_.set(112, 130, 145);
+    q->pos_.set(115.5, 130, 145); // 切り替えの中央
+    cell.addParticle(p);
+    cell.addParticle(q);
+
+    cell.clearForces();
+    cell.calcForceWithinSelf();
+    VectorXYZ full = p->a_dt2_half_;
+    test_true(full.x_ != 0);
+
+    // S = 1/2 なので、近距離の部分と遠距離の部分は半分ずつ
+    cell.clearForces();
+    cell.clearSlowForces();
+    cell.calcForceWithinSelf(LJ_FORCE_INNER);
+    cell.calcForceWithinSelf(LJ_FORCE_OUTER);
+    dbl_equals(p->a_dt2_half_.x_, full.x_ * 0.5);
+    dbl_equals(p->a_slow_dt2_half_.x_, full.x_ * 0.5);
+    dbl_equals(q->a_dt2_half_.x_ + q->a_slow_dt2_half_.x_, -full.x_);
+
+    // 切り替えの外側の組は、遠距離の部分だけ
+    q->pos_.set(116.5, 130, 145);
+    cell.clearForces();
+    cell.clearSlowForces();
+    cell.calcForceWithinSelf(LJ_FORCE_INNER);
+    cell.calcForceWithinSelf(LJ_FORCE_OUTER);
+    dbl_equals(p->a_dt2_half_.x_, 0);
+    test_true(p->a_slow_dt2_half_.x_ != 0);
+
+    // r-RESPAの遠距離の部分の速度の更新は、指定のステップ数分
+    p->vel_dt_.clear();
+    cell.updateVelocitySlow(3);
+    dbl_equals(p->vel_dt_.x_, p->a_slow_dt2_half_.x_ * 3);
+}
+
 void TestCell::run()
 {
     setup();
     testMigrate();
+    testKindRanges();
+    testRespaSplit();
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,155 @@
+/*
+ * test_MdBatchData.cpp
+ *
+ */
+
+#include <TestBase.h>
+#include <MdBatchData.h>
+#include <Cell.h>
+
+/*
+ * Tester class for MdBatchData
+ */
+class TestMdBatchData : public TestBase {
+    /*
+     * test target
+     */
+    CaseData caseData_;
+    MdCommData commData_;
+    MdBatchData batchData_;
+
+public:
+
+    void setup();
+    void testRead();
+    void testForce();
+    void testWrap();
+    void testOutputPath();
+    void testBadKinds();
+    void testFullBox();
+    void run();
+};
+
+void TestMdBatchData::setup()
+{
+    caseData_.init("testdata/mdbatchdata/case.txt", 0, 1);
+    LJParams::initParams(&caseData_);
+    commData_.init(&caseData_);
+    std::vector<std::string> files;
+    files.push_back("testdata/mdbatchdata/state_a.txt");
+    files.push_back("testdata/mdbatchdata/state_b.txt");
+    batchData_.init(&caseData_, &commData_, files);
+}
+
+void TestMdBatchData::testRead()
+{
+    int_equals(batchData_.replicaCount(), 2);
+    int_equals(batchData_.getMoleculeCount(), 2);
+    // 添字は 分子の通し番号 * レプリカ数 + レプリカ番号
+    dbl_equals(batchData_.x_[0], 5);
+    dbl_equals(batchData_.x_[1], 1);
+    dbl_equals(batchData_.x_[2], 8);
+    dbl_equals(batchData_.x_[3], 19);
+    // 速度は Δt = 2 を掛けて保持する
+    dbl_equals(batchData_.vx_[1], 0.02);
+    dbl_equals(batchData_.vx_[0], 0);
+}
+
+void TestMdBatchData::testForce()
+{
+    batchData_.calcForce(true);
+    const LJScaledMoleculePairParam &pair = LJParams::PAIR_PARAMS_[0][0];
+    double c = LJParams::MOLECULE_PARAMS_[0].dt2_by_2m_;
+
+    // レプリカ0 : 分子1は分子0から x 方向に 3
+    VectorXYZ d0(3, 0, 0);
+    VectorXYZ f0 = Cell::calcLJforce(&d0, 9, &pair);
+    dbl_equals(batchData_.ax_[0], f0.x_ * c);
+    dbl_equals(batchData_.ax_[2], -f0.x_ * c);
+    double r6 = 9.0 * 9.0 * 9.0;
+    dbl_equals(batchData_.up(0), -pair.a_ / (r6 * r6 * 12) - pair.b_ / (r6 * 6));
+
+    // レプリカ1 : 最小像では、分子1は分子0から周期境界をまたいで x 方向に -2
+    VectorXYZ d1(-2, 0, 0);
+    VectorXYZ f1 = Cell::calcLJforce(&d1, 4, &pair);
+    dbl_equals(batchData_.ax_[1], f1.x_ * c);
+    dbl_equals(batchData_.ax_[3], -f1.x_ * c);
+    dbl_equals(batchData_.ay_[1], 0);
+    r6 = 4.0 * 4.0 * 4.0;
+    dbl_equals(batchData_.up(1), -pair.a_ / (r6 * r6 * 12) - pair.b_ / (r6 * 6));
+}
+
+void TestMdBatchData::testWrap()
+{
+    batchData_.ax_.assign(4, 0);
+    batchData_.vx_[1] = -2; // x = 1 -> -1
+    batchData_.vx_[3] = 3;  // x = 19 -> 22
+    batchData_.updateVelocityHalfAndPosition();
+    dbl_equals(batchData_.x_[1], 19);
+    dbl_equals(batchData_.x_[3], 2);
+    dbl_equals(batchData_.x_[0], 5);
+}
+
+void TestMdBatchData::testOutputPath()
+{
+    test_true(MdBatchData::outputPathFor("energy.txt", 3) == "energy.3.txt");
+    test_true(MdBatchData::outputPathFor("out/energy", 0) == "out/energy.0");
+    test_true(MdBatchData::outputPathFor("./run.d/traj.xyz", 12) == "./run.d/traj.12.xyz");
+    test_true(MdBatchData::outputPathFor("./run.d/traj", 1) == "./run.d/traj.1");
+}
+
+void TestMdBatchData::testBadKinds()
+{
+    // 分子の種類の並びがレプリカ0と異なる
+    bool thrown = false;
+    try {
+        MdBatchData bad;
+        std::vector<std::string> files;
+        files.push_back("testdata/mdbatchdata/state_a.txt");
+        files.push_back("testdata/mdbatchdata/state_bad.txt");
+        bad.init(&caseData_, &commData_, files);
+    } catch (DataException &exp) {
+        thrown = true;
+    }
+    test_true(thrown);
+}
+
+void TestMdBatchData::testFullBox()
+{
+    // プロセス分割 2 2 2 の計算条件でも、rank 0 の担当範囲 (0..10)^3 ではなく箱全体を使う。
+    // state_b.txt には x = 19 の分子がある。
+    CaseData caseData;
+    MdCommData commData;
+    MdBatchData batchData;
+    caseData.init("testdata/mdbatchdata/case_div.txt", 0, 8);
+    commData.init(&caseData);
+    std::vector<std::string> files;
+    files.push_back("testdata/mdbatchdata/state_b.txt");
+    batchData.init(&caseData, &commData, files);
+    int_equals(batchData.getMoleculeCount(), 2);
+    dbl_equals(batchData.x_[1], 19);
+}
+
+void TestMdBatchData::run()
+{
+    setup();
+    testRead();
+    testForce();
+    testWrap();
+    testOutputPath();
+    testBadKinds();
+    testFullBox();
+}
+
+int main(int argc, char *argv[])
+{
+    TestMdBatchData test;
+    try {
+        test.run();
+    } catch (IoException &exp) {
+        std::cout << exp << std::endl;
+    } catch (DataException &exp) {
+        std::cout << exp << std::endl;
+    }
+    return test.report();
+}
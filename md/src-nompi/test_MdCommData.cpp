@@ -8,6 +8,8 @@
 #include <TestBase.h>
 #include <MdCommData.h>
 
+#include <cmath>
+
 /*
  * Tester class for MdCommData
  */
@@ -24,6 +26,8 @@ public:
     void setup();
     void testCommData();
     void testPeerBuffer();
+    void testPosQuantization();
+    void testTrajectoryFilter();
     void run();
 };
 
@@ -61,17 +65,59 @@ void TestMdCommData::setup()
 void TestMdCommData::testCommData()
 {
     commData_.addTrajectoryDataFrom(&cell_);
-    int_equals(commData_.send_molecule_traj_.size(), 3);
-    int_equals(commData_.send_molecule_traj_[1].kind_, 0);
-    int_equals(commData_.send_molecule_traj_[1].serial_, 1);
-    dbl3_equals(commData_.send_molecule_traj_[1].rx_,
-            commData_.send_molecule_traj_[1].ry_,
-            commData_.send_molecule_traj_[1].rz_,
-            20, 21, 22);
-    dbl3_equals(commData_.send_molecule_traj_[1].vx_,
-            commData_.send_molecule_traj_[1].vy_,
-            commData_.send_molecule_traj_[1].vz_,
-            0.55, 0.6, 0.65);
+    // 既定では、座標と速度を double で送る
+    size_equals(commData_.traj_record_size_, (size_t)64);
+    size_equals(commData_.sendTrajectoryCount(), (size_t)3);
+    CommMoleculeTrajData data;
+    commData_.unpackTrajectoryRecord(&commData_.send_molecule_traj_[commData_.traj_record_size_], &data);
+    int_equals(data.kind_, 0);
+    test_true(data.serial_ == 1);
+    dbl3_equals(data.rx_, data.ry_, data.rz_, 20, 21, 22);
+    dbl3_equals(data.vx_, data.vy_, data.vz_, 0.55, 0.6, 0.65);
+    commData_.clearSendTrajectory();
+}
+
+void TestMdCommData::testTrajectoryFilter()
+{
+    // 座標だけを float で、通し番号 1..5 の Ne, Ar を送る
+    CaseData caseData;
+    caseData.init("testdata/mdcommdata/case_traj.txt", 0, 27);
+    MdCommData commData;
+    commData.init(&caseData);
+    size_equals(commData.traj_record_size_, (size_t)24);
+    test_false(commData.isTrajectoryMolecule(1, 0));
+    test_true(commData.isTrajectoryMolecule(1, 1));
+    test_true(commData.isTrajectoryMolecule(2, 5));
+    test_false(commData.isTrajectoryMolecule(2, 6));
+    test_false(commData.isTrajectoryMolecule(0, 3));
+
+    // 通し番号 0..6、種類は He, Ne, Ar の繰り返し。Ne, Ar のうち範囲内は 1, 2, 4, 5
+    Cell cell;
+    cell.setBox(BoxXYZ(0,0,0,100,100,100));
+    for (int i = 6; i >= 0; i--) {
+        Particle *p = new Particle;
+        p->kind_ = i % 3;
+        p->serial_ = i;
+        p->pos_.set(i + 0.25, 1, 2);
+        p->vel_dt_.set(1, 1, 1);
+        cell.addParticle(p);
+    }
+    commData.addTrajectoryDataFrom(&cell);
+    size_equals(commData.sendTrajectoryCount(), (size_t)4);
+
+    // rootでは、種類で絞り込んだので整列して通し番号順に並べる
+    commData.setAllMoleculeCount(4);
+    commData.appendSendTrajectoryDataToRecvTrajectoryData();
+    commData.orderRecvTrajectoryToAllTrajectory();
+    long long expected[4] = {1, 2, 4, 5};
+    for (int i = 0; i < 4; i++) {
+        const CommMoleculeTrajData &d = commData.all_molecule_traj_[i];
+        test_true(d.serial_ == expected[i]);
+        int_equals(d.kind_, expected[i] % 3);
+        dbl3_equals(d.rx_, d.ry_, d.rz_, expected[i] + 0.25, 1, 2);
+        // 速度は送らない
+        dbl3_equals(d.vx_, d.vy_, d.vz_, 0, 0, 0);
+    }
 }
 
 void TestMdCommData::testPeerBuffer()
@@ -80,7 +126,51 @@ void TestMdCommData::testPeerBuffer()
 
     buff->clearSendMoleculeFullBuffer();
     buff->addMoleculeFullDataFrom(&cell_);
-    int_equals(buff->send_molecule_full_.size(), 3);
+    // 粒子はセルから外され、そのまま送信粒子になる
+    int_equals(buff->send_particles_.size(), 3);
+    int_equals(buff->send_count_, 3);
+    test_true(cell_.getParticleListHead() == NULL);
+    int_equals(buff->send_particles_[1]->serial_, 1);
+    dbl3_equals(buff->send_particles_[1]->pos_.x_,
+            buff->send_particles_[1]->pos_.y_,
+            buff->send_particles_[1]->pos_.z_,
+            20, 21, 22);
+
+    commData_.releaseSentParticles(buff);
+    test_true(buff->send_particles_.empty());
+    int_equals(buff->send_count_, 0);
+}
+
+void TestMdCommData::testPosQuantization()
+{
+    // 送信側のセル [10, 16.75) の座標を、周期境界で 27 だけずれた受信側のセル [37, 43.75) で復元する
+    double lo = 10.0;
+    double len = 6.75;
+    double shift = 27.0;
+    double bound = len / 4294967296.0 * 0.5 + 1.0e-12; // 辺の長さ * 2^-33 （と丸め誤差）
+    double xs[] = {10.0, 10.0 + 1.0e-12, 12.345678901234, 16.75 - 1.0e-12, 16.75};
+    for (int i = 0; i < 5; i++) {
+        uint32_t q = CommMoleculePosData::quantize(xs[i], lo, 1.0 / len);
+        double x = CommMoleculePosData::dequantize(q, lo + shift, len);
+        test_true(fabs(x - (xs[i] + shift)) <= bound);
+        // 復元した座標は受信側のセルの範囲内にある
+        test_true(x >= lo + shift && x < lo + shift + len);
+    }
+
+    // 周辺セル用の送信データは、種別と固定小数点の座標だけで16バイトに収まる
+    size_equals(sizeof(CommMoleculePosData), (size_t)16);
+    Cell cell;
+    cell.setBox(BoxXYZ(lo, lo, lo, lo + len, lo + len, lo + len));
+    Particle *p = new Particle;
+    p->kind_ = 2;
+    p->pos_.set(11, 12, 13);
+    cell.addParticle(p);
+    MdCommPeerBuffer *buff = commData_.bufferFor(GridIndex3d(2,1,1));
+    buff->clearSendMoleculePosBuffer();
+    buff->addMoleculePosDataFrom(&cell);
+    int_equals(buff->send_molecule_pos_[0].kind_, 2);
+    double y = CommMoleculePosData::dequantize(buff->send_molecule_pos_[0].qy_, lo, len);
+    test_true(fabs(y - 12) <= bound);
 }
 
 void TestMdCommData::run()
@@ -88,6 +178,8 @@ void TestMdCommData::run()
     setup();
     testCommData();
     testPeerBuffer();
+    testPosQuantization();
+    testTrajectoryFilter();
 }
 
 int main(int argc, char *argv[])
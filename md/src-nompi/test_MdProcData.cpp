@@ -8,6 +8,7 @@
 
 #include <TestBase.h>
 #include <MdProcData.h>
+#include <cmath>
 
 /*
  * Tester class for MdProcData
@@ -24,6 +25,12 @@ public:
 
     void setup();
     void testRanges();
+    void testSingleKind();
+    void testRebin();
+    void testPeriodicCells();
+    void testFusedIntegrator();
+    void testSkinExceeded();
+    void testGenerate();
     void run();
 };
 
@@ -46,12 +53,304 @@ void TestMdProcData::testRanges()
     const GridRange3d &r2 = procData_.surroundingRangeFor(GridIndex3d(1,2,1));
     int3_equals(r2.xmin_, r2.ymin_, r2.zmin_, 1, 4, 1);
     int3_equals(r2.xmax_, r2.ymax_, r2.zmax_, 3, 4, 3);
+
+    // 添字の並びは、レンジをイテレータでたどる順と同じ
+    const std::vector<int> &c1 = procData_.surfaceCellsFor(GridIndex3d(0,1,1));
+    size_equals(c1.size(), (size_t)9);
+    int_equals(c1[0], procData_.cellIndexFor(GridIndex3d(1,1,1)));
+    int_equals(c1[1], procData_.cellIndexFor(GridIndex3d(1,1,2)));
+    int_equals(c1[8], procData_.cellIndexFor(GridIndex3d(1,3,3)));
+    const std::vector<int> &c2 = procData_.surroundingCellsFor(GridIndex3d(1,2,1));
+    size_equals(c2.size(), (size_t)9);
+    int_equals(c2[0], procData_.cellIndexFor(GridIndex3d(1,4,1)));
+    int_equals(c2[8], procData_.cellIndexFor(GridIndex3d(3,4,3)));
+}
+
+void TestMdProcData::testSingleKind()
+{
+    // 初期状態ファイル(atom1.xyz)はHeだけなので、単一種類の系と判定される
+    int_equals(LJParams::SINGLE_KIND_, LJParams::nameToMoleculeKind("He"));
+}
+
+void TestMdProcData::testRebin()
+{
+    // セル(1,1,1)の中央に粒子を置き、x方向に1セル分だけ下に動かすと、周辺セル(0,1,1)に移る
+    Cell *home = procData_.cellFor(GridIndex3d(1, 1, 1));
+    Particle *p = procData_.allocateParticle();
+    p->kind_ = 0;
+    p->serial_ = 999;
+    p->pos_ = (home->cellBox().p1_ + home->cellBox().p2_) * 0.5;
+    p->vel_dt_ = VectorXYZ(-caseData_.clx_, 0, 0);
+    home->addParticle(p);
+    procData_.updatePosition();
+
+    Cell *dest = procData_.cellFor(GridIndex3d(0, 1, 1));
+    ptr_equals(dest->getParticleListHead(), p);
+    test_null(p->next_);
+    for (Particle *q = home->getParticleListHead(); q != NULL; q = q->next_) {
+        test_true(q != p);
+    }
+    procData_.clearSurroundingCells();
+    test_true(dest->empty());
+}
+
+void TestMdProcData::testPeriodicCells()
+{
+    // 全領域を一つのプロセスで受け持つ場合、セル 3x3x3 (100x200x300) の周辺セルは反対側の像
+    CaseData caseData;
+    MdCommData commData;
+    MdProcData procData;
+    caseData.init("testdata/mdprocdata/case_sp.txt", 0, 1);
+    commData.init(&caseData);
+    procData.init(&caseData, &commData);
+
+    // 周辺セル(0,1,4)は、表面セル(3,1,1)の像
+    GridIndex3d src;
+    VectorXYZ shift = procData.periodicImageFor(GridIndex3d(0, 1, 4), &src);
+    int3_equals(src.ix_, src.iy_, src.iz_, 3, 1, 1);
+    xyz_equals(shift, VectorXYZ(-300, 0, 900));
+
+    // 下側の周辺セルに移動した粒子は、上側の表面セルに座標を補正して移される
+    Particle *p = procData.allocateParticle();
+    p->kind_ = 0;
+    p->pos_.set(-10, 50, 850);
+    procData.cellFor(GridIndex3d(0, 1, 3))->addParticle(p);
+    procData.wrapExitingMolecules();
+    test_true(procData.cellFor(GridIndex3d(0, 1, 3))->empty());
+    Cell *dest = procData.cellFor(GridIndex3d(3, 1, 3));
+    bool found = false;
+    for (Particle *q = dest->getParticleListHead(); q != NULL; q = q->next_) {
+        found = found || (q == p);
+    }
+    test_true(found);
+    xyz_equals(p->pos_, VectorXYZ(290, 50, 850));
+
+    // 表面セル(3,1,3)の粒子の像が、周辺セル(0,1,3)と(0,1,0)などに置かれる
+    procData.fillPeriodicGhostCells();
+    bool ghost_x = false;
+    for (Particle *q = procData.cellFor(GridIndex3d(0, 1, 3))->getParticleListHead(); q != NULL; q = q->next_) {
+        ghost_x = ghost_x || (q->pos_.x_ == -10 && q->pos_.y_ == 50 && q->pos_.z_ == 850);
+    }
+    test_true(ghost_x);
+    bool ghost_xz = false;
+    for (Particle *q = procData.cellFor(GridIndex3d(0, 1, 0))->getParticleListHead(); q != NULL; q = q->next_) {
+        ghost_xz = ghost_xz || (q->pos_.x_ == -10 && q->pos_.y_ == 50 && q->pos_.z_ == 850 - 900);
+    }
+    test_true(ghost_xz);
+    procData.clearSurroundingCells();
+    test_true(procData.cellFor(GridIndex3d(0, 1, 0))->empty());
+
+    // 下の面のわずかに外(-1e-14)の粒子は、300を加えると丸めでちょうど300になるが、
+    // 上側の表面セルの半開区間に収められる
+    Particle *q = procData.allocateParticle();
+    q->kind_ = 0;
+    q->pos_.set(-1.0e-14, 50, 150);
+    procData.cellFor(GridIndex3d(0, 1, 1))->addParticle(q);
+    procData.wrapExitingMolecules();
+    Cell *qdest = procData.cellFor(GridIndex3d(3, 1, 1));
+    found = false;
+    for (Particle *r = qdest->getParticleListHead(); r != NULL; r = r->next_) {
+        found = found || (r == q);
+    }
+    test_true(found);
+    test_true(q->pos_.x_ < 300 && q->pos_.x_ > 299.999);
+    test_true(qdest->cellBox().contains(q->pos_));
+
+    // 表面セル(1,1,1)の上端のわずかに下の粒子の像は、300を加えると丸めで周辺セル(4,1,1)の
+    // 上端(400)に乗るが、その半開区間に置かれる
+    Particle *s = procData.allocateParticle();
+    s->kind_ = 0;
+    s->pos_.set(std::nextafter(100.0, 0.0), 50, 150);
+    procData.cellFor(GridIndex3d(1, 1, 1))->addParticle(s);
+    procData.fillPeriodicGhostCells();
+    Cell *ghost = procData.cellFor(GridIndex3d(4, 1, 1));
+    test_false(ghost->empty());
+    for (Particle *r = ghost->getParticleListHead(); r != NULL; r = r->next_) {
+        test_true(ghost->cellBox().contains(r->pos_));
+    }
+    procData.clearSurroundingCells();
+}
+
+void TestMdProcData::testFusedIntegrator()
+{
+    // ローカルセル(1..3)^3 の内部の格子点(2,2,2)の周りと、上限の角の格子点(3,3,3)の周りの
+    // 8セルずつに粒子を置く。力の計算に続けて、各粒子の速度がちょうど一回だけ更新されること。
+    LJParams::initParams(&caseData_);
+    LJParams::SINGLE_KIND_ = 0;
+    std::vector<Particle *> particles;
+    for (int corner = 2; corner <= 3; corner++) {
+        const VectorXYZ &o = procData_.cellFor(GridIndex3d(corner, corner, corner))->cellBox().p1_;
+        GridIterator3d it(GridRange3d(corner - 1, corner - 1, corner - 1, corner, corner, corner));
+        while (it.next()) {
+            Particle *p = procData_.allocateParticle();
+            p->kind_ = 0;
+            p->pos_ = o + VectorXYZ(it.ix_ == corner ? 1 : -1, it.iy_ == corner ? 1 : -1, it.iz_ == corner ? 1 : -1);
+            p->vel_dt_ = VectorXYZ(0, 0, 0);
+            procData_.cellFor(it)->addParticle(p);
+            particles.push_back(p);
+        }
+    }
+    procData_.calcForce(LJ_FORCE_FULL, true);
+    for (size_t i = 0; i < particles.size(); i++) {
+        test_true(particles[i]->a_dt2_half_.square() > 0);
+        xyz_equals(particles[i]->vel_dt_, particles[i]->a_dt2_half_);
+    }
+
+    // 速度と位置の更新と、セルの移動を一度に行う。セル(2,2,2)の粒子に x の負の向きの速度を
+    // 与えると、セル(1,2,2)に移る。
+    Particle *p = particles[7];
+    VectorXYZ expected = p->pos_ + p->vel_dt_ + p->a_dt2_half_;
+    p->vel_dt_ += VectorXYZ(-3, 0, 0);
+    expected += VectorXYZ(-3, 0, 0);
+    procData_.updateVelocityHalfAndPosition();
+    xyz_equals(p->pos_, expected);
+    bool found = false;
+    for (Particle *q = procData_.cellFor(GridIndex3d(1, 2, 2))->getParticleListHead(); q != NULL; q = q->next_) {
+        found = found || (q == p);
+    }
+    test_true(found);
+}
+
+void TestMdProcData::testSkinExceeded()
+{
+    // スキンの幅 2 なので、再構築の間はセルから 1 まではみ出してよい
+    CaseData caseData;
+    MdCommData commData;
+    MdProcData procData;
+    caseData.init("testdata/mdprocdata/case_skin.txt", 5, 27);
+    commData.init(&caseData);
+    procData.init(&caseData, &commData);
+    GridRange3d local(1, 1, 1, 3, 3, 3);
+    GridIterator3d it(local);
+    while (it.next()) {
+        for (Particle *q = procData.cellFor(it)->getParticleListHead(); q != NULL; q = q->next_) {
+            q->vel_dt_.set(0, 0, 0);
+            q->a_dt2_half_.set(0, 0, 0);
+        }
+    }
+    Cell *home = procData.cellFor(GridIndex3d(2, 2, 2));
+    Particle *p = procData.allocateParticle();
+    p->kind_ = 0;
+    p->serial_ = 999;
+    p->pos_ = home->cellBox().p1_ + VectorXYZ(0.5, 10, 10);
+    p->vel_dt_.set(-1, 0, 0);
+    p->a_dt2_half_.set(0, 0, 0);
+    home->addParticle(p);
+
+    // 0.5 だけはみ出す: 元のセルに残る
+    test_true(procData.updateVelocityHalfAndPosition(false));
+    ptr_equals(home->getParticleListHead(), p);
+    GridPeerIterator3d peerIt;
+    while (peerIt.next()) {
+        commData.bufferFor(peerIt)->clearSendMoleculePosBuffer();
+    }
+
+    // 1.5 だけはみ出す: 再構築の回に切り替え、座標送信バッファを捨て、隣のセルに移す
+    test_false(procData.updateVelocityHalfAndPosition(false));
+    procData.abandonHaloRefresh();
+    test_true(home->empty());
+    ptr_equals(procData.cellFor(GridIndex3d(1, 2, 2))->getParticleListHead(), p);
+    test_true(commData.bufferFor(GridIndex3d(0, 1, 1))->send_molecule_pos_.empty());
+}
+
+/*
+ * 本プロセスのローカルセル（3x3x3）の分子について、数と種類、速度の和を求める
+ */
+static long long sumLocalParticles(MdProcData &procData, double *kind_sum, VectorXYZ *vel_sum)
+{
+    long long n = 0;
+    *kind_sum = 0;
+    vel_sum->set(0, 0, 0);
+    GridRange3d local(1, 1, 1, 3, 3, 3);
+    GridIterator3d it(local);
+    while (it.next()) {
+        for (Particle *p = procData.cellFor(it)->getParticleListHead(); p != NULL; p = p->next_) {
+            n++;
+            *kind_sum += (double)p->serial_ * p->kind_;
+            *vel_sum += p->vel_dt_;
+        }
+    }
+    return n;
+}
+
+void TestMdProcData::testGenerate()
+{
+    // 60^3 の箱に格子定数6のfcc格子: 10^3 個の単位格子に4個ずつ
+    long long total = 0;
+    double sums[MdProcData::GENERATED_SUMS] = {0};
+    double kind_sum5 = 0;
+    VectorXYZ vel_sum5;
+    double local5[MdProcData::GENERATED_SUMS];
+    for (int rank = 0; rank < 27; rank++) {
+        CaseData caseData;
+        MdCommData commData;
+        MdProcData procData;
+        caseData.init("testdata/mdprocdata/case_lattice.txt", rank, 27);
+        commData.init(&caseData);
+        procData.init(&caseData, &commData);
+        long long total_count = procData.getMoleculeCount();
+        test_true(total_count == 4000);
+        double kind_sum;
+        VectorXYZ vel_sum;
+        long long n = sumLocalParticles(procData, &kind_sum, &vel_sum);
+        // 箱 20^3 の各プロセスには、単位格子 (20/6)^3 個分にあたる格子点のうち、箱に入るものだけが生成される
+        test_true(n > 0 && n < total_count);
+        total += n;
+        double local[MdProcData::GENERATED_SUMS];
+        procData.sumGeneratedState(local);
+        for (int i = 0; i < MdProcData::GENERATED_SUMS; i++) {
+            sums[i] += local[i];
+        }
+        if (rank == 5) {
+            kind_sum5 = kind_sum;
+            vel_sum5 = vel_sum;
+            for (int i = 0; i < MdProcData::GENERATED_SUMS; i++) {
+                local5[i] = local[i];
+            }
+        }
+    }
+    // 各格子点は、ちょうど一つのプロセスで生成される
+    test_true(total == 4000);
+    // トラジェクトリーは全分子を出力する
+    dbl_equals(sums[4], 4000);
+    // He と Ar が混ざっている（全部Heなら 4.0026*4000, 全部Arなら 39.948*4000）
+    test_true(sums[3] > 4.1 * 4000 && sums[3] < 39.9 * 4000);
+
+    // 同じ乱数の種からは、同じ種類と速度が生成される
+    CaseData caseData;
+    MdCommData commData;
+    MdProcData procData;
+    caseData.init("testdata/mdprocdata/case_lattice.txt", 5, 27);
+    commData.init(&caseData);
+    procData.init(&caseData, &commData);
+    double kind_sum;
+    VectorXYZ vel_sum;
+    sumLocalParticles(procData, &kind_sum, &vel_sum);
+    dbl_equals(kind_sum, kind_sum5);
+    xyz_equals(vel_sum, vel_sum5);
+    test_true(kind_sum > 0);
+
+    // 全rankの和を与えると、重心速度が差し引かれ、トラジェクトリーの分子数が全体の数になる
+    procData.finishGeneratedState(sums);
+    test_true(procData.getTrajectoryMoleculeCount() == 4000);
+    double local[MdProcData::GENERATED_SUMS];
+    procData.sumGeneratedState(local);
+    dbl3_equals(local[0], local[1], local[2],
+                local5[0] - local5[3] * sums[0] / sums[3],
+                local5[1] - local5[3] * sums[1] / sums[3],
+                local5[2] - local5[3] * sums[2] / sums[3]);
 }
 
 void TestMdProcData::run()
 {
     setup();
     testRanges();
+    testSingleKind();
+    testRebin();
+    testPeriodicCells();
+    testFusedIntegrator();
+    testSkinExceeded();
+    testGenerate();
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,112 @@
+/*
+ * test_MultiTauCorrelator.cpp
+ *
+ */
+
+#include <TestBase.h>
+#include <MultiTauCorrelator.h>
+
+/*
+ * Tester class for MultiTauCorrelator
+ */
+class TestMultiTauCorrelator : public TestBase {
+    /*
+     * test target
+     */
+    MultiTauCorrelator corr_;
+
+public:
+
+    void testSlots();
+    void testStraightMotion();
+    void testPackState();
+    void testWrapPosition();
+    void run();
+};
+
+void TestMultiTauCorrelator::testSlots()
+{
+    corr_.init(3, 4, 1.0);
+    test_true(corr_.isActive());
+    // 1段あたり 9 + 4*6 個、先頭に補正量3個
+    int_equals(corr_.stateSize(), 3 + 3 * 33);
+    int s0 = corr_.allocateSlot();
+    int s1 = corr_.allocateSlot();
+    int_equals(s0, 0);
+    int_equals(s1, 1);
+    corr_.freeSlot(s0);
+    // 返却されたスロットが再利用される
+    int_equals(corr_.allocateSlot(), 0);
+}
+
+void TestMultiTauCorrelator::testStraightMotion()
+{
+    // 等速直線運動では、平均を取った段でも MSD = (v*tau)^2, VACF = v^2 が厳密に成り立つ
+    corr_.init(3, 4, 2.0);
+    int slot = corr_.allocateSlot();
+    VectorXYZ vel(0.5, 0, 0);
+    for (int i = 0; i < 64; i++) {
+        // 位置は周期境界で折り返されていてもよいように、補正量はスロットが持つ
+        VectorXYZ pos(i * 2.0 * 0.5, 1, 1);
+        corr_.sample(slot, pos, vel);
+    }
+    for (int l = 0; l < 3; l++) {
+        int jmin = (l == 0) ? 0 : 2;
+        for (int j = jmin; j < 4; j++) {
+            double tau = corr_.lagTime(l, j);
+            test_true(corr_.count(l, j) > 0);
+            dbl_equals(corr_.msd(l, j), 0.25 * tau * tau);
+            dbl_equals(corr_.vacf(l, j), 0.25);
+        }
+    }
+    dbl_equals(corr_.lagTime(2, 3), 2.0 * 4 * 3);
+    // 第0段の遅れ0のサンプル数は、サンプル数そのもの
+    dbl_equals(corr_.count(0, 0), 64);
+}
+
+void TestMultiTauCorrelator::testPackState()
+{
+    corr_.init(2, 4, 1.0);
+    int slot = corr_.allocateSlot();
+    VectorXYZ vel(1, 0, 0);
+    corr_.sample(slot, VectorXYZ(9, 0, 0), vel);
+
+    // 周期境界をまたいで x が 10 だけ戻される移転
+    std::vector<double> buf;
+    corr_.packState(slot, VectorXYZ(-10, 0, 0), buf);
+    size_equals(buf.size(), (size_t)corr_.stateSize());
+    int slot2 = corr_.unpackState(&buf[0]);
+    // 返却したスロットが再利用される
+    int_equals(slot2, slot);
+
+    // 折り返し後の座標 0 は、折り返し前の 10 として扱われる
+    corr_.sample(slot2, VectorXYZ(0, 0, 0), vel);
+    dbl_equals(corr_.msd(0, 1), 1.0);
+}
+
+void TestMultiTauCorrelator::testWrapPosition()
+{
+    corr_.init(2, 4, 1.0);
+    int slot = corr_.allocateSlot();
+    VectorXYZ vel(1, 0, 0);
+    corr_.sample(slot, VectorXYZ(9, 0, 0), vel);
+    // プロセス内で x が 10 だけ戻される折り返し
+    corr_.wrapPosition(slot, VectorXYZ(-10, 0, 0));
+    corr_.sample(slot, VectorXYZ(0, 0, 0), vel);
+    dbl_equals(corr_.msd(0, 1), 1.0);
+}
+
+void TestMultiTauCorrelator::run()
+{
+    testSlots();
+    testStraightMotion();
+    testPackState();
+    testWrapPosition();
+}
+
+int main(int argc, char *argv[])
+{
+    TestMultiTauCorrelator test;
+    test.run();
+    return test.report();
+}
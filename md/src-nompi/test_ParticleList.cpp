@@ -37,6 +37,18 @@ void TestParticleList::run()
     ptr_equals(list_.tail_, q);
     ptr_equals(p->next_, q);
     ptr_equals(q->prev_, p);
+    // 途中への挿入
+    Particle *r = new Particle();
+    list_.insertAfter(p, r);
+    ptr_equals(p->next_, r);
+    ptr_equals(r->next_, q);
+    ptr_equals(q->prev_, r);
+    ptr_equals(list_.tail_, q);
+    // 末尾への挿入
+    Particle *s = new Particle();
+    list_.insertAfter(q, s);
+    ptr_equals(list_.tail_, s);
+    int_equals(list_.count(), 4);
 }
 
 int main(int argc, char *argv[])
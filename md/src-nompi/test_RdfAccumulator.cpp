@@ -0,0 +1,121 @@
+/*
+ * test_RdfAccumulator.cpp
+ *
+ */
+
+#include <TestBase.h>
+#include <RdfAccumulator.h>
+
+#include <sstream>
+#include <cmath>
+
+/*
+ * Tester class for RdfAccumulator
+ */
+class TestRdfAccumulator : public TestBase {
+    /*
+     * test target
+     */
+    RdfAccumulator rdf_;
+
+public:
+
+    void testPairIndex();
+    void testBinning();
+    void testWrite();
+    void run();
+};
+
+void TestRdfAccumulator::testPairIndex()
+{
+    // 上三角の組み合わせ番号が重複なく 0..PAIR_TYPES-1 を覆い、順序に依存しないこと
+    std::vector<int> used(RdfAccumulator::PAIR_TYPES, 0);
+    for (int ki = 0; ki < LJ_MOLECULE_TYPES; ki++) {
+        for (int kj = ki; kj < LJ_MOLECULE_TYPES; kj++) {
+            int idx = RdfAccumulator::pairIndex(ki, kj);
+            test_true(idx >= 0 && idx < RdfAccumulator::PAIR_TYPES);
+            int_equals(RdfAccumulator::pairIndex(kj, ki), idx);
+            used[idx]++;
+        }
+    }
+    for (int i = 0; i < RdfAccumulator::PAIR_TYPES; i++) {
+        int_equals(used[i], 1);
+    }
+}
+
+void TestRdfAccumulator::testBinning()
+{
+    // rc = 10, r^2 の幅 10 のビンが10個
+    rdf_.init(10, 10.0);
+    test_true(rdf_.isActive());
+    int_equals(rdf_.binCount(), 10);
+    dbl_equals(rdf_.rLower(0), 0);
+    dbl_equals(rdf_.rLower(1), sqrt(10.0));
+    dbl_equals(rdf_.rUpper(9), 10.0);
+
+    rdf_.addPair(0, 0, 5.0, 2);
+    rdf_.addPair(1, 0, 99.999, 1);
+    rdf_.addPair(0, 1, 95.0, 1);
+    dbl_equals(rdf_.pairCount(0, 0, 0), 1.0);
+    dbl_equals(rdf_.pairCount(0, 1, 9), 1.0);
+    dbl_equals(rdf_.pairCount(1, 0, 9), 1.0);
+    dbl_equals(rdf_.pairCount(0, 0, 1), 0.0);
+
+    rdf_.addMolecule(2);
+    rdf_.endSample();
+    test_true(rdf_.moleculeCount(2) == 1);
+    test_true(rdf_.sampleCount() == 1);
+
+    rdf_.clear();
+    dbl_equals(rdf_.pairCount(0, 0, 0), 0.0);
+    test_true(rdf_.sampleCount() == 0);
+}
+
+void TestRdfAccumulator::testWrite()
+{
+    // rc = 2, r^2 の幅 1 のビンが4個。He 10個を1サンプル。
+    rdf_.init(4, 2.0);
+    for (int i = 0; i < 10; i++) {
+        rdf_.addMolecule(0);
+    }
+    for (int i = 0; i < 3; i++) {
+        rdf_.addPair(0, 0, 1.5, 2); // ビン1 : 1 <= r < sqrt(2)
+    }
+    rdf_.endSample();
+
+    double volume = 1000.0;
+    std::stringstream ss;
+    rdf_.write(ss, volume);
+
+    std::string line;
+    std::getline(ss, line); // samples
+    std::getline(ss, line); // column names
+    test_true(line == "# r_lower r_upper He-He");
+    std::getline(ss, line); // bin 0
+    std::getline(ss, line); // bin 1
+    std::stringstream ls(line);
+    double rl, ru, g;
+    ls >> rl >> ru >> g;
+    // 出力は有効数字6桁
+    setTolerance(1.0e-3);
+    double r2 = sqrt(2.0);
+    double shell = 4.0 / 3.0 * M_PI * (r2 * r2 * r2 - 1.0);
+    double expected = 10.0 * 9.0 / 2.0 / volume * shell;
+    dbl_equals(rl, 1.0);
+    dbl_equals(ru, r2);
+    dbl_equals(g, 3.0 / expected);
+}
+
+void TestRdfAccumulator::run()
+{
+    testPairIndex();
+    testBinning();
+    testWrite();
+}
+
+int main(int argc, char *argv[])
+{
+    TestRdfAccumulator test;
+    test.run();
+    return test.report();
+}
@@ -0,0 +1,79 @@
+/*
+ * test_ReplicaList.cpp
+ *
+ */
+
+#include <TestBase.h>
+#include <ReplicaList.h>
+#include <IoException.h>
+#include <DataException.h>
+
+/*
+ * Tester class for ReplicaList
+ */
+class TestReplicaList : public TestBase {
+    /*
+     * test target
+     */
+    ReplicaList replicas_;
+
+public:
+
+    void testRead();
+    void testRanks();
+    void testBadFile();
+    void run();
+};
+
+void TestReplicaList::testRead()
+{
+    replicas_.read("testdata/replicalist/replicas.txt");
+    int_equals(replicas_.size(), 3);
+    int_equals(replicas_.totalProcs(), 36);
+    int_equals(replicas_.procs(1), 1);
+    int_equals(replicas_.firstRank(2), 9);
+    test_true(replicas_.caseFile(0) == "case_a.txt");
+    test_true(replicas_.caseFile(2) == "sub/case_c.txt");
+}
+
+void TestReplicaList::testRanks()
+{
+    // rank 0..7 : 0, 8 : 1, 9..35 : 2
+    int_equals(replicas_.replicaForRank(0), 0);
+    int_equals(replicas_.replicaForRank(7), 0);
+    int_equals(replicas_.replicaForRank(8), 1);
+    int_equals(replicas_.replicaForRank(9), 2);
+    int_equals(replicas_.replicaForRank(35), 2);
+}
+
+void TestReplicaList::testBadFile()
+{
+    bool thrown = false;
+    try {
+        ReplicaList bad;
+        bad.read("testdata/replicalist/bad.txt");
+    } catch (DataException &exp) {
+        thrown = true;
+    }
+    test_true(thrown);
+}
+
+void TestReplicaList::run()
+{
+    testRead();
+    testRanks();
+    testBadFile();
+}
+
+int main(int argc, char *argv[])
+{
+    TestReplicaList test;
+    try {
+        test.run();
+    } catch (IoException &exp) {
+        std::cout << exp << std::endl;
+    } catch (DataException &exp) {
+        std::cout << exp << std::endl;
+    }
+    return test.report();
+}